@@ -14,15 +14,29 @@ auto shaderHeader = R"(#version 150 core
 
 auto fillVertShader = R"(
 	uniform vec2 viewSize;
+	uniform float vertexScale;	// 1/8 for compact vertices
 	in vec2 vertex;
 	in vec2 tcoord;
+	in vec4 instPos;	// center, unit x axis
+	in vec4 instShape;	// half extents, radius, fringe
+	in vec4 instColor;
 	out vec2 ftcoord;
 	out vec2 fpos;
+	out vec4 fshape;
+	out vec4 fcolor;
 
 void main(void) {
+	vec2 pos = vertex * vertexScale;
 	ftcoord = tcoord;
-	fpos = vertex;
-	gl_Position = vec4(2.0*vertex.x/viewSize.x - 1.0, 1.0 - 2.0*vertex.y/viewSize.y, 0, 1);
+	if (instShape.w > 0.0) {
+		// Instanced rectangle, vertex is a corner of the unit quad.
+		ftcoord = pos * (instShape.xy + instShape.w);
+		pos = instPos.xy + ftcoord.x * instPos.zw + ftcoord.y * vec2(-instPos.w, instPos.z);
+	}
+	fpos = pos;
+	fshape = instShape;
+	fcolor = instColor;
+	gl_Position = vec4(2.0*pos.x/viewSize.x - 1.0, 1.0 - 2.0*pos.y/viewSize.y, 0, 1);
 }
 )";
 
@@ -46,6 +60,8 @@ auto fillFragShader = R"(
 	uniform sampler2D tex;
 	in vec2 ftcoord;
 	in vec2 fpos;
+	in vec4 fshape;
+	in vec4 fcolor;
 	out vec4 outColor;
 
 float sdroundrect(vec2 pt, vec2 ext, float rad) {
@@ -54,8 +70,9 @@ float sdroundrect(vec2 pt, vec2 ext, float rad) {
 	return min(max(d.x,d.y),0.0) + length(max(d,0.0)) - rad;
 }
 
-// Scissoring
+// Scissoring, negative extent when there is none or it is done by glScissor.
 float scissorMask(vec2 p) {
+	if (scissorExt.x < 0.0) return 1.0;
 	vec2 sc = (abs((scissorMat * vec3(p,1.0)).xy) - scissorExt);
 	sc = vec2(0.5,0.5) - sc * scissorScale;
 	return clamp(sc.x,0.0,1.0) * clamp(sc.y,0.0,1.0);
@@ -67,15 +84,38 @@ float strokeMask() {
 }
 #endif
 
+// Texture lookup, converted to premultiplied color.
+vec4 texColor(vec2 uv) {
+	vec4 color = texture(tex, uv);
+	if (texType == 1) color = vec4(color.xyz*color.w,color.w);
+	if (texType == 2) color = vec4(color.x);
+	if (texType == 3) {
+		// Distance field - the edge is at 0.5, antialiased over a pixel
+		// and widened by the feather for blur.
+		float w = 0.5 * fwidth(color.x) + feather;
+		color = vec4(smoothstep(0.5 - w, 0.5 + w, color.x));
+	}
+	return color;
+}
+
+// Instanced shape - ftcoord is the position relative to the shape center.
+float shapeMask() {
+	float d = sdroundrect(ftcoord, fshape.xy, fshape.z);
+	return clamp(0.5 - d / fshape.w, 0.0, 1.0);
+}
+
 void main(void) {
   vec4 result;
 	float scissor = scissorMask(fpos);
-#ifdef EDGE_AA
-	float strokeAlpha = strokeMask();
-	if (strokeAlpha < strokeThr) discard;
-#else
 	float strokeAlpha = 1.0;
+	if (fshape.w > 0.0) {
+		strokeAlpha = shapeMask();
+	} else {
+#ifdef EDGE_AA
+		strokeAlpha = strokeMask();
+		if (strokeAlpha < strokeThr) discard;
 #endif
+	}
 	if (type == 0) {			// Gradient
 		// Calculate gradient color using box gradient
 		vec2 pt = (paintMat * vec3(fpos,1.0)).xy;
@@ -87,9 +127,7 @@ void main(void) {
 	} else if (type == 1) {		// Image
 		// Calculate color fron texture
 		vec2 pt = (paintMat * vec3(fpos,1.0)).xy / extent;
-		vec4 color = texture(tex, pt);
-		if (texType == 1) color = vec4(color.xyz*color.w,color.w);
-		if (texType == 2) color = vec4(color.x);
+		vec4 color = texColor(pt);
 		// Apply color tint and alpha.
 		color *= innerCol;
 		// Combine alpha
@@ -98,13 +136,11 @@ void main(void) {
 	} else if (type == 2) {		// Stencil fill
 		result = vec4(1,1,1,1);
 	} else if (type == 3) {		// Textured tris
-		vec4 color = texture(tex, ftcoord);
-		if (texType == 1) color = vec4(color.xyz*color.w,color.w);
-		if (texType == 2) color = vec4(color.x);
+		vec4 color = texColor(ftcoord);
 		color *= scissor;
 		result = color * innerCol;
 	}
-	outColor = result;
+	outColor = result * fcolor;
 };
 )";
 
@@ -183,8 +219,11 @@ std::shared_ptr<GLNVGshader> GLNVGshader::create(bool useAntiAlias) {
     glAttachShader(shader->prog, shader->vert);
     glAttachShader(shader->prog, shader->frag);
 
-    glBindAttribLocation(shader->prog, 0, "vertex");
-    glBindAttribLocation(shader->prog, 1, "tcoord");
+    glBindAttribLocation(shader->prog, GLNVG_ATTR_VERTEX, "vertex");
+    glBindAttribLocation(shader->prog, GLNVG_ATTR_TCOORD, "tcoord");
+    glBindAttribLocation(shader->prog, GLNVG_ATTR_INSTPOS, "instPos");
+    glBindAttribLocation(shader->prog, GLNVG_ATTR_INSTSHAPE, "instShape");
+    glBindAttribLocation(shader->prog, GLNVG_ATTR_INSTCOLOR, "instColor");
 
     glLinkProgram(shader->prog);
     glGetProgramiv(shader->prog, GL_LINK_STATUS, &status);
@@ -198,6 +237,7 @@ std::shared_ptr<GLNVGshader> GLNVGshader::create(bool useAntiAlias) {
 
 void GLNVGshader::getUniforms() {
     loc[GLNVG_LOC_VIEWSIZE] = glGetUniformLocation(prog, "viewSize");
+    loc[GLNVG_LOC_VERTEXSCALE] = glGetUniformLocation(prog, "vertexScale");
     loc[GLNVG_LOC_TEX] = glGetUniformLocation(prog, "tex");
     loc[GLNVG_LOC_FRAG] = glGetUniformBlockIndex(prog, "frag");
 }
@@ -210,3 +250,7 @@ void GLNVGshader::set_texture_and_view(int texture, const float view[2]) {
     glUniform1i(loc[GLNVG_LOC_TEX], texture);
     glUniform2fv(loc[GLNVG_LOC_VIEWSIZE], 1, view);
 }
+
+void GLNVGshader::set_vertex_scale(float scale) {
+    glUniform1f(loc[GLNVG_LOC_VERTEXSCALE], scale);
+}
@@ -3,12 +3,21 @@
 
 enum GLNVGuniformLoc {
   GLNVG_LOC_VIEWSIZE,
+  GLNVG_LOC_VERTEXSCALE,
   GLNVG_LOC_TEX,
   GLNVG_LOC_FRAG,
   GLNVG_MAX_LOCS
 };
 
 
+enum GLNVGattribLoc {
+  GLNVG_ATTR_VERTEX,
+  GLNVG_ATTR_TCOORD,
+  GLNVG_ATTR_INSTPOS,
+  GLNVG_ATTR_INSTSHAPE,
+  GLNVG_ATTR_INSTCOLOR,
+};
+
 enum GLNVGuniformBindings {
   GLNVG_FRAG_BINDING = 0,
 };
@@ -27,4 +36,6 @@ public:
   void getUniforms();
   void blockBind();
   void set_texture_and_view(int texture, const float view[2]);
+  // Scale from the vertex positions to pixels.
+  void set_vertex_scale(float scale);
 };
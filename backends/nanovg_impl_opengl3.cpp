@@ -57,6 +57,15 @@ static NVGtextureInfo *glnvg__renderGetTexture(struct NVGparams *params, int ima
   return (NVGtextureInfo *)tex.get();
 }
 
+static int glnvg__renderUniformSize()
+{
+  if (!g_renderer)
+  {
+    return 0;
+  }
+  return g_renderer->fragSize();
+}
+
 bool nvg_ImplOpenGL3_Init(struct NVGcontext *vg)
 {
   auto params = nvgParams(vg);
@@ -65,6 +74,7 @@ bool nvg_ImplOpenGL3_Init(struct NVGcontext *vg)
   params->renderDeleteTexture = glnvg__renderDeleteTexture;
   params->renderUpdateTexture = glnvg__renderUpdateTexture;
   params->renderGetTexture = glnvg__renderGetTexture;
+  params->renderUniformSize = glnvg__renderUniformSize;
   return true;
 }
 
@@ -2,6 +2,7 @@
 #include "nanovg_gl_shader.h"
 #include "texture_manager.h"
 #include <assert.h>
+#include <string.h>
 #include <glad/glad.h>
 #include <memory>
 
@@ -61,6 +62,8 @@ unsigned int _stencilFunc = {};
 int _stencilFuncRef = {};
 unsigned int _stencilFuncMask = {};
 GLNVGblend _blendFunc = {};
+int _scissorEnabled = {};
+int _scissorRect[4] = {};
 
 static void glnvg__stencilMask(GLuint mask) {
   if (_stencilMask != mask) {
@@ -80,6 +83,29 @@ static void glnvg__stencilFunc(GLenum func, GLint ref, GLuint mask) {
   }
 }
 
+// Applies the hardware scissor of the call. The rect is from the top left
+// corner, glScissor counts from the bottom.
+static void glnvg__scissor(const GLNVGcall *call, int fbHeight) {
+  if (!call->hwScissor) {
+    if (_scissorEnabled) {
+      _scissorEnabled = 0;
+      glDisable(GL_SCISSOR_TEST);
+    }
+    return;
+  }
+  if (!_scissorEnabled) {
+    _scissorEnabled = 1;
+    glEnable(GL_SCISSOR_TEST);
+  }
+  int rect[4] = {call->scissorRect[0],
+                 fbHeight - call->scissorRect[1] - call->scissorRect[3],
+                 call->scissorRect[2], call->scissorRect[3]};
+  if (memcmp(_scissorRect, rect, sizeof(rect)) != 0) {
+    memcpy(_scissorRect, rect, sizeof(rect));
+    glScissor(rect[0], rect[1], rect[2], rect[3]);
+  }
+}
+
 // TODO:
 int _flags = 0;
 static void glnvg__checkError(const char *str) {
@@ -103,14 +129,17 @@ Renderer::Renderer(const std::shared_ptr<GLNVGshader> &shader)
   // Create dynamic vertex array
   glGenVertexArrays(1, &_vertArr);
   glGenBuffers(1, &_vertBuf);
+  glGenBuffers(1, &_instBuf);
+  glGenBuffers(1, &_indexBuf);
 
   // Create UBOs
   int align = 4;
   _shader->blockBind();
   glGenBuffers(1, &_fragBuf);
   glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
-  _fragSize =
-      sizeof(GLNVGfragUniforms) + align - sizeof(GLNVGfragUniforms) % align;
+  // Uniform blocks are packed at the smallest stride the driver accepts as a
+  // buffer range offset, see NVGparams::renderUniformSize.
+  _fragSize = ((int)sizeof(GLNVGfragUniforms) + align - 1) / align * align;
 
   glnvg__checkError("create done");
 
@@ -124,6 +153,10 @@ Renderer::~Renderer() {
     glDeleteVertexArrays(1, &_vertArr);
   if (_vertBuf != 0)
     glDeleteBuffers(1, &_vertBuf);
+  if (_instBuf != 0)
+    glDeleteBuffers(1, &_instBuf);
+  if (_indexBuf != 0)
+    glDeleteBuffers(1, &_indexBuf);
 }
 
 std::shared_ptr<Renderer> Renderer::create(bool useAntiAlias) {
@@ -147,9 +180,43 @@ void Renderer::glnvg__blendFuncSeparate(const GLNVGblend *blend) {
   }
 }
 
+// Draws the fill or the stroke vertex ranges of the paths with one call.
+void Renderer::glnvg__drawPaths(GLenum mode, const GLNVGpath *paths,
+                                int npaths, bool fill) {
+  _first.clear();
+  _count.clear();
+  for (int i = 0; i < npaths; i++) {
+    int count = fill ? paths[i].fillCount : paths[i].strokeCount;
+    if (count <= 0)
+      continue;
+    _first.push_back(fill ? paths[i].fillOffset : paths[i].strokeOffset);
+    _count.push_back(count);
+  }
+  if (!_first.empty())
+    glMultiDrawArrays(mode, _first.data(), _count.data(),
+                      (GLsizei)_first.size());
+}
+
+// Draws a range of the triangle list indices of NVG_INDEXED.
+void Renderer::glnvg__drawIndices(int offset, int count) {
+  if (count > 0)
+    glDrawElements(GL_TRIANGLES, count, _indexType,
+                   (const GLvoid *)((size_t)offset * _indexSize));
+}
+
+// Draws the fringes or the strokes of the paths of the call.
+void Renderer::glnvg__drawStrokes(const GLNVGcall *call,
+                                  const GLNVGpath *paths, int npaths) {
+  if (call->indexCount > 0)
+    glnvg__drawIndices(call->indexOffset + call->fillIndexCount,
+                       call->indexCount - call->fillIndexCount);
+  else
+    glnvg__drawPaths(GL_TRIANGLE_STRIP, paths, npaths, false);
+}
+
 void Renderer::glnvg__fill(const GLNVGcall *call, const GLNVGpath *pPath) {
   auto paths = &pPath[call->pathOffset];
-  int i, npaths = call->pathCount;
+  int npaths = call->pathCount;
 
   // Draw shapes
   glEnable(GL_STENCIL_TEST);
@@ -165,8 +232,10 @@ void Renderer::glnvg__fill(const GLNVGcall *call, const GLNVGpath *pPath) {
   glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_KEEP, GL_INCR_WRAP);
   glStencilOpSeparate(GL_BACK, GL_KEEP, GL_KEEP, GL_DECR_WRAP);
   glDisable(GL_CULL_FACE);
-  for (i = 0; i < npaths; i++)
-    glDrawArrays(GL_TRIANGLE_FAN, paths[i].fillOffset, paths[i].fillCount);
+  if (call->indexCount > 0)
+    glnvg__drawIndices(call->indexOffset, call->fillIndexCount);
+  else
+    glnvg__drawPaths(GL_TRIANGLE_FAN, paths, npaths, true);
   glEnable(GL_CULL_FACE);
 
   // Draw anti-aliased pixels
@@ -180,9 +249,7 @@ void Renderer::glnvg__fill(const GLNVGcall *call, const GLNVGpath *pPath) {
     glnvg__stencilFunc(GL_EQUAL, 0x00, 0xff);
     glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
     // Draw fringes
-    for (i = 0; i < npaths; i++)
-      glDrawArrays(GL_TRIANGLE_STRIP, paths[i].strokeOffset,
-                   paths[i].strokeCount);
+    glnvg__drawStrokes(call, paths, npaths);
   }
 
   // Draw fill
@@ -196,25 +263,30 @@ void Renderer::glnvg__fill(const GLNVGcall *call, const GLNVGpath *pPath) {
 void Renderer::glnvg__convexFill(const GLNVGcall *call,
                                  const GLNVGpath *pPaths) {
   auto paths = &pPaths[call->pathOffset];
-  int i, npaths = call->pathCount;
+  int npaths = call->pathCount;
 
   glnvg__setUniforms(call->uniformOffset);
   _texture->bind(call->image);
   glnvg__checkError("convex fill");
 
-  for (i = 0; i < npaths; i++) {
-    glDrawArrays(GL_TRIANGLE_FAN, paths[i].fillOffset, paths[i].fillCount);
-    // Draw fringes
-    if (paths[i].strokeCount > 0) {
-      glDrawArrays(GL_TRIANGLE_STRIP, paths[i].strokeOffset,
-                   paths[i].strokeCount);
-    }
+  // Indexed fills and fringes are one triangle list.
+  if (call->indexCount > 0) {
+    glnvg__drawIndices(call->indexOffset, call->indexCount);
+    return;
   }
+
+  // Merged calls draw all the fills before the fringes, the paint is the
+  // same for all of them. Triangulated concave fills are triangle lists.
+  glnvg__drawPaths(call->type == GLNVG_CONCAVEFILL ? GL_TRIANGLES
+                                                   : GL_TRIANGLE_FAN,
+                   paths, npaths, true);
+  // Draw fringes
+  glnvg__drawPaths(GL_TRIANGLE_STRIP, paths, npaths, false);
 }
 
 void Renderer::glnvg__stroke(const GLNVGcall *call, const GLNVGpath *pPaths) {
   auto paths = &pPaths[call->pathOffset];
-  int npaths = call->pathCount, i;
+  int npaths = call->pathCount;
 
   if (_flags & NVG_STENCIL_STROKES) {
     glEnable(GL_STENCIL_TEST);
@@ -226,27 +298,21 @@ void Renderer::glnvg__stroke(const GLNVGcall *call, const GLNVGpath *pPaths) {
     glnvg__setUniforms(call->uniformOffset + _fragSize);
     _texture->bind(call->image);
     glnvg__checkError("stroke fill 0");
-    for (i = 0; i < npaths; i++)
-      glDrawArrays(GL_TRIANGLE_STRIP, paths[i].strokeOffset,
-                   paths[i].strokeCount);
+    glnvg__drawStrokes(call, paths, npaths);
 
     // Draw anti-aliased pixels.
     glnvg__setUniforms(call->uniformOffset);
     _texture->bind(call->image);
     glnvg__stencilFunc(GL_EQUAL, 0x00, 0xff);
     glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
-    for (i = 0; i < npaths; i++)
-      glDrawArrays(GL_TRIANGLE_STRIP, paths[i].strokeOffset,
-                   paths[i].strokeCount);
+    glnvg__drawStrokes(call, paths, npaths);
 
     // Clear stencil buffer.
     glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
     glnvg__stencilFunc(GL_ALWAYS, 0x0, 0xff);
     glStencilOp(GL_ZERO, GL_ZERO, GL_ZERO);
     glnvg__checkError("stroke fill 1");
-    for (i = 0; i < npaths; i++)
-      glDrawArrays(GL_TRIANGLE_STRIP, paths[i].strokeOffset,
-                   paths[i].strokeCount);
+    glnvg__drawStrokes(call, paths, npaths);
     glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
 
     glDisable(GL_STENCIL_TEST);
@@ -260,9 +326,7 @@ void Renderer::glnvg__stroke(const GLNVGcall *call, const GLNVGpath *pPaths) {
     _texture->bind(call->image);
     glnvg__checkError("stroke fill");
     // Draw Strokes
-    for (i = 0; i < npaths; i++)
-      glDrawArrays(GL_TRIANGLE_STRIP, paths[i].strokeOffset,
-                   paths[i].strokeCount);
+    glnvg__drawStrokes(call, paths, npaths);
   }
 }
 
@@ -274,6 +338,36 @@ void Renderer::glnvg__triangles(const GLNVGcall *call) {
   glDrawArrays(GL_TRIANGLES, call->triangleOffset, call->triangleCount);
 }
 
+void Renderer::glnvg__instances(const GLNVGcall *call) {
+  const GLvoid *base =
+      (const GLvoid *)(call->instanceOffset * sizeof(NVGinstance));
+  glnvg__setUniforms(call->uniformOffset);
+  _texture->bind(call->image);
+  glnvg__checkError("instances fill");
+
+  glBindBuffer(GL_ARRAY_BUFFER, _instBuf);
+  glVertexAttribPointer(GLNVG_ATTR_INSTPOS, 4, GL_FLOAT, GL_FALSE,
+                        sizeof(NVGinstance), base);
+  glVertexAttribPointer(GLNVG_ATTR_INSTSHAPE, 4, GL_FLOAT, GL_FALSE,
+                        sizeof(NVGinstance),
+                        (const GLvoid *)((size_t)base + 4 * sizeof(float)));
+  glVertexAttribPointer(GLNVG_ATTR_INSTCOLOR, 4, GL_FLOAT, GL_FALSE,
+                        sizeof(NVGinstance),
+                        (const GLvoid *)((size_t)base + 8 * sizeof(float)));
+  glEnableVertexAttribArray(GLNVG_ATTR_INSTPOS);
+  glEnableVertexAttribArray(GLNVG_ATTR_INSTSHAPE);
+  glEnableVertexAttribArray(GLNVG_ATTR_INSTCOLOR);
+
+  glDrawArraysInstanced(GL_TRIANGLE_STRIP, call->triangleOffset,
+                        call->triangleCount, call->instanceCount);
+
+  // The other draws see the constant attribute values set in render().
+  glDisableVertexAttribArray(GLNVG_ATTR_INSTPOS);
+  glDisableVertexAttribArray(GLNVG_ATTR_INSTSHAPE);
+  glDisableVertexAttribArray(GLNVG_ATTR_INSTCOLOR);
+  glBindBuffer(GL_ARRAY_BUFFER, _vertBuf);
+}
+
 void Renderer::glnvg__setUniforms(int uniformOffset) {
   glBindBufferRange(GL_UNIFORM_BUFFER, GLNVG_FRAG_BINDING, _fragBuf,
                     uniformOffset, sizeof(GLNVGfragUniforms));
@@ -304,6 +398,9 @@ void Renderer::render(const NVGdrawData *data) {
   _blendFunc.srcAlpha = {};
   _blendFunc.dstRGB = {};
   _blendFunc.dstAlpha = {};
+  _scissorEnabled = 0;
+  memset(_scissorRect, 0xff, sizeof(_scissorRect));
+  int fbHeight = (int)(data->view[1] * data->devicePixelRatio + 0.5f);
 
   // Upload ubo for frag shaders
   glBindBuffer(GL_UNIFORM_BUFFER, _fragBuf);
@@ -314,17 +411,55 @@ void Renderer::render(const NVGdrawData *data) {
   // Upload vertex data
   glBindVertexArray(_vertArr);
   glBindBuffer(GL_ARRAY_BUFFER, _vertBuf);
-  glBufferData(GL_ARRAY_BUFFER, data->vertexCount * sizeof(NVGvertex),
-               data->pVertex, GL_STREAM_DRAW);
   glEnableVertexAttribArray(0);
   glEnableVertexAttribArray(1);
-  glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(NVGvertex),
-                        (const GLvoid *)(size_t)0);
-  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(NVGvertex),
-                        (const GLvoid *)(0 + 2 * sizeof(float)));
+  if (data->vertexFormat == NVG_VERTEX_COMPACT) {
+    glBufferData(GL_ARRAY_BUFFER,
+                 data->vertexCount * sizeof(NVGcompactVertex),
+                 data->pCompactVertex, GL_STREAM_DRAW);
+    glVertexAttribPointer(0, 2, GL_SHORT, GL_FALSE, sizeof(NVGcompactVertex),
+                          (const GLvoid *)(size_t)0);
+    glVertexAttribPointer(1, 2, GL_UNSIGNED_SHORT, GL_TRUE,
+                          sizeof(NVGcompactVertex),
+                          (const GLvoid *)(0 + 2 * sizeof(short)));
+  } else {
+    glBufferData(GL_ARRAY_BUFFER, data->vertexCount * sizeof(NVGvertex),
+                 data->pVertex, GL_STREAM_DRAW);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(NVGvertex),
+                          (const GLvoid *)(size_t)0);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(NVGvertex),
+                          (const GLvoid *)(0 + 2 * sizeof(float)));
+  }
+
+  // Upload index data, bound to the vertex array.
+  if (data->indexCount > 0) {
+    _indexSize = data->indexSize;
+    _indexType = _indexSize == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _indexBuf);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, data->indexCount * _indexSize,
+                 data->pIndex, GL_STREAM_DRAW);
+  }
+
+  // Upload instance data. Outside of instanced draws the instance attributes
+  // are constants which leave the vertices and colors untouched.
+  if (data->instanceCount > 0) {
+    glBindBuffer(GL_ARRAY_BUFFER, _instBuf);
+    glBufferData(GL_ARRAY_BUFFER, data->instanceCount * sizeof(NVGinstance),
+                 data->pInstance, GL_STREAM_DRAW);
+    glVertexAttribDivisor(GLNVG_ATTR_INSTPOS, 1);
+    glVertexAttribDivisor(GLNVG_ATTR_INSTSHAPE, 1);
+    glVertexAttribDivisor(GLNVG_ATTR_INSTCOLOR, 1);
+    glBindBuffer(GL_ARRAY_BUFFER, _vertBuf);
+  }
+  glVertexAttrib4f(GLNVG_ATTR_INSTPOS, 0.0f, 0.0f, 0.0f, 0.0f);
+  glVertexAttrib4f(GLNVG_ATTR_INSTSHAPE, 0.0f, 0.0f, 0.0f, 0.0f);
+  glVertexAttrib4f(GLNVG_ATTR_INSTCOLOR, 1.0f, 1.0f, 1.0f, 1.0f);
 
   // Set view and texture just once per frame.
   _shader->set_texture_and_view(0, data->view);
+  _shader->set_vertex_scale(data->vertexFormat == NVG_VERTEX_COMPACT
+                                ? 1.0f / NVG_COMPACT_SUBPIXELS
+                                : 1.0f);
 
   glBindBuffer(GL_UNIFORM_BUFFER, _fragBuf);
 
@@ -334,20 +469,25 @@ void Renderer::render(const NVGdrawData *data) {
     GLNVGblend blendFunc = glnvg__blendCompositeOperation(call.blendFunc);   
 
     glnvg__blendFuncSeparate(&blendFunc);
+    glnvg__scissor(&call, fbHeight);
     if (call.type == GLNVG_FILL)
       glnvg__fill(&call, data->pPath);
-    else if (call.type == GLNVG_CONVEXFILL)
+    else if (call.type == GLNVG_CONVEXFILL ||
+             call.type == GLNVG_CONCAVEFILL)
       glnvg__convexFill(&call, data->pPath);
     else if (call.type == GLNVG_STROKE)
       glnvg__stroke(&call, data->pPath);
     else if (call.type == GLNVG_TRIANGLES)
       glnvg__triangles(&call);
+    else if (call.type == GLNVG_INSTANCES)
+      glnvg__instances(&call);
   }
 
   glDisableVertexAttribArray(0);
   glDisableVertexAttribArray(1);
   glBindVertexArray(0);
   glDisable(GL_CULL_FACE);
+  glDisable(GL_SCISSOR_TEST);
   glBindBuffer(GL_ARRAY_BUFFER, 0);
   glUseProgram(0);
   glBindTexture(GL_TEXTURE_2D, 0);
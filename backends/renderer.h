@@ -2,6 +2,7 @@
 #include <nanovg.h>
 #include <memory>
 #include <unordered_map>
+#include <vector>
 
 class TextureManager;
 class GLNVGshader;
@@ -10,8 +11,15 @@ class Renderer {
   std::shared_ptr<GLNVGshader> _shader;
   unsigned int _vertBuf = {};
   unsigned int _vertArr = {};
+  unsigned int _instBuf = {};
+  unsigned int _indexBuf = {};
+  unsigned int _indexType = {};
+  int _indexSize = {};
   unsigned int _fragBuf = {};
   int _fragSize = {};
+  // Scratch arrays for glMultiDrawArrays.
+  std::vector<int> _first;
+  std::vector<int> _count;
 
   Renderer(const std::shared_ptr<GLNVGshader> &shader);
 
@@ -30,10 +38,16 @@ public:
   unsigned int nvglImageHandleGL3(int image);
 
 private:
+  void glnvg__drawPaths(unsigned int mode, const GLNVGpath *paths, int npaths,
+                        bool fill);
+  void glnvg__drawIndices(int offset, int count);
+  void glnvg__drawStrokes(const GLNVGcall *call, const GLNVGpath *paths,
+                          int npaths);
   void glnvg__fill(const GLNVGcall *call, const GLNVGpath *paths);
   void glnvg__convexFill(const GLNVGcall *call, const GLNVGpath *paths);
   void glnvg__stroke(const GLNVGcall *call, const GLNVGpath *paths);
   void glnvg__triangles(const GLNVGcall *call);
+  void glnvg__instances(const GLNVGcall *call);
   void glnvg__blendFuncSeparate(const struct GLNVGblend *blend);
   void glnvg__setUniforms(int uniformOffset);
 };
@@ -24,8 +24,21 @@
 enum FONSflags {
 	FONS_ZERO_TOPLEFT = 1,
 	FONS_ZERO_BOTTOMLEFT = 2,
+	// Glyphs are stored as signed distance fields rasterized once per code
+	// point at FONS_SDF_SIZE, and scaled to the requested size. The atlas
+	// holds 0.5 on the outline, falling off by 0.5 over FONS_SDF_PADDING
+	// pixels of the reference size. Blur is left to the renderer. Not
+	// supported with FreeType, where the flag is ignored.
+	FONS_SDF_GLYPHS = 4,
 };
 
+#ifndef FONS_SDF_SIZE
+#	define FONS_SDF_SIZE 48
+#endif
+#ifndef FONS_SDF_PADDING
+#	define FONS_SDF_PADDING 6
+#endif
+
 enum FONSalign {
 	// Horizontal align
 	FONS_ALIGN_LEFT 	= 1<<0,	// Default
@@ -84,6 +97,7 @@ struct FONStextIter {
 	const char* end;
 	unsigned int utf8state;
 	int bitmapOption;
+	int page; // Atlas page of the current glyph, -1 if it has no bitmap.
 };
 typedef struct FONStextIter FONStextIter;
 
@@ -94,6 +108,8 @@ FONScontext* fonsCreateInternal(FONSparams* params);
 void fonsDeleteInternal(FONScontext* s);
 
 void fonsSetErrorCallback(FONScontext* s, void (*callback)(void* uptr, int error, int val), void* uptr);
+// Returns the FONSflags in effect.
+int fonsGetFlags(FONScontext* s);
 // Returns current atlas size.
 void fonsGetAtlasSize(FONScontext* s, int* width, int* height);
 // Expands the atlas size.
@@ -135,6 +151,55 @@ int fonsTextIterNext(FONScontext* stash, FONStextIter* iter, struct FONSquad* qu
 const unsigned char* fonsGetTextureData(FONScontext* stash, int* width, int* height);
 int fonsValidateTexture(FONScontext* s, int* dirty);
 
+// Atlas pages. Glyphs are packed to pages of the atlas size. When no page
+// has room, a page is added up to the page limit, after that the least
+// recently used page which has not been drawn from in the current frame is
+// emptied and its glyphs are rasterized again when needed.
+void fonsSetMaxPages(FONScontext* s, int maxPages);
+int fonsGetPageCount(FONScontext* s);
+int fonsAddPage(FONScontext* s);
+// Drops the pages from index npages on.
+void fonsTrimPages(FONScontext* s, int npages);
+const unsigned char* fonsGetPageData(FONScontext* s, int page, int* width, int* height);
+int fonsValidatePage(FONScontext* s, int page, int* dirty);
+// Starts a new frame for the least recently used page.
+void fonsBeginFrame(FONScontext* s);
+// Marks a page as drawn from in the current frame.
+void fonsTouchPage(FONScontext* s, int page);
+// Returns a counter which changes whenever glyphs leave the atlas.
+int fonsGetAtlasGeneration(FONScontext* s);
+// Returns the atlas generation a page was last emptied in. Glyphs placed on
+// the page at that generation or later are still there. Pages which do not
+// exist report a generation newer than the atlas.
+int fonsGetPageGeneration(FONScontext* s, int page);
+
+// Deferred glyph rasterization. While enabled, a glyph missing from the atlas
+// gets its place in the atlas right away, but its bitmap stays empty until
+// the glyph is rasterized by fonsRasterizeGlyph() and copied to the atlas by
+// fonsCommitGlyphs(). Pending glyphs are rasterized in the order they were
+// added. nthreads is the number of threads which may rasterize at the same
+// time, 0 finishes the pending glyphs and disables deferring. Returns 0 if
+// not supported, as with FreeType, or out of memory. Deferring is then off.
+int fonsDeferGlyphs(FONScontext* s, int nthreads);
+int fonsGetPendingGlyphs(FONScontext* s);
+// Rasterizes the pending glyph at index with the scratch memory of thread.
+// May be called from several threads at once, each with a thread index of
+// its own, while nothing else uses the stash.
+void fonsRasterizeGlyph(FONScontext* s, int index, int thread);
+// Copies the first count pending glyphs to the atlas and removes them.
+void fonsCommitGlyphs(FONScontext* s, int count);
+
+// Atlas cache. Saves the atlas pages and the glyph tables of the fonts to a
+// file, each font keyed by a hash of its data. Loading replaces the atlas
+// and the glyphs of every font whose data matches a saved font, glyphs of
+// other fonts are rasterized again when needed. The file is specific to the
+// build and machine which wrote it, loading fails on a version, layout,
+// atlas size or page limit mismatch. Returns 1 on success.
+int fonsSaveAtlas(FONScontext* s, const char* path);
+int fonsLoadAtlas(FONScontext* s, const char* path);
+// Loads from memory, the data may be a mapped file and is not kept.
+int fonsLoadAtlasMem(FONScontext* s, const unsigned char* data, int ndata);
+
 // Draws the stash texture for debugging
 void fonsDrawDebug(FONScontext* s, float x, float y);
 
@@ -198,6 +263,9 @@ typedef struct FONSttFontImpl FONSttFontImpl;
 #ifndef FONS_MAX_FALLBACKS
 #	define FONS_MAX_FALLBACKS 20
 #endif
+#ifndef FONS_MAX_PAGES
+#	define FONS_MAX_PAGES 16
+#endif
 
 static unsigned int fons__hashint(unsigned int a)
 {
@@ -226,6 +294,7 @@ struct FONSglyph
 	int index;
 	int next;
 	short size, blur;
+	short page;
 	short x0,y0,x1,y1;
 	short xadv,xoff,yoff;
 };
@@ -247,6 +316,7 @@ struct FONSfont
 	int lut[FONS_HASH_LUT_SIZE];
 	int fallbacks[FONS_MAX_FALLBACKS];
 	int nfallbacks;
+	unsigned int dataHash; // Computed when first needed, 0 until then.
 };
 typedef struct FONSfont FONSfont;
 
@@ -275,22 +345,60 @@ struct FONSatlas
 };
 typedef struct FONSatlas FONSatlas;
 
+// Memory stb_truetype allocates from while rasterizing a glyph.
+struct FONSscratch
+{
+	unsigned char* data;
+	int n;
+	FONScontext* stash; // Reports FONS_SCRATCH_FULL, NULL on other threads.
+};
+typedef struct FONSscratch FONSscratch;
+
+// A glyph with a place in the atlas but no bitmap yet.
+struct FONSglyphJob
+{
+	FONSfont* font; // Font the glyph is rasterized from, may be a fallback.
+	int index;
+	float scale;
+	int page, x, y, w, h;
+	int pad, blur;
+	unsigned char* bitmap; // w*h, with the padding.
+};
+typedef struct FONSglyphJob FONSglyphJob;
+
+struct FONSpage
+{
+	FONSatlas* atlas;
+	unsigned char* texData;
+	int dirtyRect[4];
+	int lastUsed; // Frame the page was last drawn from.
+	int generation; // Atlas generation the page was last emptied in.
+};
+typedef struct FONSpage FONSpage;
+
 struct FONScontext
 {
 	FONSparams params;
 	float itw,ith;
-	unsigned char* texData;
-	int dirtyRect[4];
+	FONSpage pages[FONS_MAX_PAGES];
+	int npages;
+	int maxPages;
+	int lastPage; // Page the last glyph was added to.
+	int frame;
+	int generation;
 	FONSfont** fonts;
-	FONSatlas* atlas;
 	int cfonts;
 	int nfonts;
 	float verts[FONS_VERTEX_COUNT*2];
 	float tcoords[FONS_VERTEX_COUNT*2];
 	unsigned int colors[FONS_VERTEX_COUNT];
 	int nverts;
-	unsigned char* scratch;
-	int nscratch;
+	FONSscratch scratch;
+	FONSglyphJob* jobs;
+	int njobs;
+	int cjobs;
+	FONSscratch* threadScratch;
+	int nthreads;
 	FONSstate states[FONS_MAX_STATES];
 	int nstates;
 	void (*handleError)(void* uptr, int error, int val);
@@ -387,6 +495,20 @@ void fons__tt_renderGlyphBitmap(FONSttFontImpl *font, unsigned char *output, int
 	}
 }
 
+int fons__tt_renderGlyphSDF(FONSttFontImpl *font, unsigned char *output, int outWidth, int outHeight, int outStride,
+							float scale, int padding, int glyph)
+{
+	FONS_NOTUSED(font);
+	FONS_NOTUSED(output);
+	FONS_NOTUSED(outWidth);
+	FONS_NOTUSED(outHeight);
+	FONS_NOTUSED(outStride);
+	FONS_NOTUSED(scale);
+	FONS_NOTUSED(padding);
+	FONS_NOTUSED(glyph);
+	return 0;
+}
+
 int fons__tt_getGlyphKernAdvance(FONSttFontImpl *font, int glyph1, int glyph2)
 {
 	FT_Vector ftKerning;
@@ -413,7 +535,7 @@ int fons__tt_loadFont(FONScontext *context, FONSttFontImpl *font, unsigned char
 	int offset, stbError;
 	FONS_NOTUSED(dataSize);
 
-	font->font.userdata = context;
+	font->font.userdata = &context->scratch;
 	offset = stbtt_GetFontOffsetForIndex(data, fontIndex);
 	if (offset == -1) {
 		stbError = 0;
@@ -453,6 +575,19 @@ void fons__tt_renderGlyphBitmap(FONSttFontImpl *font, unsigned char *output, int
 	stbtt_MakeGlyphBitmap(&font->font, output, outWidth, outHeight, outStride, scaleX, scaleY, glyph);
 }
 
+int fons__tt_renderGlyphSDF(FONSttFontImpl *font, unsigned char *output, int outWidth, int outHeight, int outStride,
+							float scale, int padding, int glyph)
+{
+	int y, w, h, xoff, yoff;
+	unsigned char* sdf = stbtt_GetGlyphSDF(&font->font, scale, glyph, padding, 128, 128.0f / padding,
+										   &w, &h, &xoff, &yoff);
+	if (sdf == NULL) return 0;
+	for (y = 0; y < fons__mini(h, outHeight); y++)
+		memcpy(&output[y * outStride], &sdf[y * w], fons__mini(w, outWidth));
+	stbtt_FreeSDF(sdf, font->font.userdata);
+	return 1;
+}
+
 int fons__tt_getGlyphKernAdvance(FONSttFontImpl *font, int glyph1, int glyph2)
 {
 	return stbtt_GetGlyphKernAdvance(&font->font, glyph1, glyph2);
@@ -465,18 +600,19 @@ int fons__tt_getGlyphKernAdvance(FONSttFontImpl *font, int glyph1, int glyph2)
 static void* fons__tmpalloc(size_t size, void* up)
 {
 	unsigned char* ptr;
-	FONScontext* stash = (FONScontext*)up;
+	FONSscratch* scratch = (FONSscratch*)up;
+	FONScontext* stash = scratch->stash;
 
 	// 16-byte align the returned pointer
 	size = (size + 0xf) & ~0xf;
 
-	if (stash->nscratch+(int)size > FONS_SCRATCH_BUF_SIZE) {
-		if (stash->handleError)
-			stash->handleError(stash->errorUptr, FONS_SCRATCH_FULL, stash->nscratch+(int)size);
+	if (scratch->n+(int)size > FONS_SCRATCH_BUF_SIZE) {
+		if (stash != NULL && stash->handleError)
+			stash->handleError(stash->errorUptr, FONS_SCRATCH_FULL, scratch->n+(int)size);
 		return NULL;
 	}
-	ptr = stash->scratch + stash->nscratch;
-	stash->nscratch += (int)size;
+	ptr = scratch->data + scratch->n;
+	scratch->n += (int)size;
 	return ptr;
 }
 
@@ -710,25 +846,143 @@ static int fons__atlasAddRect(FONSatlas* atlas, int rw, int rh, int* rx, int* ry
 	return 1;
 }
 
+static void fons__addDirtyRect(FONSpage* page, int x0, int y0, int x1, int y1)
+{
+	page->dirtyRect[0] = fons__mini(page->dirtyRect[0], x0);
+	page->dirtyRect[1] = fons__mini(page->dirtyRect[1], y0);
+	page->dirtyRect[2] = fons__maxi(page->dirtyRect[2], x1);
+	page->dirtyRect[3] = fons__maxi(page->dirtyRect[3], y1);
+}
+
+static void fons__resetDirtyRect(FONScontext* stash, FONSpage* page)
+{
+	page->dirtyRect[0] = stash->params.width;
+	page->dirtyRect[1] = stash->params.height;
+	page->dirtyRect[2] = 0;
+	page->dirtyRect[3] = 0;
+}
+
 static void fons__addWhiteRect(FONScontext* stash, int w, int h)
 {
 	int x, y, gx, gy;
 	unsigned char* dst;
-	if (fons__atlasAddRect(stash->atlas, w, h, &gx, &gy) == 0)
+	FONSpage* page = &stash->pages[0];
+	if (fons__atlasAddRect(page->atlas, w, h, &gx, &gy) == 0)
 		return;
 
 	// Rasterize
-	dst = &stash->texData[gx + gy * stash->params.width];
+	dst = &page->texData[gx + gy * stash->params.width];
 	for (y = 0; y < h; y++) {
 		for (x = 0; x < w; x++)
 			dst[x] = 0xff;
 		dst += stash->params.width;
 	}
 
-	stash->dirtyRect[0] = fons__mini(stash->dirtyRect[0], gx);
-	stash->dirtyRect[1] = fons__mini(stash->dirtyRect[1], gy);
-	stash->dirtyRect[2] = fons__maxi(stash->dirtyRect[2], gx+w);
-	stash->dirtyRect[3] = fons__maxi(stash->dirtyRect[3], gy+h);
+	fons__addDirtyRect(page, gx, gy, gx+w, gy+h);
+}
+
+static void fons__freePage(FONSpage* page)
+{
+	if (page->atlas) fons__deleteAtlas(page->atlas);
+	if (page->texData) free(page->texData);
+	memset(page, 0, sizeof(FONSpage));
+}
+
+static int fons__allocPage(FONScontext* stash)
+{
+	int size = stash->params.width * stash->params.height;
+	FONSpage* page;
+	if (stash->npages >= FONS_MAX_PAGES) return 0;
+	page = &stash->pages[stash->npages];
+	memset(page, 0, sizeof(FONSpage));
+	page->atlas = fons__allocAtlas(stash->params.width, stash->params.height, FONS_INIT_ATLAS_NODES);
+	if (page->atlas == NULL) goto error;
+	page->texData = (unsigned char*)malloc(size);
+	if (page->texData == NULL) goto error;
+	memset(page->texData, 0, size);
+	fons__resetDirtyRect(stash, page);
+	page->lastUsed = stash->frame;
+	page->generation = stash->generation;
+	stash->npages++;
+	return 1;
+
+error:
+	fons__freePage(page);
+	return 0;
+}
+
+// Forgets the pending glyphs of the pages from p0 to p1-1.
+static void fons__dropJobs(FONScontext* stash, int p0, int p1)
+{
+	int i, n = 0;
+	for (i = 0; i < stash->njobs; i++) {
+		FONSglyphJob* job = &stash->jobs[i];
+		if (job->page >= p0 && job->page < p1)
+			free(job->bitmap);
+		else
+			stash->jobs[n++] = *job;
+	}
+	stash->njobs = n;
+}
+
+// Empties a page, its glyphs are rasterized again when they are needed.
+static void fons__evictPage(FONScontext* stash, int p)
+{
+	FONSpage* page = &stash->pages[p];
+	int i, j;
+
+	fons__dropJobs(stash, p, p+1);
+	fons__atlasReset(page->atlas, stash->params.width, stash->params.height);
+	memset(page->texData, 0, stash->params.width * stash->params.height);
+	for (i = 0; i < stash->nfonts; i++) {
+		FONSfont* font = stash->fonts[i];
+		for (j = 0; j < font->nglyphs; j++) {
+			FONSglyph* glyph = &font->glyphs[j];
+			if (glyph->page == p && glyph->x0 >= 0) {
+				glyph->page = -1;
+				glyph->x0 = glyph->y0 = -1;
+			}
+		}
+	}
+	if (p == 0)
+		fons__addWhiteRect(stash, 2,2);
+	page->generation = ++stash->generation;
+}
+
+// Finds room for a glyph in the pages there are, then in a new page, and last
+// in the least recently used page. Returns the page or -1.
+static int fons__addGlyphRect(FONScontext* stash, int w, int h, int* x, int* y)
+{
+	int i, lru = -1;
+
+	// Would not fit an empty page either.
+	if (w > stash->params.width || h > stash->params.height)
+		return -1;
+
+	// Glyphs rasterized together are likely drawn together, keep them on
+	// the same page so that the text is not split into several batches.
+	if (stash->lastPage < stash->npages &&
+		fons__atlasAddRect(stash->pages[stash->lastPage].atlas, w, h, x, y))
+		return stash->lastPage;
+	for (i = 0; i < stash->npages; i++) {
+		if (i != stash->lastPage && fons__atlasAddRect(stash->pages[i].atlas, w, h, x, y))
+			return stash->lastPage = i;
+	}
+
+	if (stash->npages < stash->maxPages && fons__allocPage(stash)) {
+		i = stash->npages-1;
+		return fons__atlasAddRect(stash->pages[i].atlas, w, h, x, y) ? (stash->lastPage = i) : -1;
+	}
+
+	// Quads drawn from a page in this frame would see the new glyphs.
+	for (i = 0; i < stash->npages; i++) {
+		if (stash->pages[i].lastUsed == stash->frame) continue;
+		if (lru == -1 || stash->pages[i].lastUsed < stash->pages[lru].lastUsed)
+			lru = i;
+	}
+	if (lru == -1) return -1;
+	fons__evictPage(stash, lru);
+	return fons__atlasAddRect(stash->pages[lru].atlas, w, h, x, y) ? (stash->lastPage = lru) : -1;
 }
 
 FONScontext* fonsCreateInternal(FONSparams* params)
@@ -741,10 +995,14 @@ FONScontext* fonsCreateInternal(FONSparams* params)
 	memset(stash, 0, sizeof(FONScontext));
 
 	stash->params = *params;
+#ifdef FONS_USE_FREETYPE
+	stash->params.flags &= ~FONS_SDF_GLYPHS;
+#endif
 
 	// Allocate scratch buffer.
-	stash->scratch = (unsigned char*)malloc(FONS_SCRATCH_BUF_SIZE);
-	if (stash->scratch == NULL) goto error;
+	stash->scratch.data = (unsigned char*)malloc(FONS_SCRATCH_BUF_SIZE);
+	if (stash->scratch.data == NULL) goto error;
+	stash->scratch.stash = stash;
 
 	// Initialize implementation library
 	if (!fons__tt_init(stash)) goto error;
@@ -754,8 +1012,8 @@ FONScontext* fonsCreateInternal(FONSparams* params)
 			goto error;
 	}
 
-	stash->atlas = fons__allocAtlas(stash->params.width, stash->params.height, FONS_INIT_ATLAS_NODES);
-	if (stash->atlas == NULL) goto error;
+	stash->maxPages = 1;
+	if (!fons__allocPage(stash)) goto error;
 
 	// Allocate space for fonts.
 	stash->fonts = (FONSfont**)malloc(sizeof(FONSfont*) * FONS_INIT_FONTS);
@@ -764,17 +1022,8 @@ FONScontext* fonsCreateInternal(FONSparams* params)
 	stash->cfonts = FONS_INIT_FONTS;
 	stash->nfonts = 0;
 
-	// Create texture for the cache.
 	stash->itw = 1.0f/stash->params.width;
 	stash->ith = 1.0f/stash->params.height;
-	stash->texData = (unsigned char*)malloc(stash->params.width * stash->params.height);
-	if (stash->texData == NULL) goto error;
-	memset(stash->texData, 0, stash->params.width * stash->params.height);
-
-	stash->dirtyRect[0] = stash->params.width;
-	stash->dirtyRect[1] = stash->params.height;
-	stash->dirtyRect[2] = 0;
-	stash->dirtyRect[3] = 0;
 
 	// Add white rect at 0,0 for debug drawing.
 	fons__addWhiteRect(stash, 2,2);
@@ -965,7 +1214,7 @@ int fonsAddFontMem(FONScontext* stash, const char* name, unsigned char* data, in
 	font->freeData = (unsigned char)freeData;
 
 	// Init font
-	stash->nscratch = 0;
+	stash->scratch.n = 0;
 	if (!fons__tt_loadFont(stash, &font->font, data, dataSize, fontIndex)) goto error;
 
 	// Store normalized line height. The real line height is got
@@ -1073,6 +1322,37 @@ static void fons__blur(FONScontext* stash, unsigned char* dst, int w, int h, int
 //	fons__blurcols(dst, w, h, dstStride, alpha);
 }
 
+// Queues a glyph to be rasterized by fonsRasterizeGlyph(). Returns 0 if the
+// glyph has to be rasterized right away.
+static int fons__deferGlyph(FONScontext* stash, FONSfont* font, int index, float scale,
+							int page, FONSglyph* glyph, int pad, int blur)
+{
+	FONSglyphJob* job;
+	if (stash->njobs+1 > stash->cjobs) {
+		int cjobs = stash->cjobs == 0 ? 64 : stash->cjobs * 2;
+		FONSglyphJob* jobs = (FONSglyphJob*)realloc(stash->jobs, sizeof(FONSglyphJob) * cjobs);
+		if (jobs == NULL) return 0;
+		stash->jobs = jobs;
+		stash->cjobs = cjobs;
+	}
+	job = &stash->jobs[stash->njobs];
+	job->font = font;
+	job->index = index;
+	job->scale = scale;
+	job->page = page;
+	job->x = glyph->x0;
+	job->y = glyph->y0;
+	job->w = glyph->x1 - glyph->x0;
+	job->h = glyph->y1 - glyph->y0;
+	job->pad = pad;
+	job->blur = blur;
+	// Zeroed, so that the padding stays empty.
+	job->bitmap = (unsigned char*)calloc(job->w * job->h, 1);
+	if (job->bitmap == NULL) return 0;
+	stash->njobs++;
+	return 1;
+}
+
 static FONSglyph* fons__getGlyph(FONScontext* stash, FONSfont* font, unsigned int codepoint,
 								 short isize, short iblur, int bitmapOption)
 {
@@ -1081,17 +1361,25 @@ static FONSglyph* fons__getGlyph(FONScontext* stash, FONSfont* font, unsigned in
 	FONSglyph* glyph = NULL;
 	unsigned int h;
 	float size = isize/10.0f;
-	int pad, added;
+	int pad, page;
 	unsigned char* bdst;
 	unsigned char* dst;
 	FONSfont* renderFont = font;
+	FONSpage* dstPage;
+	int sdf = stash->params.flags & FONS_SDF_GLYPHS;
 
 	if (isize < 2) return NULL;
+	if (sdf) {
+		// One distance field per code point serves all sizes and blurs.
+		isize = FONS_SDF_SIZE*10;
+		iblur = 0;
+		size = FONS_SDF_SIZE;
+	}
 	if (iblur > 20) iblur = 20;
-	pad = iblur+2;
+	pad = sdf ? FONS_SDF_PADDING+1 : iblur+2;
 
 	// Reset allocator.
-	stash->nscratch = 0;
+	stash->scratch.n = 0;
 
 	// Find code point and size.
 	h = fons__hashint(codepoint) & (FONS_HASH_LUT_SIZE-1);
@@ -1099,7 +1387,11 @@ static FONSglyph* fons__getGlyph(FONScontext* stash, FONSfont* font, unsigned in
 	while (i != -1) {
 		if (font->glyphs[i].codepoint == codepoint && font->glyphs[i].size == isize && font->glyphs[i].blur == iblur) {
 			glyph = &font->glyphs[i];
-			if (bitmapOption == FONS_GLYPH_BITMAP_OPTIONAL || (glyph->x0 >= 0 && glyph->y0 >= 0)) {
+			if (bitmapOption == FONS_GLYPH_BITMAP_OPTIONAL) {
+			  return glyph;
+			}
+			if (glyph->x0 >= 0 && glyph->y0 >= 0) {
+			  stash->pages[glyph->page].lastUsed = stash->frame;
 			  return glyph;
 			}
 			// At this point, glyph exists but the bitmap data is not yet created.
@@ -1132,15 +1424,16 @@ static FONSglyph* fons__getGlyph(FONScontext* stash, FONSfont* font, unsigned in
 	// Determines the spot to draw glyph in the atlas.
 	if (bitmapOption == FONS_GLYPH_BITMAP_REQUIRED) {
 		// Find free spot for the rect in the atlas
-		added = fons__atlasAddRect(stash->atlas, gw, gh, &gx, &gy);
-		if (added == 0 && stash->handleError != NULL) {
+		page = fons__addGlyphRect(stash, gw, gh, &gx, &gy);
+		if (page == -1 && stash->handleError != NULL) {
 			// Atlas is full, let the user to resize the atlas (or not), and try again.
 			stash->handleError(stash->errorUptr, FONS_ATLAS_FULL, 0);
-			added = fons__atlasAddRect(stash->atlas, gw, gh, &gx, &gy);
+			page = fons__addGlyphRect(stash, gw, gh, &gx, &gy);
 		}
-		if (added == 0) return NULL;
+		if (page == -1) return NULL;
 	} else {
 		// Negative coordinate indicates there is no bitmap data created.
+		page = -1;
 		gx = -1;
 		gy = -1;
 	}
@@ -1158,6 +1451,7 @@ static FONSglyph* fons__getGlyph(FONScontext* stash, FONSfont* font, unsigned in
 		font->lut[h] = font->nglyphs-1;
 	}
 	glyph->index = g;
+	glyph->page = (short)page;
 	glyph->x0 = (short)gx;
 	glyph->y0 = (short)gy;
 	glyph->x1 = (short)(glyph->x0+gw);
@@ -1170,12 +1464,25 @@ static FONSglyph* fons__getGlyph(FONScontext* stash, FONSfont* font, unsigned in
 		return glyph;
 	}
 
+	dstPage = &stash->pages[page];
+	dstPage->lastUsed = stash->frame;
+	if (stash->nthreads > 0 && fons__deferGlyph(stash, renderFont, g, scale, page, glyph, pad, iblur))
+		return glyph;
+
 	// Rasterize
-	dst = &stash->texData[(glyph->x0+pad) + (glyph->y0+pad) * stash->params.width];
-	fons__tt_renderGlyphBitmap(&renderFont->font, dst, gw-pad*2,gh-pad*2, stash->params.width, scale, scale, g);
+	if (sdf) {
+		// The distance field covers the padding, except for the border.
+		dst = &dstPage->texData[(glyph->x0+1) + (glyph->y0+1) * stash->params.width];
+		for (y = 0; y < gh-2; y++)
+			memset(&dst[y*stash->params.width], 0, gw-2);
+		fons__tt_renderGlyphSDF(&renderFont->font, dst, gw-2, gh-2, stash->params.width, scale, FONS_SDF_PADDING, g);
+	} else {
+		dst = &dstPage->texData[(glyph->x0+pad) + (glyph->y0+pad) * stash->params.width];
+		fons__tt_renderGlyphBitmap(&renderFont->font, dst, gw-pad*2,gh-pad*2, stash->params.width, scale, scale, g);
+	}
 
 	// Make sure there is one pixel empty border.
-	dst = &stash->texData[glyph->x0 + glyph->y0 * stash->params.width];
+	dst = &dstPage->texData[glyph->x0 + glyph->y0 * stash->params.width];
 	for (y = 0; y < gh; y++) {
 		dst[y*stash->params.width] = 0;
 		dst[gw-1 + y*stash->params.width] = 0;
@@ -1186,7 +1493,7 @@ static FONSglyph* fons__getGlyph(FONScontext* stash, FONSfont* font, unsigned in
 	}
 
 	// Debug code to color the glyph background
-/*	unsigned char* fdst = &stash->texData[glyph->x0 + glyph->y0 * stash->params.width];
+/*	unsigned char* fdst = &dstPage->texData[glyph->x0 + glyph->y0 * stash->params.width];
 	for (y = 0; y < gh; y++) {
 		for (x = 0; x < gw; x++) {
 			int a = (int)fdst[x+y*stash->params.width] + 20;
@@ -1197,25 +1504,66 @@ static FONSglyph* fons__getGlyph(FONScontext* stash, FONSfont* font, unsigned in
 
 	// Blur
 	if (iblur > 0) {
-		stash->nscratch = 0;
-		bdst = &stash->texData[glyph->x0 + glyph->y0 * stash->params.width];
+		stash->scratch.n = 0;
+		bdst = &dstPage->texData[glyph->x0 + glyph->y0 * stash->params.width];
 		fons__blur(stash, bdst, gw, gh, stash->params.width, iblur);
 	}
 
-	stash->dirtyRect[0] = fons__mini(stash->dirtyRect[0], glyph->x0);
-	stash->dirtyRect[1] = fons__mini(stash->dirtyRect[1], glyph->y0);
-	stash->dirtyRect[2] = fons__maxi(stash->dirtyRect[2], glyph->x1);
-	stash->dirtyRect[3] = fons__maxi(stash->dirtyRect[3], glyph->y1);
+	fons__addDirtyRect(dstPage, glyph->x0, glyph->y0, glyph->x1, glyph->y1);
 
 	return glyph;
 }
 
+// Distance field glyphs are scaled from the reference size, without snapping
+// to pixels which would make zooming text wobble.
+static void fons__getScaledQuad(FONScontext* stash, FONSfont* font,
+								int prevGlyphIndex, FONSglyph* glyph,
+								float scale, float spacing, float* x, float* y, FONSquad* q)
+{
+	float k = scale / fons__tt_getPixelHeightScale(&font->font, FONS_SDF_SIZE);
+	float xoff, yoff, x0, y0, x1, y1;
+
+	if (prevGlyphIndex != -1) {
+		float adv = fons__tt_getGlyphKernAdvance(&font->font, prevGlyphIndex, glyph->index) * scale;
+		*x += adv + spacing;
+	}
+
+	// Inset by the border pixel, the rest of the padding is part of the field.
+	xoff = (glyph->xoff+1) * k;
+	yoff = (glyph->yoff+1) * k;
+	x0 = (float)(glyph->x0+1);
+	y0 = (float)(glyph->y0+1);
+	x1 = (float)(glyph->x1-1);
+	y1 = (float)(glyph->y1-1);
+
+	q->x0 = *x + xoff;
+	q->x1 = q->x0 + (x1 - x0) * k;
+	if (stash->params.flags & FONS_ZERO_TOPLEFT) {
+		q->y0 = *y + yoff;
+		q->y1 = q->y0 + (y1 - y0) * k;
+	} else {
+		q->y0 = *y - yoff;
+		q->y1 = q->y0 - (y1 - y0) * k;
+	}
+	q->s0 = x0 * stash->itw;
+	q->t0 = y0 * stash->ith;
+	q->s1 = x1 * stash->itw;
+	q->t1 = y1 * stash->ith;
+
+	*x += glyph->xadv / 10.0f * k;
+}
+
 static void fons__getQuad(FONScontext* stash, FONSfont* font,
 						   int prevGlyphIndex, FONSglyph* glyph,
 						   float scale, float spacing, float* x, float* y, FONSquad* q)
 {
 	float rx,ry,xoff,yoff,x0,y0,x1,y1;
 
+	if (stash->params.flags & FONS_SDF_GLYPHS) {
+		fons__getScaledQuad(stash, font, prevGlyphIndex, glyph, scale, spacing, x, y, q);
+		return;
+	}
+
 	if (prevGlyphIndex != -1) {
 		float adv = fons__tt_getGlyphKernAdvance(&font->font, prevGlyphIndex, glyph->index) * scale;
 		*x += (int)(adv + spacing + 0.5f);
@@ -1264,15 +1612,13 @@ static void fons__getQuad(FONScontext* stash, FONSfont* font,
 
 static void fons__flush(FONScontext* stash)
 {
-	// Flush texture
-	if (stash->dirtyRect[0] < stash->dirtyRect[2] && stash->dirtyRect[1] < stash->dirtyRect[3]) {
+	// Flush texture, the render callbacks know of the first page only.
+	FONSpage* page = &stash->pages[0];
+	if (page->dirtyRect[0] < page->dirtyRect[2] && page->dirtyRect[1] < page->dirtyRect[3]) {
 		if (stash->params.renderUpdate != NULL)
-			stash->params.renderUpdate(stash->params.userPtr, stash->dirtyRect, stash->texData);
+			stash->params.renderUpdate(stash->params.userPtr, page->dirtyRect, page->texData);
 		// Reset dirty rect
-		stash->dirtyRect[0] = stash->params.width;
-		stash->dirtyRect[1] = stash->params.height;
-		stash->dirtyRect[2] = 0;
-		stash->dirtyRect[3] = 0;
+		fons__resetDirtyRect(stash, page);
 	}
 
 	// Flush triangles
@@ -1450,6 +1796,7 @@ int fonsTextIterNext(FONScontext* stash, FONStextIter* iter, FONSquad* quad)
 		if (glyph != NULL)
 			fons__getQuad(stash, iter->font, iter->prevGlyphIndex, glyph, iter->scale, iter->spacing, &iter->nextx, &iter->nexty, quad);
 		iter->prevGlyphIndex = glyph != NULL ? glyph->index : -1;
+		iter->page = glyph != NULL ? glyph->page : -1;
 		break;
 	}
 	iter->next = str;
@@ -1487,8 +1834,8 @@ void fonsDrawDebug(FONScontext* stash, float x, float y)
 	fons__vertex(stash, x+w, y+h, 1, 1, 0xffffffff);
 
 	// Drawbug draw atlas
-	for (i = 0; i < stash->atlas->nnodes; i++) {
-		FONSatlasNode* n = &stash->atlas->nodes[i];
+	for (i = 0; i < stash->pages[0].atlas->nnodes; i++) {
+		FONSatlasNode* n = &stash->pages[0].atlas->nodes[i];
 
 		if (stash->nverts+6 > FONS_VERTEX_COUNT)
 			fons__flush(stash);
@@ -1522,6 +1869,7 @@ float fonsTextBounds(FONScontext* stash,
 	FONSfont* font;
 	float startx, advance;
 	float minx, miny, maxx, maxy;
+	float inset = 0.0f;
 
 	if (stash == NULL) return 0;
 	if (state->font < 0 || state->font >= stash->nfonts) return 0;
@@ -1529,6 +1877,9 @@ float fonsTextBounds(FONScontext* stash,
 	if (font->data == NULL) return 0;
 
 	scale = fons__tt_getPixelHeightScale(&font->font, (float)isize/10.0f);
+	// The padding of distance field quads is not part of the glyph.
+	if (stash->params.flags & FONS_SDF_GLYPHS)
+		inset = FONS_SDF_PADDING * scale / fons__tt_getPixelHeightScale(&font->font, FONS_SDF_SIZE);
 
 	// Align vertically.
 	y += fons__getVertAlign(stash, font, state->align, isize);
@@ -1546,14 +1897,14 @@ float fonsTextBounds(FONScontext* stash,
 		glyph = fons__getGlyph(stash, font, codepoint, isize, iblur, FONS_GLYPH_BITMAP_OPTIONAL);
 		if (glyph != NULL) {
 			fons__getQuad(stash, font, prevGlyphIndex, glyph, scale, state->spacing, &x, &y, &q);
-			if (q.x0 < minx) minx = q.x0;
-			if (q.x1 > maxx) maxx = q.x1;
+			if (q.x0+inset < minx) minx = q.x0+inset;
+			if (q.x1-inset > maxx) maxx = q.x1-inset;
 			if (stash->params.flags & FONS_ZERO_TOPLEFT) {
-				if (q.y0 < miny) miny = q.y0;
-				if (q.y1 > maxy) maxy = q.y1;
+				if (q.y0+inset < miny) miny = q.y0+inset;
+				if (q.y1-inset > maxy) maxy = q.y1-inset;
 			} else {
-				if (q.y1 < miny) miny = q.y1;
-				if (q.y0 > maxy) maxy = q.y0;
+				if (q.y1+inset < miny) miny = q.y1+inset;
+				if (q.y0-inset > maxy) maxy = q.y0-inset;
 			}
 		}
 		prevGlyphIndex = glyph != NULL ? glyph->index : -1;
@@ -1627,31 +1978,199 @@ void fonsLineBounds(FONScontext* stash, float y, float* miny, float* maxy)
 }
 
 const unsigned char* fonsGetTextureData(FONScontext* stash, int* width, int* height)
+{
+	return fonsGetPageData(stash, 0, width, height);
+}
+
+int fonsValidateTexture(FONScontext* stash, int* dirty)
+{
+	return fonsValidatePage(stash, 0, dirty);
+}
+
+void fonsSetMaxPages(FONScontext* stash, int maxPages)
+{
+	if (stash == NULL) return;
+	stash->maxPages = fons__maxi(1, fons__mini(maxPages, FONS_MAX_PAGES));
+}
+
+int fonsGetPageCount(FONScontext* stash)
+{
+	if (stash == NULL) return 0;
+	return stash->npages;
+}
+
+int fonsAddPage(FONScontext* stash)
+{
+	if (stash == NULL) return 0;
+	return fons__allocPage(stash);
+}
+
+void fonsTrimPages(FONScontext* stash, int npages)
+{
+	int i, j;
+	if (stash == NULL) return;
+	npages = fons__maxi(npages, 1);
+	if (npages >= stash->npages) return;
+
+	for (i = 0; i < stash->nfonts; i++) {
+		FONSfont* font = stash->fonts[i];
+		for (j = 0; j < font->nglyphs; j++) {
+			FONSglyph* glyph = &font->glyphs[j];
+			if (glyph->page >= npages) {
+				glyph->page = -1;
+				glyph->x0 = glyph->y0 = -1;
+			}
+		}
+	}
+	fons__dropJobs(stash, npages, FONS_MAX_PAGES);
+	for (i = npages; i < stash->npages; i++)
+		fons__freePage(&stash->pages[i]);
+	stash->npages = npages;
+	stash->generation++;
+}
+
+const unsigned char* fonsGetPageData(FONScontext* stash, int page, int* width, int* height)
 {
 	if (width != NULL)
 		*width = stash->params.width;
 	if (height != NULL)
 		*height = stash->params.height;
-	return stash->texData;
+	if (page < 0 || page >= stash->npages) return NULL;
+	return stash->pages[page].texData;
 }
 
-int fonsValidateTexture(FONScontext* stash, int* dirty)
+int fonsValidatePage(FONScontext* stash, int page, int* dirty)
 {
-	if (stash->dirtyRect[0] < stash->dirtyRect[2] && stash->dirtyRect[1] < stash->dirtyRect[3]) {
-		dirty[0] = stash->dirtyRect[0];
-		dirty[1] = stash->dirtyRect[1];
-		dirty[2] = stash->dirtyRect[2];
-		dirty[3] = stash->dirtyRect[3];
+	FONSpage* p;
+	if (page < 0 || page >= stash->npages) return 0;
+	p = &stash->pages[page];
+	if (p->dirtyRect[0] < p->dirtyRect[2] && p->dirtyRect[1] < p->dirtyRect[3]) {
+		dirty[0] = p->dirtyRect[0];
+		dirty[1] = p->dirtyRect[1];
+		dirty[2] = p->dirtyRect[2];
+		dirty[3] = p->dirtyRect[3];
 		// Reset dirty rect
-		stash->dirtyRect[0] = stash->params.width;
-		stash->dirtyRect[1] = stash->params.height;
-		stash->dirtyRect[2] = 0;
-		stash->dirtyRect[3] = 0;
+		fons__resetDirtyRect(stash, p);
 		return 1;
 	}
 	return 0;
 }
 
+void fonsBeginFrame(FONScontext* stash)
+{
+	if (stash == NULL) return;
+	stash->frame++;
+}
+
+void fonsTouchPage(FONScontext* stash, int page)
+{
+	if (stash == NULL || page < 0 || page >= stash->npages) return;
+	stash->pages[page].lastUsed = stash->frame;
+}
+
+int fonsGetAtlasGeneration(FONScontext* stash)
+{
+	if (stash == NULL) return 0;
+	return stash->generation;
+}
+
+int fonsGetPageGeneration(FONScontext* stash, int page)
+{
+	if (stash == NULL) return 0;
+	if (page < 0 || page >= stash->npages) return stash->generation+1;
+	return stash->pages[page].generation;
+}
+
+int fonsDeferGlyphs(FONScontext* stash, int nthreads)
+{
+	int i;
+	if (stash == NULL) return 0;
+#ifdef FONS_USE_FREETYPE
+	// A FreeType face can not be used by several threads.
+	if (nthreads > 0) return 0;
+#endif
+
+	// Finish the pending glyphs with the scratch memory there is.
+	for (i = 0; i < stash->njobs; i++)
+		fonsRasterizeGlyph(stash, i, 0);
+	fonsCommitGlyphs(stash, stash->njobs);
+
+	for (i = 0; i < stash->nthreads; i++)
+		free(stash->threadScratch[i].data);
+	free(stash->threadScratch);
+	stash->threadScratch = NULL;
+	stash->nthreads = 0;
+	if (nthreads <= 0) return 1;
+
+	stash->threadScratch = (FONSscratch*)calloc(nthreads, sizeof(FONSscratch));
+	if (stash->threadScratch == NULL) return 0;
+	for (i = 0; i < nthreads; i++) {
+		stash->threadScratch[i].data = (unsigned char*)malloc(FONS_SCRATCH_BUF_SIZE);
+		if (stash->threadScratch[i].data == NULL) {
+			// Every thread needs its scratch memory, rasterize right away.
+			while (i-- > 0)
+				free(stash->threadScratch[i].data);
+			free(stash->threadScratch);
+			stash->threadScratch = NULL;
+			return 0;
+		}
+	}
+	stash->nthreads = nthreads;
+	return 1;
+}
+
+int fonsGetPendingGlyphs(FONScontext* stash)
+{
+	if (stash == NULL) return 0;
+	return stash->njobs;
+}
+
+void fonsRasterizeGlyph(FONScontext* stash, int index, int thread)
+{
+#ifndef FONS_USE_FREETYPE
+	FONSglyphJob* job = &stash->jobs[index];
+	FONSscratch* scratch = &stash->threadScratch[thread];
+	// The font is shared, a copy lets stb_truetype allocate from the
+	// scratch memory of this thread.
+	FONSttFontImpl font = job->font->font;
+	font.font.userdata = scratch;
+	scratch->n = 0;
+	if (stash->params.flags & FONS_SDF_GLYPHS)
+		fons__tt_renderGlyphSDF(&font, &job->bitmap[1 + job->w], job->w - 2, job->h - 2, job->w,
+								job->scale, FONS_SDF_PADDING, job->index);
+	else
+		fons__tt_renderGlyphBitmap(&font, &job->bitmap[job->pad + job->pad * job->w],
+								   job->w - job->pad*2, job->h - job->pad*2, job->w,
+								   job->scale, job->scale, job->index);
+#else
+	FONS_NOTUSED(stash);
+	FONS_NOTUSED(index);
+	FONS_NOTUSED(thread);
+#endif
+}
+
+void fonsCommitGlyphs(FONScontext* stash, int count)
+{
+	int i, y;
+	if (stash == NULL) return;
+	count = fons__mini(count, stash->njobs);
+	for (i = 0; i < count; i++) {
+		FONSglyphJob* job = &stash->jobs[i];
+		FONSpage* page = &stash->pages[job->page];
+		unsigned char* dst = &page->texData[job->x + job->y * stash->params.width];
+		for (y = 0; y < job->h; y++)
+			memcpy(&dst[y * stash->params.width], &job->bitmap[y * job->w], job->w);
+		if (job->blur > 0) {
+			stash->scratch.n = 0;
+			fons__blur(stash, dst, job->w, job->h, stash->params.width, job->blur);
+		}
+		fons__addDirtyRect(page, job->x, job->y, job->x + job->w, job->y + job->h);
+		free(job->bitmap);
+	}
+	stash->njobs -= count;
+	memmove(stash->jobs, &stash->jobs[count], sizeof(FONSglyphJob) * stash->njobs);
+}
+
 void fonsDeleteInternal(FONScontext* stash)
 {
 	int i;
@@ -1663,10 +2182,16 @@ void fonsDeleteInternal(FONScontext* stash)
 	for (i = 0; i < stash->nfonts; ++i)
 		fons__freeFont(stash->fonts[i]);
 
-	if (stash->atlas) fons__deleteAtlas(stash->atlas);
+	for (i = 0; i < stash->npages; ++i)
+		fons__freePage(&stash->pages[i]);
+	for (i = 0; i < stash->njobs; ++i)
+		free(stash->jobs[i].bitmap);
+	free(stash->jobs);
+	for (i = 0; i < stash->nthreads; ++i)
+		free(stash->threadScratch[i].data);
+	free(stash->threadScratch);
 	if (stash->fonts) free(stash->fonts);
-	if (stash->texData) free(stash->texData);
-	if (stash->scratch) free(stash->scratch);
+	if (stash->scratch.data) free(stash->scratch.data);
 	fons__tt_done(stash);
 	free(stash);
 }
@@ -1678,6 +2203,12 @@ void fonsSetErrorCallback(FONScontext* stash, void (*callback)(void* uptr, int e
 	stash->errorUptr = uptr;
 }
 
+int fonsGetFlags(FONScontext* stash)
+{
+	if (stash == NULL) return 0;
+	return stash->params.flags;
+}
+
 void fonsGetAtlasSize(FONScontext* stash, int* width, int* height)
 {
 	if (stash == NULL) return;
@@ -1689,7 +2220,11 @@ int fonsExpandAtlas(FONScontext* stash, int width, int height)
 {
 	int i, maxy = 0;
 	unsigned char* data = NULL;
+	FONSpage* page;
 	if (stash == NULL) return 0;
+	// All pages share the atlas size, only a single page can grow.
+	if (stash->npages > 1) return 0;
+	page = &stash->pages[0];
 
 	width = fons__maxi(width, stash->params.width);
 	height = fons__maxi(height, stash->params.height);
@@ -1711,7 +2246,7 @@ int fonsExpandAtlas(FONScontext* stash, int width, int height)
 		return 0;
 	for (i = 0; i < stash->params.height; i++) {
 		unsigned char* dst = &data[i*width];
-		unsigned char* src = &stash->texData[i*stash->params.width];
+		unsigned char* src = &page->texData[i*stash->params.width];
 		memcpy(dst, src, stash->params.width);
 		if (width > stash->params.width)
 			memset(dst+stash->params.width, 0, width - stash->params.width);
@@ -1719,19 +2254,19 @@ int fonsExpandAtlas(FONScontext* stash, int width, int height)
 	if (height > stash->params.height)
 		memset(&data[stash->params.height * width], 0, (height - stash->params.height) * width);
 
-	free(stash->texData);
-	stash->texData = data;
+	free(page->texData);
+	page->texData = data;
 
 	// Increase atlas size
-	fons__atlasExpand(stash->atlas, width, height);
+	fons__atlasExpand(page->atlas, width, height);
 
 	// Add existing data as dirty.
-	for (i = 0; i < stash->atlas->nnodes; i++)
-		maxy = fons__maxi(maxy, stash->atlas->nodes[i].y);
-	stash->dirtyRect[0] = 0;
-	stash->dirtyRect[1] = 0;
-	stash->dirtyRect[2] = stash->params.width;
-	stash->dirtyRect[3] = maxy;
+	for (i = 0; i < page->atlas->nnodes; i++)
+		maxy = fons__maxi(maxy, page->atlas->nodes[i].y);
+	page->dirtyRect[0] = 0;
+	page->dirtyRect[1] = 0;
+	page->dirtyRect[2] = stash->params.width;
+	page->dirtyRect[3] = maxy;
 
 	stash->params.width = width;
 	stash->params.height = height;
@@ -1744,6 +2279,7 @@ int fonsExpandAtlas(FONScontext* stash, int width, int height)
 int fonsResetAtlas(FONScontext* stash, int width, int height)
 {
 	int i, j;
+	FONSpage* page;
 	if (stash == NULL) return 0;
 
 	// Flush pending glyphs.
@@ -1755,19 +2291,28 @@ int fonsResetAtlas(FONScontext* stash, int width, int height)
 			return 0;
 	}
 
+	// Drop all but the first page, the rest are allocated again on demand.
+	fons__dropJobs(stash, 0, FONS_MAX_PAGES);
+	for (i = 1; i < stash->npages; i++)
+		fons__freePage(&stash->pages[i]);
+	stash->npages = 1;
+	page = &stash->pages[0];
+
 	// Reset atlas
-	fons__atlasReset(stash->atlas, width, height);
+	fons__atlasReset(page->atlas, width, height);
 
 	// Clear texture data.
-	stash->texData = (unsigned char*)realloc(stash->texData, width * height);
-	if (stash->texData == NULL) return 0;
-	memset(stash->texData, 0, width * height);
+	page->texData = (unsigned char*)realloc(page->texData, width * height);
+	if (page->texData == NULL) return 0;
+	memset(page->texData, 0, width * height);
 
 	// Reset dirty rect
-	stash->dirtyRect[0] = width;
-	stash->dirtyRect[1] = height;
-	stash->dirtyRect[2] = 0;
-	stash->dirtyRect[3] = 0;
+	page->dirtyRect[0] = width;
+	page->dirtyRect[1] = height;
+	page->dirtyRect[2] = 0;
+	page->dirtyRect[3] = 0;
+	page->lastUsed = stash->frame;
+	page->generation = ++stash->generation;
 
 	// Reset cached glyphs
 	for (i = 0; i < stash->nfonts; i++) {
@@ -1788,5 +2333,282 @@ int fonsResetAtlas(FONScontext* stash, int width, int height)
 	return 1;
 }
 
+#define FONS_ATLAS_FILE_VERSION 1
+
+// Atlas cache file header, followed by the fonts and then the pages. A page
+// is its skyline node count, the nodes and the texture data.
+struct FONSatlasHeader
+{
+	char magic[4];
+	int version;
+	int glyphSize; // Catches changes to the layout of FONSglyph.
+	int width, height;
+	int flags;
+	int npages;
+	int nfonts;
+};
+typedef struct FONSatlasHeader FONSatlasHeader;
+
+// Saved font, followed by its glyphs.
+struct FONSatlasFont
+{
+	unsigned int hash;
+	int dataSize;
+	int nglyphs;
+};
+typedef struct FONSatlasFont FONSatlasFont;
+
+static unsigned int fons__fontHash(FONSfont* font)
+{
+	int i;
+	unsigned int h = 2166136261u;
+	if (font->dataHash != 0) return font->dataHash;
+	for (i = 0; i < font->dataSize; i++) {
+		h ^= font->data[i];
+		h *= 16777619u;
+	}
+	font->dataHash = h != 0 ? h : 1;
+	return font->dataHash;
+}
+
+// Returns count items of size at *p and moves past them, NULL if the data
+// ends before.
+static const unsigned char* fons__readAtlas(const unsigned char** p, const unsigned char* end, int count, int size)
+{
+	const unsigned char* r = *p;
+	if (count < 0 || count > (end - r) / size) return NULL;
+	*p += count * size;
+	return r;
+}
+
+// A saved glyph is either missing from the atlas or lies within a page.
+static int fons__validAtlasGlyph(const FONSglyph* g, int npages, int width, int height)
+{
+	if (g->x0 < 0 && g->y0 < 0)
+		return g->page == -1;
+	return g->page >= 0 && g->page < npages &&
+		   g->x0 >= 0 && g->x0 < g->x1 && g->x1 <= width &&
+		   g->y0 >= 0 && g->y0 < g->y1 && g->y1 <= height;
+}
+
+static int fons__validAtlasNode(const FONSatlasNode* n, int width, int height)
+{
+	return n->x >= 0 && n->width >= 0 && n->x + n->width <= width &&
+		   n->y >= 0 && n->y <= height;
+}
+
+int fonsSaveAtlas(FONScontext* stash, const char* path)
+{
+	FILE* fp = 0;
+	FONSatlasHeader hdr;
+	FONSatlasFont af;
+	int i, ok, size;
+
+	if (stash == NULL) return 0;
+	size = stash->params.width * stash->params.height;
+
+	// Pending glyphs would be saved empty.
+	for (i = 0; i < stash->njobs; i++)
+		fonsRasterizeGlyph(stash, i, 0);
+	fonsCommitGlyphs(stash, stash->njobs);
+
+	fp = fopen(path, "wb");
+	if (fp == NULL) return 0;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, "FONA", 4);
+	hdr.version = FONS_ATLAS_FILE_VERSION;
+	hdr.glyphSize = (int)sizeof(FONSglyph);
+	hdr.width = stash->params.width;
+	hdr.height = stash->params.height;
+	hdr.flags = stash->params.flags & FONS_SDF_GLYPHS;
+	hdr.npages = stash->npages;
+	hdr.nfonts = stash->nfonts;
+	ok = fwrite(&hdr, sizeof(hdr), 1, fp) == 1;
+
+	for (i = 0; i < stash->nfonts && ok; i++) {
+		FONSfont* font = stash->fonts[i];
+		memset(&af, 0, sizeof(af));
+		af.hash = fons__fontHash(font);
+		af.dataSize = font->dataSize;
+		af.nglyphs = font->nglyphs;
+		ok = fwrite(&af, sizeof(af), 1, fp) == 1;
+		if (ok && font->nglyphs > 0)
+			ok = fwrite(font->glyphs, sizeof(FONSglyph), font->nglyphs, fp) == (size_t)font->nglyphs;
+	}
+
+	for (i = 0; i < stash->npages && ok; i++) {
+		FONSpage* page = &stash->pages[i];
+		ok = fwrite(&page->atlas->nnodes, sizeof(int), 1, fp) == 1 &&
+			 fwrite(page->atlas->nodes, sizeof(FONSatlasNode), page->atlas->nnodes, fp) == (size_t)page->atlas->nnodes &&
+			 fwrite(page->texData, 1, size, fp) == (size_t)size;
+	}
+
+	if (fclose(fp) != 0) ok = 0;
+	return ok;
+}
+
+int fonsLoadAtlas(FONScontext* stash, const char* path)
+{
+	FILE* fp = 0;
+	int dataSize = 0, res;
+	size_t readed;
+	unsigned char* data = NULL;
+
+	// Read in the atlas file.
+	fp = fopen(path, "rb");
+	if (fp == NULL) goto error;
+	fseek(fp,0,SEEK_END);
+	dataSize = (int)ftell(fp);
+	fseek(fp,0,SEEK_SET);
+	if (dataSize <= 0) goto error;
+	data = (unsigned char*)malloc(dataSize);
+	if (data == NULL) goto error;
+	readed = fread(data, 1, dataSize, fp);
+	fclose(fp);
+	fp = 0;
+	if (readed != (size_t)dataSize) goto error;
+
+	res = fonsLoadAtlasMem(stash, data, dataSize);
+	free(data);
+	return res;
+
+error:
+	if (data) free(data);
+	if (fp) fclose(fp);
+	return 0;
+}
+
+int fonsLoadAtlasMem(FONScontext* stash, const unsigned char* data, int ndata)
+{
+	const unsigned char* end = data + ndata;
+	const unsigned char* p = data;
+	const unsigned char* fonts;
+	const unsigned char* pages;
+	const unsigned char* r;
+	FONSatlasHeader hdr;
+	FONSatlasFont af;
+	FONSatlasNode node;
+	FONSglyph saved;
+	int i, j, k, nnodes, size;
+	int ok = 1;
+
+	if (stash == NULL || data == NULL) return 0;
+	size = stash->params.width * stash->params.height;
+
+	// Check the whole file before the atlas is touched.
+	r = fons__readAtlas(&p, end, 1, sizeof(hdr));
+	if (r == NULL) return 0;
+	memcpy(&hdr, r, sizeof(hdr));
+	if (memcmp(hdr.magic, "FONA", 4) != 0 || hdr.version != FONS_ATLAS_FILE_VERSION ||
+		hdr.glyphSize != (int)sizeof(FONSglyph) ||
+		hdr.width != stash->params.width || hdr.height != stash->params.height ||
+		hdr.flags != (stash->params.flags & FONS_SDF_GLYPHS) ||
+		hdr.npages < 1 || hdr.npages > stash->maxPages || hdr.nfonts < 0)
+		return 0;
+	fonts = p;
+	for (i = 0; i < hdr.nfonts; i++) {
+		r = fons__readAtlas(&p, end, 1, sizeof(af));
+		if (r == NULL) return 0;
+		memcpy(&af, r, sizeof(af));
+		r = fons__readAtlas(&p, end, af.nglyphs, sizeof(FONSglyph));
+		if (r == NULL) return 0;
+		for (k = 0; k < af.nglyphs; k++) {
+			memcpy(&saved, &r[k * sizeof(FONSglyph)], sizeof(FONSglyph));
+			if (!fons__validAtlasGlyph(&saved, hdr.npages, hdr.width, hdr.height))
+				return 0;
+		}
+	}
+	pages = p;
+	for (i = 0; i < hdr.npages; i++) {
+		r = fons__readAtlas(&p, end, 1, sizeof(int));
+		if (r == NULL) return 0;
+		memcpy(&nnodes, r, sizeof(int));
+		if (nnodes < 1) return 0;
+		r = fons__readAtlas(&p, end, nnodes, sizeof(FONSatlasNode));
+		if (r == NULL) return 0;
+		for (k = 0; k < nnodes; k++) {
+			memcpy(&node, &r[k * sizeof(FONSatlasNode)], sizeof(FONSatlasNode));
+			if (!fons__validAtlasNode(&node, hdr.width, hdr.height))
+				return 0;
+		}
+		if (fons__readAtlas(&p, end, size, 1) == NULL) return 0;
+	}
+
+	// Make room for the pages and their nodes, nothing is lost on failure.
+	while (stash->npages < hdr.npages) {
+		if (!fons__allocPage(stash)) return 0;
+	}
+	p = pages;
+	for (i = 0; i < hdr.npages; i++) {
+		FONSatlas* atlas = stash->pages[i].atlas;
+		memcpy(&nnodes, fons__readAtlas(&p, end, 1, sizeof(int)), sizeof(int));
+		fons__readAtlas(&p, end, nnodes, sizeof(FONSatlasNode));
+		fons__readAtlas(&p, end, size, 1);
+		if (nnodes > atlas->cnodes) {
+			FONSatlasNode* nodes = (FONSatlasNode*)realloc(atlas->nodes, sizeof(FONSatlasNode) * nnodes);
+			if (nodes == NULL) return 0;
+			atlas->nodes = nodes;
+			atlas->cnodes = nnodes;
+		}
+	}
+
+	// Replace the atlas.
+	fons__dropJobs(stash, 0, FONS_MAX_PAGES);
+	for (i = hdr.npages; i < stash->npages; i++)
+		fons__freePage(&stash->pages[i]);
+	stash->npages = hdr.npages;
+	p = pages;
+	for (i = 0; i < hdr.npages; i++) {
+		FONSpage* page = &stash->pages[i];
+		memcpy(&nnodes, fons__readAtlas(&p, end, 1, sizeof(int)), sizeof(int));
+		memcpy(page->atlas->nodes, fons__readAtlas(&p, end, nnodes, sizeof(FONSatlasNode)), sizeof(FONSatlasNode) * nnodes);
+		page->atlas->nnodes = nnodes;
+		memcpy(page->texData, fons__readAtlas(&p, end, size, 1), size);
+		fons__addDirtyRect(page, 0, 0, stash->params.width, stash->params.height);
+		page->lastUsed = stash->frame;
+	}
+	stash->lastPage = 0;
+	stash->generation++;
+	for (i = 0; i < hdr.npages; i++)
+		stash->pages[i].generation = stash->generation;
+
+	// Replace the glyphs of the fonts there are.
+	for (i = 0; i < stash->nfonts; i++) {
+		FONSfont* font = stash->fonts[i];
+		font->nglyphs = 0;
+		for (j = 0; j < FONS_HASH_LUT_SIZE; j++)
+			font->lut[j] = -1;
+	}
+	p = fonts;
+	for (i = 0; i < hdr.nfonts; i++) {
+		const unsigned char* glyphs;
+		memcpy(&af, fons__readAtlas(&p, end, 1, sizeof(af)), sizeof(af));
+		glyphs = fons__readAtlas(&p, end, af.nglyphs, sizeof(FONSglyph));
+		for (j = 0; j < stash->nfonts && ok; j++) {
+			FONSfont* font = stash->fonts[j];
+			if (font->dataSize != af.dataSize || fons__fontHash(font) != af.hash)
+				continue;
+			for (k = 0; k < af.nglyphs; k++) {
+				FONSglyph* glyph;
+				unsigned int h;
+				memcpy(&saved, &glyphs[k * sizeof(FONSglyph)], sizeof(FONSglyph));
+				glyph = fons__allocGlyph(font);
+				if (glyph == NULL) {
+					ok = 0;
+					break;
+				}
+				*glyph = saved;
+				// Insert char to hash lookup.
+				h = fons__hashint(glyph->codepoint) & (FONS_HASH_LUT_SIZE-1);
+				glyph->next = font->lut[h];
+				font->lut[h] = font->nglyphs-1;
+			}
+		}
+	}
+
+	return ok;
+}
+
 
 #endif
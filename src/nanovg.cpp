@@ -20,6 +20,7 @@
 
 #include <math.h>
 #include <memory.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #define FONTSTASH_IMPLEMENTATION
@@ -30,7 +31,24 @@
 #include "stb_image.h"
 #endif
 
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
 #include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifndef NVG_NO_SIMD
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NVG_SSE2
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define NVG_NEON
+#include <arm_neon.h>
+#endif
+#endif
 
 #ifdef _MSC_VER
 #pragma warning(disable : 4100)  // unreferenced formal parameter
@@ -40,15 +58,38 @@
 #pragma warning(disable : 4706)  // assignment within conditional expression
 #endif
 
-#define NVG_INIT_FONTIMAGE_SIZE 512
-#define NVG_MAX_FONTIMAGE_SIZE 2048
-#define NVG_MAX_FONTIMAGES 4
+#define NVG_FONTPAGE_SIZE 512
+#define NVG_MAX_FONTIMAGES 16  // one per atlas page, at most FONS_MAX_PAGES
+#define NVG_FONTATLAS_DEFAULT_BUDGET (4 * 1024 * 1024)
 
-#define NVG_INIT_COMMANDS_SIZE 256
+#define NVG_INIT_COMMANDS_SIZE 64
+#define NVG_INIT_COMMAND_POINTS_SIZE 128
 #define NVG_INIT_POINTS_SIZE 128
 #define NVG_INIT_PATHS_SIZE 16
 #define NVG_INIT_VERTS_SIZE 256
-#define NVG_MAX_STATES 32
+#define NVG_INIT_SAVE_LEVELS 32
+#define NVG_INIT_STATE_UNDO_SIZE 4096
+#define NVG_MAX_BEZIER_SEGMENTS 1024
+#define NVG_MAX_TRIANGULATE_POINTS 64
+
+#define NVG_GEOMCACHE_LUT_SIZE 256
+#define NVG_GEOMCACHE_SEEN_SIZE 1024
+#define NVG_GEOMCACHE_DEFAULT_BUDGET (4 * 1024 * 1024)
+
+#define NVG_TEXTCACHE_LUT_SIZE 4096
+#define NVG_TEXTCACHE_SEEN_SIZE 1024  // In 32 bit words.
+#define NVG_TEXTCACHE_DEFAULT_BUDGET (4 * 1024 * 1024)
+
+#define NVG_UNIFORM_LUT_SIZE 512
+
+#define NVG_INIT_TESS_JOBS_SIZE 64
+#define NVG_MAX_TESS_THREADS 16
+
+#define NVG_GLYPH_DEFAULT_BUDGET 4.0f  // Milliseconds per frame.
+#define NVG_GLYPH_BATCH_SIZE 16        // Glyphs per thread between checks.
+
+#define NVG_ARENA_ALIGN 16
+#define NVG_ARENA_MIN_BLOCK_SIZE (64 * 1024)
 
 #define NVG_KAPPA90 \
     0.5522847493f  // Length proportional to radius of a cubic bezier handle for
@@ -71,18 +112,35 @@ enum NVGpointFlags {
     NVG_PR_INNERBEVEL = 0x08,
 };
 
+// Inverse of a paint or scissor transform, computed when it is first drawn
+// and kept until the paint or scissor changes. scale is the length of the
+// axes of a scissor transform.
+struct NVGinverse {
+    int valid;
+    float xform[6];
+    float scale[2];
+};
+
+// The fields of each NVGstateBlock are contiguous.
 struct NVGstate {
+    // NVG_STATE_PAINT
     NVGcompositeOperationState compositeOperation;
     int shapeAntiAlias;
     NVGpaint fill;
     NVGpaint stroke;
+    NVGinverse fillInverse;
+    NVGinverse strokeInverse;
     float strokeWidth;
     float miterLimit;
     int lineJoin;
     int lineCap;
     float alpha;
+    // NVG_STATE_XFORM
     float xform[6];
+    // NVG_STATE_SCISSOR
     NVGscissor scissor;
+    NVGinverse scissorInverse;
+    // NVG_STATE_TEXT
     float fontSize;
     float letterSpacing;
     float lineHeight;
@@ -92,17 +150,35 @@ struct NVGstate {
 };
 typedef struct NVGstate NVGstate;
 
-struct NVGpoint {
-    float x, y;
-    float dx, dy;
-    float len;
-    float dmx, dmy;
-    unsigned char flags;
+// Parts of the state which nvgSave() and nvgRestore() track separately.
+// Only the blocks changed after a save are copied, see nvg__writeState().
+enum NVGstateBlock {
+    NVG_STATE_PAINT = 1 << 0,
+    NVG_STATE_XFORM = 1 << 1,
+    NVG_STATE_SCISSOR = 1 << 2,
+    NVG_STATE_TEXT = 1 << 3,
+    NVG_STATE_ALL = 0xf,
+};
+
+// A nvgSave() level, the blocks changed since the save and the offset of
+// their old values in the undo log.
+struct NVGsaveLevel {
+    int changed;
+    int undoOffset;
 };
-typedef struct NVGpoint NVGpoint;
+typedef struct NVGsaveLevel NVGsaveLevel;
 
 struct NVGpathCache {
-    NVGpoint* points;
+    // Flattened points, stored as a structure of arrays so that each pass
+    // over them only loads the fields it uses.
+    float* px;  // Position.
+    float* py;
+    float* dx;  // Direction to the next point.
+    float* dy;
+    float* len;  // Length of the segment to the next point.
+    float* dmx;  // Extrusion.
+    float* dmy;
+    unsigned char* flags;
     int npoints;
     int cpoints;
     NVGpath* paths;
@@ -115,30 +191,281 @@ struct NVGpathCache {
 };
 typedef struct NVGpathCache NVGpathCache;
 
+enum NVGgeomType {
+    NVG_GEOM_FILL = 1,
+    NVG_GEOM_STROKE = 2,
+};
+
+// Everything besides the path commands which affects the tessellation.
+struct NVGgeomKey {
+    int type;
+    int lineJoin;
+    int lineCap;
+    float width;
+    float fringe;
+    float miterLimit;
+    float tessTol;
+};
+typedef struct NVGgeomKey NVGgeomKey;
+
+struct NVGgeomEntry {
+    unsigned int hash;
+    NVGgeomKey key;
+    unsigned char* commands;
+    int ncommands;
+    float* commandPts;
+    int ncommandPts;
+    NVGpath* paths;
+    int npaths;
+    NVGvertex* verts;
+    int nverts;
+    float bounds[4];
+    int size;
+    struct NVGgeomEntry* next;  // Next entry in the same hash bucket.
+    struct NVGgeomEntry* lruPrev;
+    struct NVGgeomEntry* lruNext;
+};
+typedef struct NVGgeomEntry NVGgeomEntry;
+
+struct NVGgeomCache {
+    NVGgeomEntry* lut[NVG_GEOMCACHE_LUT_SIZE];
+    NVGgeomEntry* lruHead;  // Most recently used.
+    NVGgeomEntry* lruTail;  // Least recently used.
+    unsigned int seen[NVG_GEOMCACHE_SEEN_SIZE];
+    int budget;
+    int bytes;
+    int nentries;
+    int hits;
+    int misses;
+    int evictions;
+};
+typedef struct NVGgeomCache NVGgeomCache;
+
+// Everything besides the string which affects the glyph quads. The sizes
+// are in font pixels, the origin is the fraction of the pixel the text is
+// drawn at.
+struct NVGtextKey {
+    int fontId;
+    int align;
+    float size;
+    float spacing;
+    float blur;
+    float originx;
+    float originy;
+};
+typedef struct NVGtextKey NVGtextKey;
+
+// Glyph quads in font pixels, relative to the whole pixel the text is drawn
+// at. Each quad has the corners x0,y0 x1,y0 x1,y1 x0,y1 in pts,
+// s0,t0,s1,t1 in uvs and the atlas page of its glyph in pages.
+struct NVGtextLayout {
+    float* pts;
+    float* uvs;
+    int* pages;
+    int nquads;
+    float nextx;
+};
+typedef struct NVGtextLayout NVGtextLayout;
+
+struct NVGtextEntry {
+    unsigned int hash;
+    NVGtextKey key;
+    int fontGeneration;   // Font generation the quads were laid out with.
+    int atlasGeneration;  // Atlas generation the glyphs were in the atlas.
+    unsigned int pages;   // Bit set of the atlas pages the quads use.
+    char* string;
+    int nstring;
+    NVGtextLayout layout;
+    int size;
+    struct NVGtextEntry* next;  // Next entry in the same hash bucket.
+    struct NVGtextEntry* lruPrev;
+    struct NVGtextEntry* lruNext;
+};
+typedef struct NVGtextEntry NVGtextEntry;
+
+struct NVGtextCache {
+    NVGtextEntry* lut[NVG_TEXTCACHE_LUT_SIZE];
+    NVGtextEntry* lruHead;  // Most recently used.
+    NVGtextEntry* lruTail;  // Least recently used.
+    // Bit set of the hashes seen once. Unlike a table of hashes, labels
+    // which share a slot do not keep each other out of the cache.
+    unsigned int seen[NVG_TEXTCACHE_SEEN_SIZE];
+    int nseen;
+    int budget;
+    int bytes;
+    int nentries;
+    int hits;
+    int misses;
+    int evictions;
+};
+typedef struct NVGtextCache NVGtextCache;
+
+struct NVGarenaBlock {
+    struct NVGarenaBlock* next;
+    size_t size;
+    size_t used;
+};
+typedef struct NVGarenaBlock NVGarenaBlock;
+
+// Bump allocator for the per frame buffers, the default frame allocator.
+struct NVGarena {
+    NVGarenaBlock* blocks;  // Current block first.
+    void* last;             // Latest allocation, can be grown in place.
+    size_t lastSize;
+    size_t used;  // Bytes handed out since the last reset.
+    size_t highWater;
+};
+typedef struct NVGarena NVGarena;
+
+// Analytic description of a path which consists of a single rectangle,
+// rounded rectangle or circle, in the space of the transform it was added
+// with.
+struct NVGshape {
+    int end;  // Command count right after the shape, 0 when there is none.
+    float xform[6];
+    float cx, cy;
+    float hw, hh;  // Half extents.
+    float radius;
+};
+typedef struct NVGshape NVGshape;
+
+// A fill or stroke of NVG_DEFERRED_TESSELLATION, the copy of its path
+// commands and the state it was drawn with, and the tessellated paths.
+struct NVGtessJob {
+    int type;  // NVGgeomType
+    int call;  // Draw call reserved in submission order.
+    unsigned char* commands;
+    int ncommands;
+    float* commandPts;
+    int ncommandPts;
+    NVGpaint paint;
+    NVGcompositeOperationState compositeOperation;
+    NVGscissor scissor;
+    NVGinverse paintInverse;
+    NVGinverse scissorInverse;
+    float width;  // Fringe width of a fill, stroke width of a stroke.
+    float fringe;
+    int lineCap;
+    int lineJoin;
+    float miterLimit;
+    int cacheInsert;  // Offer the geometry to the geometry cache.
+    unsigned int hash;
+    NVGgeomKey key;
+    // Output, in the frame memory of the worker until it is copied to verts.
+    NVGpath* paths;
+    int npaths;
+    int nverts;
+    float bounds[4];
+    NVGvertex* verts;  // Range of the frame vertex buffer.
+};
+typedef struct NVGtessJob NVGtessJob;
+
 struct NVGcontext {
     NVGparams params = {};
-    float* commands = {};
+    // Path commands, one byte per command followed by the winding for
+    // NVG_WINDING. The transformed points of the commands are packed in
+    // commandPts as x,y pairs.
+    unsigned char* commands = {};
     int ccommands = {};
     int ncommands = {};
+    float* commandPts = {};
+    int ccommandPts = {};
+    int ncommandPts = {};
     float commandx = {};
     float commandy = {};
-    NVGstate states[NVG_MAX_STATES] = {};
-    int nstates = {};
+    // Bounds of the transformed command points, used to skip paths which
+    // are outside the view or scissor without tessellating them.
+    float commandBounds[4] = {};
+    NVGshape shape = {};
+    NVGstate state = {};
+    NVGsaveLevel* levels = {};
+    int nlevels = {};
+    int clevels = {};
+    // Values of the blocks before their first change on each save level,
+    // each an int NVGstateBlock followed by the block, 16 byte aligned.
+    unsigned char* stateUndo = {};
+    int nstateUndo = {};
+    int cstateUndo = {};
     NVGpathCache* cache = {};
+    NVGgeomCache* geomCache = {};
+    NVGtextCache* textCache = {};
+    // Fills and strokes waiting for nvg__flushTessellation().
+    NVGtessJob* tessJobs = {};
+    int ntessJobs = {};
+    int ctessJobs = {};
+    struct NVGtessPool* tessPool = {};
+    int tessWorker = {};  // Context of a tessellation thread.
+    NVGarena arena = {};
+    NVGallocator allocator = {};
+    unsigned int commandsHash = {};
+    int commandsHashValid = {};
     float tessTol = {};
     float distTol = {};
     float fringeWidth = {};
     float devicePxRatio = {};
+    float viewWidth = {};
+    float viewHeight = {};
     struct FONScontext* fs = {};
-    int fontImages[NVG_MAX_FONTIMAGES] = {};
-    int fontImageIdx = {};
+    int fontImages[NVG_MAX_FONTIMAGES] = {};  // One per atlas page.
+    int maxFontPages = {};
+    // Recorders use the font stash and font images of the context which
+    // created them, one at a time under fontMutex.
+    NVGcontext* fontOwner = {};
+    std::recursive_mutex* fontMutex = {};
+    int atlasFull = {};  // A recorder could not add an atlas page.
+    float glyphBudget = {};  // Milliseconds of NVG_ASYNC_GLYPHS per frame.
+    // Bumped when cached text layouts may no longer match the font atlas
+    // or the fallback fonts.
+    int fontGeneration = {};
     int drawCallCount = {};
     int fillTriCount = {};
     int strokeTriCount = {};
     int textTriCount = {};
+    int culledFillCount = {};
+    int culledStrokeCount = {};
+    int culledInstanceCount = {};
     bool isInit = false;
 };
 
+// Threads which run the jobs of NVG_DEFERRED_TESSELLATION and rasterize the
+// glyphs of NVG_ASYNC_GLYPHS. The thread which flushes the jobs works on
+// them too, as worker 0. Each worker tessellates
+// with a context of its own. Jobs are claimed one by one from a shared
+// counter, so that threads which finish early take over the rest.
+struct NVGtessPool {
+    std::vector<std::thread> threads;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::mutex geomMutex;  // Guards the geometry cache of the context.
+    NVGcontext* workers[NVG_MAX_TESS_THREADS] = {};
+    int nworkers = {};
+    void (*run)(void* userPtr, int worker, int job) = {};
+    void* userPtr = {};
+    std::atomic<int> next = {};  // Next job to claim.
+    int njobs = {};
+    int generation = {};  // Bumped for every batch of jobs.
+    int nbusy = {};       // Threads still working on the batch.
+    bool quit = false;
+};
+
+// Holds the font mutex of a context which shares its fonts with recorders
+// for the rest of the scope.
+struct NVGfontLock {
+    std::recursive_mutex* mutex;
+    explicit NVGfontLock(NVGcontext* ctx) : mutex(ctx->fontMutex) {
+        if (mutex != NULL) mutex->lock();
+    }
+    ~NVGfontLock() {
+        if (mutex != NULL) mutex->unlock();
+    }
+};
+
+// Context which owns the font stash and font images.
+static NVGcontext* nvg__fonts(NVGcontext* ctx) {
+    return ctx->fontOwner != NULL ? ctx->fontOwner : ctx;
+}
+
 static float nvg__sqrtf(float a) { return sqrtf(a); }
 static float nvg__modf(float a, float b) { return fmodf(a, b); }
 static float nvg__sinf(float a) { return sinf(a); }
@@ -173,38 +500,291 @@ static float nvg__normalize(float* x, float* y) {
     return d;
 }
 
+static size_t nvg__arenaAlign(size_t size) {
+    return (size + NVG_ARENA_ALIGN - 1) & ~(size_t)(NVG_ARENA_ALIGN - 1);
+}
+
+static unsigned char* nvg__arenaBlockData(NVGarenaBlock* block) {
+    return (unsigned char*)block + nvg__arenaAlign(sizeof(NVGarenaBlock));
+}
+
+static NVGarenaBlock* nvg__arenaAllocBlock(size_t size) {
+    NVGarenaBlock* block = (NVGarenaBlock*)malloc(
+        nvg__arenaAlign(sizeof(NVGarenaBlock)) + size);
+    if (block == NULL) return NULL;
+    block->next = NULL;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
+
+static void nvg__arenaFreeBlocks(NVGarena* arena) {
+    NVGarenaBlock* block = arena->blocks;
+    while (block != NULL) {
+        NVGarenaBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->blocks = NULL;
+}
+
+static void* nvg__arenaReallocate(void* userPtr, void* ptr, size_t oldSize,
+                                  size_t newSize) {
+    NVGarena* arena = (NVGarena*)userPtr;
+    NVGarenaBlock* block = arena->blocks;
+    size_t size = nvg__arenaAlign(newSize);
+    unsigned char* mem;
+
+    if (ptr != NULL && newSize <= oldSize) return ptr;
+
+    // The latest allocation can grow in place if the block has room.
+    if (ptr != NULL && ptr == arena->last) {
+        size_t start = (unsigned char*)ptr - nvg__arenaBlockData(block);
+        if (start + size <= block->size) {
+            block->used = start + size;
+            arena->used += size - arena->lastSize;
+            arena->lastSize = size;
+            return ptr;
+        }
+    }
+
+    if (block == NULL || block->used + size > block->size) {
+        size_t blockSize = NVG_ARENA_MIN_BLOCK_SIZE;
+        if (block != NULL && block->size * 2 > blockSize)
+            blockSize = block->size * 2;
+        if (size > blockSize) blockSize = size;
+        block = nvg__arenaAllocBlock(blockSize);
+        if (block == NULL) return NULL;
+        block->next = arena->blocks;
+        arena->blocks = block;
+    }
+
+    mem = nvg__arenaBlockData(block) + block->used;
+    block->used += size;
+    arena->used += size;
+    arena->last = mem;
+    arena->lastSize = size;
+    if (ptr != NULL) memcpy(mem, ptr, oldSize);
+    return mem;
+}
+
+static void nvg__arenaReset(void* userPtr) {
+    NVGarena* arena = (NVGarena*)userPtr;
+    if (arena->used > arena->highWater) arena->highWater = arena->used;
+    if (arena->blocks != NULL && arena->blocks->next != NULL) {
+        // The frame did not fit in one block, replace the blocks with a
+        // single block which holds the largest frame so far.
+        nvg__arenaFreeBlocks(arena);
+        arena->blocks =
+            nvg__arenaAllocBlock(nvg__arenaAlign(arena->highWater));
+    }
+    if (arena->blocks != NULL) arena->blocks->used = 0;
+    arena->last = NULL;
+    arena->lastSize = 0;
+    arena->used = 0;
+}
+
+static void nvg__defaultAllocator(NVGcontext* ctx) {
+    ctx->allocator.reallocate = nvg__arenaReallocate;
+    ctx->allocator.reset = nvg__arenaReset;
+    ctx->allocator.userPtr = &ctx->arena;
+}
+
+// Grows a per frame array to hold at least n elements. The arrays are
+// forgotten when the frame memory is reset, but keep their capacity, which is
+// used as the size of the first allocation on the next frame.
+static void* nvg__frameGrow(const NVGallocator* alloc, void* ptr, int* cap,
+                            int n, int minCap, size_t elemSize) {
+    size_t oldSize = ptr != NULL ? elemSize * (*cap) : 0;
+    int ncap;
+    if (ptr != NULL && n <= *cap) return ptr;
+    if (ptr == NULL)
+        ncap = nvg__maxi(nvg__maxi(n, *cap), minCap);
+    else
+        ncap = nvg__maxi(n, minCap) + *cap / 2;  // 1.5x Overallocate
+    ptr = alloc->reallocate(alloc->userPtr, ptr, oldSize, elemSize * ncap);
+    if (ptr == NULL) return NULL;
+    *cap = ncap;
+    return ptr;
+}
+
 static void nvg__deletePathCache(NVGpathCache* c) {
     if (c == NULL) return;
-    if (c->points != NULL) free(c->points);
-    if (c->paths != NULL) free(c->paths);
-    if (c->verts != NULL) free(c->verts);
     free(c);
 }
 
 static NVGpathCache* nvg__allocPathCache(void) {
     NVGpathCache* c = (NVGpathCache*)malloc(sizeof(NVGpathCache));
-    if (c == NULL) goto error;
+    if (c == NULL) return NULL;
     memset(c, 0, sizeof(NVGpathCache));
 
-    c->points = (NVGpoint*)malloc(sizeof(NVGpoint) * NVG_INIT_POINTS_SIZE);
-    if (!c->points) goto error;
-    c->npoints = 0;
+    // The arrays live in the frame memory, allocated on first use.
     c->cpoints = NVG_INIT_POINTS_SIZE;
-
-    c->paths = (NVGpath*)malloc(sizeof(NVGpath) * NVG_INIT_PATHS_SIZE);
-    if (!c->paths) goto error;
-    c->npaths = 0;
     c->cpaths = NVG_INIT_PATHS_SIZE;
-
-    c->verts = (NVGvertex*)malloc(sizeof(NVGvertex) * NVG_INIT_VERTS_SIZE);
-    if (!c->verts) goto error;
-    c->nverts = 0;
     c->cverts = NVG_INIT_VERTS_SIZE;
 
     return c;
-error:
-    nvg__deletePathCache(c);
-    return NULL;
+}
+
+static void nvg__clearBounds(float* bounds) {
+    bounds[0] = bounds[1] = 1e30f;
+    bounds[2] = bounds[3] = -1e30f;
+}
+
+// Releases the per frame buffers back to the frame allocator.
+static void nvg__resetFrameMemory(NVGcontext* ctx) {
+    ctx->params.clear();
+    if (ctx->allocator.reset != NULL)
+        ctx->allocator.reset(ctx->allocator.userPtr);
+    ctx->commands = NULL;
+    ctx->ncommands = 0;
+    ctx->commandPts = NULL;
+    ctx->ncommandPts = 0;
+    ctx->commandsHashValid = 0;
+    ctx->shape.end = 0;
+    ctx->tessJobs = NULL;
+    ctx->ntessJobs = 0;
+    nvg__clearBounds(ctx->commandBounds);
+    if (ctx->cache != NULL) {
+        ctx->cache->px = NULL;
+        ctx->cache->npoints = 0;
+        ctx->cache->paths = NULL;
+        ctx->cache->npaths = 0;
+        ctx->cache->verts = NULL;
+        ctx->cache->nverts = 0;
+    }
+}
+
+static void nvg__deleteGeomCache(NVGgeomCache* gc) {
+    NVGgeomEntry* entry;
+    if (gc == NULL) return;
+    entry = gc->lruHead;
+    while (entry != NULL) {
+        NVGgeomEntry* next = entry->lruNext;
+        free(entry);
+        entry = next;
+    }
+    free(gc);
+}
+
+static NVGgeomCache* nvg__allocGeomCache(void) {
+    NVGgeomCache* gc = (NVGgeomCache*)malloc(sizeof(NVGgeomCache));
+    if (gc == NULL) return NULL;
+    memset(gc, 0, sizeof(NVGgeomCache));
+    gc->budget = NVG_GEOMCACHE_DEFAULT_BUDGET;
+    return gc;
+}
+
+static void nvg__deleteTextCache(NVGtextCache* tc) {
+    NVGtextEntry* entry;
+    if (tc == NULL) return;
+    entry = tc->lruHead;
+    while (entry != NULL) {
+        NVGtextEntry* next = entry->lruNext;
+        free(entry);
+        entry = next;
+    }
+    free(tc);
+}
+
+static NVGtextCache* nvg__allocTextCache(void) {
+    NVGtextCache* tc = (NVGtextCache*)malloc(sizeof(NVGtextCache));
+    if (tc == NULL) return NULL;
+    memset(tc, 0, sizeof(NVGtextCache));
+    tc->budget = NVG_TEXTCACHE_DEFAULT_BUDGET;
+    return tc;
+}
+
+// Runs the jobs of the batches handed to the pool by nvg__runJobs().
+static void nvg__runPoolJobs(NVGtessPool* pool, int worker) {
+    int job;
+    while ((job = pool->next.fetch_add(1)) < pool->njobs)
+        pool->run(pool->userPtr, worker, job);
+}
+
+static void nvg__poolThread(NVGtessPool* pool, int worker) {
+    int generation = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(pool->mutex);
+            pool->wake.wait(lock, [&] {
+                return pool->quit || pool->generation != generation;
+            });
+            if (pool->quit) return;
+            generation = pool->generation;
+        }
+        nvg__runPoolJobs(pool, worker);
+        {
+            std::lock_guard<std::mutex> lock(pool->mutex);
+            if (--pool->nbusy == 0) pool->done.notify_one();
+        }
+    }
+}
+
+// Calls run for jobs 0..njobs-1 on the threads of the pool and returns when
+// all of them are done.
+static void nvg__runJobs(NVGtessPool* pool, int njobs,
+                         void (*run)(void* userPtr, int worker, int job),
+                         void* userPtr) {
+    int i;
+    if (pool->threads.empty() || njobs < 2) {
+        for (i = 0; i < njobs; i++) run(userPtr, 0, i);
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        pool->run = run;
+        pool->userPtr = userPtr;
+        pool->njobs = njobs;
+        pool->next = 0;
+        pool->nbusy = (int)pool->threads.size();
+        pool->generation++;
+    }
+    pool->wake.notify_all();
+    nvg__runPoolJobs(pool, 0);
+    std::unique_lock<std::mutex> lock(pool->mutex);
+    pool->done.wait(lock, [&] { return pool->nbusy == 0; });
+}
+
+static void nvg__deleteTessPool(NVGtessPool* pool) {
+    int i;
+    if (pool == NULL) return;
+    {
+        std::lock_guard<std::mutex> lock(pool->mutex);
+        pool->quit = true;
+    }
+    pool->wake.notify_all();
+    for (auto& thread : pool->threads) thread.join();
+    for (i = 0; i < pool->nworkers; i++) {
+        // The geometry cache belongs to the main context.
+        pool->workers[i]->geomCache = NULL;
+        nvgDelete(pool->workers[i]);
+    }
+    delete pool;
+}
+
+// Creates the worker contexts and starts a thread per hardware thread, less
+// the one of the caller.
+static NVGtessPool* nvg__allocTessPool(NVGcontext* ctx) {
+    NVGtessPool* pool = new NVGtessPool;
+    int i, n = (int)std::thread::hardware_concurrency();
+    n = nvg__clampi(n, 1, NVG_MAX_TESS_THREADS);
+    for (i = 0; i < n; i++) {
+        NVGcontext* worker = new NVGcontext;
+        pool->workers[pool->nworkers++] = worker;
+        worker->tessWorker = 1;
+        worker->geomCache = ctx->geomCache;
+        nvg__defaultAllocator(worker);
+        worker->params.setAllocator(&worker->allocator);
+        worker->cache = nvg__allocPathCache();
+        if (worker->cache == NULL) {
+            nvg__deleteTessPool(pool);
+            return NULL;
+        }
+    }
+    for (i = 1; i < n; i++)
+        pool->threads.emplace_back(nvg__poolThread, pool, i);
+    return pool;
 }
 
 static void nvg__setDevicePixelRatio(NVGcontext* ctx, float ratio) {
@@ -264,8 +844,89 @@ static NVGcompositeOperationState nvg__compositeOperationState(
     return state;
 }
 
-static NVGstate* nvg__getState(NVGcontext* ctx) {
-    return &ctx->states[ctx->nstates - 1];
+static NVGstate* nvg__getState(NVGcontext* ctx) { return &ctx->state; }
+
+// Returns the offset of a state block in NVGstate and its size.
+static void nvg__stateBlock(int block, size_t* offset, size_t* size) {
+    switch (block) {
+        case NVG_STATE_PAINT:
+            *offset = offsetof(NVGstate, compositeOperation);
+            *size = offsetof(NVGstate, xform) - *offset;
+            break;
+        case NVG_STATE_XFORM:
+            *offset = offsetof(NVGstate, xform);
+            *size = sizeof(float) * 6;
+            break;
+        case NVG_STATE_SCISSOR:
+            *offset = offsetof(NVGstate, scissor);
+            *size = offsetof(NVGstate, fontSize) - *offset;
+            break;
+        default:
+            *offset = offsetof(NVGstate, fontSize);
+            *size = sizeof(NVGstate) - *offset;
+            break;
+    }
+}
+
+// Copies a state block. The sizes are constants in each case, which lets the
+// compiler inline the copies.
+static void nvg__copyStateBlock(int block, unsigned char* dst,
+                                const unsigned char* src) {
+    switch (block) {
+        case NVG_STATE_PAINT:
+            memcpy(dst, src, offsetof(NVGstate, xform));
+            break;
+        case NVG_STATE_XFORM:
+            memcpy(dst, src, sizeof(float) * 6);
+            break;
+        case NVG_STATE_SCISSOR:
+            memcpy(dst, src,
+                   offsetof(NVGstate, fontSize) - offsetof(NVGstate, scissor));
+            break;
+        default:
+            memcpy(dst, src, sizeof(NVGstate) - offsetof(NVGstate, fontSize));
+            break;
+    }
+}
+
+// Returns the state for changing the given blocks. The first change of a
+// block after nvgSave() copies its old value to the undo log.
+static NVGstate* nvg__writeState(NVGcontext* ctx, int blocks) {
+    NVGsaveLevel* level;
+    int block;
+    // The bottom level is never restored.
+    if (ctx->nlevels <= 1) return &ctx->state;
+    level = &ctx->levels[ctx->nlevels - 1];
+    blocks &= ~level->changed;
+    for (block = 1; blocks != 0; block <<= 1) {
+        size_t offset, size;
+        int n;
+        if ((blocks & block) == 0) continue;
+        blocks &= ~block;
+        nvg__stateBlock(block, &offset, &size);
+        n = (int)(16 + ((size + 15) & ~15));
+        if (ctx->nstateUndo + n > ctx->cstateUndo) {
+            int cundo = nvg__maxi(nvg__maxi(ctx->nstateUndo + n,
+                                            ctx->cstateUndo * 2),
+                                  NVG_INIT_STATE_UNDO_SIZE);
+            unsigned char* undo =
+                (unsigned char*)realloc(ctx->stateUndo, cundo);
+            if (undo == NULL) return &ctx->state;
+            ctx->stateUndo = undo;
+            ctx->cstateUndo = cundo;
+        }
+        memcpy(&ctx->stateUndo[ctx->nstateUndo], &block, sizeof(int));
+        nvg__copyStateBlock(block, &ctx->stateUndo[ctx->nstateUndo + 16],
+                            (unsigned char*)&ctx->state + offset);
+        ctx->nstateUndo += n;
+        level->changed |= block;
+    }
+    return &ctx->state;
+}
+
+// Font atlas pages hold distance fields when fontstash supports them.
+static int nvg__fontImageFlags(NVGcontext* ctx) {
+    return (fonsGetFlags(ctx->fs) & FONS_SDF_GLYPHS) ? NVG_IMAGE_SDF : 0;
 }
 
 static void _initialize(NVGcontext* ctx) {
@@ -277,9 +938,10 @@ static void _initialize(NVGcontext* ctx) {
     // Init font rendering
     FONSparams fontParams;
     memset(&fontParams, 0, sizeof(fontParams));
-    fontParams.width = NVG_INIT_FONTIMAGE_SIZE;
-    fontParams.height = NVG_INIT_FONTIMAGE_SIZE;
+    fontParams.width = NVG_FONTPAGE_SIZE;
+    fontParams.height = NVG_FONTPAGE_SIZE;
     fontParams.flags = FONS_ZERO_TOPLEFT;
+    if (ctx->params._flags & NVG_SDF_TEXT) fontParams.flags |= FONS_SDF_GLYPHS;
     fontParams.renderCreate = NULL;
     fontParams.renderUpdate = NULL;
     fontParams.renderDraw = NULL;
@@ -289,15 +951,22 @@ static void _initialize(NVGcontext* ctx) {
     if (ctx->fs == NULL) {
         return;
     }
+    if (ctx->maxFontPages == 0) {
+        ctx->maxFontPages = NVG_FONTATLAS_DEFAULT_BUDGET /
+                            (NVG_FONTPAGE_SIZE * NVG_FONTPAGE_SIZE);
+    }
+    fonsSetMaxPages(ctx->fs, ctx->maxFontPages);
+    // Without scratch memory for every worker fontstash does not defer, and
+    // the glyphs are rasterized when they are added.
+    if (ctx->params._flags & NVG_ASYNC_GLYPHS) {
+        fonsDeferGlyphs(ctx->fs,
+                        ctx->tessPool != NULL ? ctx->tessPool->nworkers : 1);
+    }
 
     // Create font texture
     ctx->fontImages[0] = ctx->params.renderCreateTexture(
-        &ctx->params, NVG_TEXTURE_ALPHA, fontParams.width, fontParams.height, 0,
-        NULL);
-    if (ctx->fontImages[0] == 0) {
-        return;
-    }
-    ctx->fontImageIdx = 0;
+        &ctx->params, NVG_TEXTURE_ALPHA, fontParams.width, fontParams.height,
+        nvg__fontImageFlags(ctx), NULL);
 }
 
 NVGcontext* nvgCreate(int flags) {
@@ -310,14 +979,39 @@ NVGcontext* nvgCreate(int flags) {
 
     for (int i = 0; i < NVG_MAX_FONTIMAGES; i++) ctx->fontImages[i] = 0;
 
-    ctx->commands = (float*)malloc(sizeof(float) * NVG_INIT_COMMANDS_SIZE);
-    if (!ctx->commands) goto error;
+    nvg__defaultAllocator(ctx);
+    ctx->params.setAllocator(&ctx->allocator);
+
+    // Allocated from the frame memory on first use.
+    ctx->commands = NULL;
     ctx->ncommands = 0;
     ctx->ccommands = NVG_INIT_COMMANDS_SIZE;
+    ctx->commandPts = NULL;
+    ctx->ncommandPts = 0;
+    ctx->ccommandPts = NVG_INIT_COMMAND_POINTS_SIZE;
 
     ctx->cache = nvg__allocPathCache();
     if (ctx->cache == NULL) goto error;
 
+    if (flags & NVG_GEOMETRY_CACHE) {
+        ctx->geomCache = nvg__allocGeomCache();
+        if (ctx->geomCache == NULL) goto error;
+    }
+
+    if (flags & NVG_TEXT_CACHE) {
+        ctx->textCache = nvg__allocTextCache();
+        if (ctx->textCache == NULL) goto error;
+    }
+
+    // With a single hardware thread deferring would only add copies.
+    ctx->ctessJobs = NVG_INIT_TESS_JOBS_SIZE;
+    ctx->glyphBudget = NVG_GLYPH_DEFAULT_BUDGET;
+    if ((flags & (NVG_DEFERRED_TESSELLATION | NVG_ASYNC_GLYPHS)) &&
+        std::thread::hardware_concurrency() > 1) {
+        ctx->tessPool = nvg__allocTessPool(ctx);
+        if (ctx->tessPool == NULL) goto error;
+    }
+
     nvgSave(ctx);
     nvgReset(ctx);
 
@@ -332,79 +1026,151 @@ error:
 
 NVGparams* nvgParams(NVGcontext* ctx) { return &ctx->params; }
 
+NVGcontext* nvgCreateRecorder(NVGcontext* ctx) {
+    NVGcontext* rec;
+    int flags = ctx->params._flags & ~NVG_DEFERRED_TESSELLATION;
+
+    // The fonts are shared, so they must exist before the first frame of
+    // either context.
+    _initialize(ctx);
+    if (ctx->fontMutex == NULL) {
+        ctx->fontMutex = new std::recursive_mutex;
+    }
+
+    rec = new NVGcontext;
+    rec->params.userPtr = ctx->params.userPtr;
+    rec->params.edgeAntiAlias = ctx->params.edgeAntiAlias;
+    rec->params.renderCreateTexture = ctx->params.renderCreateTexture;
+    rec->params.renderDeleteTexture = ctx->params.renderDeleteTexture;
+    rec->params.renderUpdateTexture = ctx->params.renderUpdateTexture;
+    rec->params.renderGetTexture = ctx->params.renderGetTexture;
+    rec->params.renderUniformSize = ctx->params.renderUniformSize;
+    rec->params._flags = flags;
+
+    rec->isInit = true;
+    rec->fs = ctx->fs;
+    rec->fontOwner = ctx;
+    rec->fontMutex = ctx->fontMutex;
+
+    nvg__defaultAllocator(rec);
+    rec->params.setAllocator(&rec->allocator);
+
+    rec->ccommands = NVG_INIT_COMMANDS_SIZE;
+    rec->ccommandPts = NVG_INIT_COMMAND_POINTS_SIZE;
+
+    rec->cache = nvg__allocPathCache();
+    if (rec->cache == NULL) goto error;
+
+    if (flags & NVG_GEOMETRY_CACHE) {
+        rec->geomCache = nvg__allocGeomCache();
+        if (rec->geomCache == NULL) goto error;
+    }
+
+    if (flags & NVG_TEXT_CACHE) {
+        rec->textCache = nvg__allocTextCache();
+        if (rec->textCache == NULL) goto error;
+    }
+
+    nvgSave(rec);
+    nvgReset(rec);
+
+    nvg__setDevicePixelRatio(rec, 1.0f);
+
+    return rec;
+
+error:
+    nvgDelete(rec);
+    return 0;
+}
+
 void nvgDelete(NVGcontext* ctx) {
     if (!ctx) return;
-    if (ctx->commands != NULL) free(ctx->commands);
+    nvg__deleteTessPool(ctx->tessPool);
+    nvg__resetFrameMemory(ctx);
+    nvg__arenaFreeBlocks(&ctx->arena);
     if (ctx->cache != NULL) nvg__deletePathCache(ctx->cache);
-
-    if (ctx->fs) fonsDeleteInternal(ctx->fs);
-
-    for (int i = 0; i < NVG_MAX_FONTIMAGES; i++) {
-        if (ctx->fontImages[i] != 0) {
-            nvgDeleteImage(ctx, ctx->fontImages[i]);
-            ctx->fontImages[i] = 0;
+    if (ctx->geomCache != NULL) nvg__deleteGeomCache(ctx->geomCache);
+    if (ctx->textCache != NULL) nvg__deleteTextCache(ctx->textCache);
+    free(ctx->levels);
+    free(ctx->stateUndo);
+
+    // The fonts of a recorder belong to its owner.
+    if (ctx->fontOwner == NULL) {
+        if (ctx->fs) fonsDeleteInternal(ctx->fs);
+
+        for (int i = 0; i < NVG_MAX_FONTIMAGES; i++) {
+            if (ctx->fontImages[i] != 0) {
+                nvgDeleteImage(ctx, ctx->fontImages[i]);
+                ctx->fontImages[i] = 0;
+            }
         }
+        delete ctx->fontMutex;
     }
 
-    free(ctx);
+    delete ctx;
 }
 
 void nvgBeginFrame(NVGcontext* ctx, float windowWidth, float windowHeight,
                    float devicePixelRatio) {
     _initialize(ctx);
-    nvgParams(ctx)->clear();
+    nvg__resetFrameMemory(ctx);
 
     /*	printf("Tris: draws:%d  fill:%d  stroke:%d  text:%d  TOT:%d\n",
                     ctx->drawCallCount, ctx->fillTriCount, ctx->strokeTriCount,
        ctx->textTriCount,
                     ctx->fillTriCount+ctx->strokeTriCount+ctx->textTriCount);*/
 
-    ctx->nstates = 0;
+    ctx->nlevels = 0;
+    ctx->nstateUndo = 0;
     nvgSave(ctx);
     nvgReset(ctx);
 
     nvg__setDevicePixelRatio(ctx, devicePixelRatio);
 
-    ctx->params.setViewSize(windowWidth, windowHeight);
+    ctx->params.setViewSize(windowWidth, windowHeight, devicePixelRatio);
+    ctx->viewWidth = windowWidth;
+    ctx->viewHeight = windowHeight;
 
     ctx->drawCallCount = 0;
     ctx->fillTriCount = 0;
     ctx->strokeTriCount = 0;
     ctx->textTriCount = 0;
+    ctx->culledFillCount = 0;
+    ctx->culledStrokeCount = 0;
+    ctx->culledInstanceCount = 0;
+
+    // Atlas pages drawn from in the previous frame may be evicted again.
+    if (ctx->fontOwner == NULL && ctx->fs != NULL) {
+        NVGfontLock lock(ctx);
+        fonsBeginFrame(ctx->fs);
+    }
+}
+
+void nvgFrameStats(NVGcontext* ctx, NVGframeStats* stats) {
+    if (stats == NULL) return;
+    stats->drawCalls = ctx->drawCallCount;
+    stats->fillTriangles = ctx->fillTriCount;
+    stats->strokeTriangles = ctx->strokeTriCount;
+    stats->textTriangles = ctx->textTriCount;
+    stats->culledFills = ctx->culledFillCount;
+    stats->culledStrokes = ctx->culledStrokeCount;
+    stats->culledInstances = ctx->culledInstanceCount;
 }
 
-void nvgCancelFrame(NVGcontext* ctx) { ctx->params.clear(); }
-
-// void nvgEndFrame(NVGcontext* ctx)
-// {
-// 	ctx->params.renderFlush(&ctx->params);
-// 	if (ctx->fontImageIdx != 0) {
-// 		int fontImage = ctx->fontImages[ctx->fontImageIdx];
-// 		int i, j, iw, ih;
-// 		// delete images that smaller than current one
-// 		if (fontImage == 0)
-// 			return;
-// 		nvgImageSize(ctx, fontImage, &iw, &ih);
-// 		for (i = j = 0; i < ctx->fontImageIdx; i++) {
-// 			if (ctx->fontImages[i] != 0) {
-// 				int nw, nh;
-// 				nvgImageSize(ctx, ctx->fontImages[i], &nw, &nh);
-// 				if (nw < iw || nh < ih)
-// 					nvgDeleteImage(ctx, ctx->fontImages[i]);
-// 				else
-// 					ctx->fontImages[j++] =
-// ctx->fontImages[i];
-// 			}
-// 		}
-// 		// make current font image to first
-// 		ctx->fontImages[j++] = ctx->fontImages[0];
-// 		ctx->fontImages[0] = fontImage;
-// 		ctx->fontImageIdx = 0;
-// 		// clear all images after j
-// 		for (i = j; i < NVG_MAX_FONTIMAGES; i++)
-// 			ctx->fontImages[i] = 0;
-// 	}
-// }
+void nvgCancelFrame(NVGcontext* ctx) { nvg__resetFrameMemory(ctx); }
+
+void nvgFrameAllocator(NVGcontext* ctx, const NVGallocator* allocator) {
+    nvg__resetFrameMemory(ctx);
+    if (allocator != NULL)
+        ctx->allocator = *allocator;
+    else
+        nvg__defaultAllocator(ctx);
+}
+
+size_t nvgFrameMemoryHighWater(NVGcontext* ctx) {
+    size_t used = ctx->arena.used;
+    return used > ctx->arena.highWater ? used : ctx->arena.highWater;
+}
 
 NVGcolor nvgRGB(unsigned char r, unsigned char g, unsigned char b) {
     return nvgRGBA(r, g, b, 255);
@@ -596,22 +1362,56 @@ static void nvg__setPaintColor(NVGpaint* p, NVGcolor color) {
     p->outerColor = color;
 }
 
+// Computes the inverse of a paint transform unless it is cached.
+static void nvg__cachePaint(NVGinverse* inv, const float* t) {
+    if (inv->valid) return;
+    nvgTransformInverse(inv->xform, t);
+    inv->valid = 1;
+}
+
+static void nvg__cacheScissor(NVGinverse* inv, const float* t) {
+    if (inv->valid) return;
+    nvgTransformInverse(inv->xform, t);
+    inv->scale[0] = sqrtf(t[0] * t[0] + t[2] * t[2]);
+    inv->scale[1] = sqrtf(t[1] * t[1] + t[3] * t[3]);
+    inv->valid = 1;
+}
+
 // State handling
 void nvgSave(NVGcontext* ctx) {
-    if (ctx->nstates >= NVG_MAX_STATES) return;
-    if (ctx->nstates > 0)
-        memcpy(&ctx->states[ctx->nstates], &ctx->states[ctx->nstates - 1],
-               sizeof(NVGstate));
-    ctx->nstates++;
+    NVGsaveLevel* level;
+    if (ctx->nlevels + 1 > ctx->clevels) {
+        int clevels = nvg__maxi(ctx->clevels * 2, NVG_INIT_SAVE_LEVELS);
+        NVGsaveLevel* levels = (NVGsaveLevel*)realloc(
+            ctx->levels, sizeof(NVGsaveLevel) * clevels);
+        if (levels == NULL) return;
+        ctx->levels = levels;
+        ctx->clevels = clevels;
+    }
+    level = &ctx->levels[ctx->nlevels++];
+    level->changed = 0;
+    level->undoOffset = ctx->nstateUndo;
 }
 
 void nvgRestore(NVGcontext* ctx) {
-    if (ctx->nstates <= 1) return;
-    ctx->nstates--;
+    NVGsaveLevel* level;
+    int i;
+    if (ctx->nlevels <= 1) return;
+    level = &ctx->levels[--ctx->nlevels];
+    for (i = level->undoOffset; i < ctx->nstateUndo;) {
+        size_t offset, size;
+        int block;
+        memcpy(&block, &ctx->stateUndo[i], sizeof(int));
+        nvg__stateBlock(block, &offset, &size);
+        nvg__copyStateBlock(block, (unsigned char*)&ctx->state + offset,
+                            &ctx->stateUndo[i + 16]);
+        i += (int)(16 + ((size + 15) & ~15));
+    }
+    ctx->nstateUndo = level->undoOffset;
 }
 
 void nvgReset(NVGcontext* ctx) {
-    NVGstate* state = nvg__getState(ctx);
+    NVGstate* state = nvg__writeState(ctx, NVG_STATE_ALL);
     memset(state, 0, sizeof(*state));
 
     nvg__setPaintColor(&state->fill, nvgRGBA(255, 255, 255, 255));
@@ -638,77 +1438,77 @@ void nvgReset(NVGcontext* ctx) {
 
 // State setting
 void nvgShapeAntiAlias(NVGcontext* ctx, int enabled) {
-    NVGstate* state = nvg__getState(ctx);
+    NVGstate* state = nvg__writeState(ctx, NVG_STATE_PAINT);
     state->shapeAntiAlias = enabled;
 }
 
 void nvgStrokeWidth(NVGcontext* ctx, float width) {
-    NVGstate* state = nvg__getState(ctx);
+    NVGstate* state = nvg__writeState(ctx, NVG_STATE_PAINT);
     state->strokeWidth = width;
 }
 
 void nvgMiterLimit(NVGcontext* ctx, float limit) {
-    NVGstate* state = nvg__getState(ctx);
+    NVGstate* state = nvg__writeState(ctx, NVG_STATE_PAINT);
     state->miterLimit = limit;
 }
 
 void nvgLineCap(NVGcontext* ctx, int cap) {
-    NVGstate* state = nvg__getState(ctx);
+    NVGstate* state = nvg__writeState(ctx, NVG_STATE_PAINT);
     state->lineCap = cap;
 }
 
 void nvgLineJoin(NVGcontext* ctx, int join) {
-    NVGstate* state = nvg__getState(ctx);
+    NVGstate* state = nvg__writeState(ctx, NVG_STATE_PAINT);
     state->lineJoin = join;
 }
 
 void nvgGlobalAlpha(NVGcontext* ctx, float alpha) {
-    NVGstate* state = nvg__getState(ctx);
+    NVGstate* state = nvg__writeState(ctx, NVG_STATE_PAINT);
     state->alpha = alpha;
 }
 
 void nvgTransform(NVGcontext* ctx, float a, float b, float c, float d, float e,
                   float f) {
-    NVGstate* state = nvg__getState(ctx);
+    NVGstate* state = nvg__writeState(ctx, NVG_STATE_XFORM);
     float t[6] = {a, b, c, d, e, f};
     nvgTransformPremultiply(state->xform, t);
 }
 
 void nvgResetTransform(NVGcontext* ctx) {
-    NVGstate* state = nvg__getState(ctx);
+    NVGstate* state = nvg__writeState(ctx, NVG_STATE_XFORM);
     nvgTransformIdentity(state->xform);
 }
 
 void nvgTranslate(NVGcontext* ctx, float x, float y) {
-    NVGstate* state = nvg__getState(ctx);
+    NVGstate* state = nvg__writeState(ctx, NVG_STATE_XFORM);
     float t[6];
     nvgTransformTranslate(t, x, y);
     nvgTransformPremultiply(state->xform, t);
 }
 
 void nvgRotate(NVGcontext* ctx, float angle) {
-    NVGstate* state = nvg__getState(ctx);
+    NVGstate* state = nvg__writeState(ctx, NVG_STATE_XFORM);
     float t[6];
     nvgTransformRotate(t, angle);
     nvgTransformPremultiply(state->xform, t);
 }
 
 void nvgSkewX(NVGcontext* ctx, float angle) {
-    NVGstate* state = nvg__getState(ctx);
+    NVGstate* state = nvg__writeState(ctx, NVG_STATE_XFORM);
     float t[6];
     nvgTransformSkewX(t, angle);
     nvgTransformPremultiply(state->xform, t);
 }
 
 void nvgSkewY(NVGcontext* ctx, float angle) {
-    NVGstate* state = nvg__getState(ctx);
+    NVGstate* state = nvg__writeState(ctx, NVG_STATE_XFORM);
     float t[6];
     nvgTransformSkewY(t, angle);
     nvgTransformPremultiply(state->xform, t);
 }
 
 void nvgScale(NVGcontext* ctx, float x, float y) {
-    NVGstate* state = nvg__getState(ctx);
+    NVGstate* state = nvg__writeState(ctx, NVG_STATE_XFORM);
     float t[6];
     nvgTransformScale(t, x, y);
     nvgTransformPremultiply(state->xform, t);
@@ -721,25 +1521,29 @@ void nvgCurrentTransform(NVGcontext* ctx, float* xform) {
 }
 
 void nvgStrokeColor(NVGcontext* ctx, NVGcolor color) {
-    NVGstate* state = nvg__getState(ctx);
+    NVGstate* state = nvg__writeState(ctx, NVG_STATE_PAINT);
     nvg__setPaintColor(&state->stroke, color);
+    state->strokeInverse.valid = 0;
 }
 
 void nvgStrokePaint(NVGcontext* ctx, NVGpaint paint) {
-    NVGstate* state = nvg__getState(ctx);
+    NVGstate* state = nvg__writeState(ctx, NVG_STATE_PAINT);
     state->stroke = paint;
     nvgTransformMultiply(state->stroke.xform, state->xform);
+    state->strokeInverse.valid = 0;
 }
 
 void nvgFillColor(NVGcontext* ctx, NVGcolor color) {
-    NVGstate* state = nvg__getState(ctx);
+    NVGstate* state = nvg__writeState(ctx, NVG_STATE_PAINT);
     nvg__setPaintColor(&state->fill, color);
+    state->fillInverse.valid = 0;
 }
 
 void nvgFillPaint(NVGcontext* ctx, NVGpaint paint) {
-    NVGstate* state = nvg__getState(ctx);
+    NVGstate* state = nvg__writeState(ctx, NVG_STATE_PAINT);
     state->fill = paint;
     nvgTransformMultiply(state->fill.xform, state->xform);
+    state->fillInverse.valid = 0;
 }
 
 #ifndef NVG_NO_STB
@@ -907,7 +1711,7 @@ NVGpaint nvgImagePattern(NVGcontext* ctx, float cx, float cy, float w, float h,
 
 // Scissoring
 void nvgScissor(NVGcontext* ctx, float x, float y, float w, float h) {
-    NVGstate* state = nvg__getState(ctx);
+    NVGstate* state = nvg__writeState(ctx, NVG_STATE_SCISSOR);
 
     w = nvg__maxf(0.0f, w);
     h = nvg__maxf(0.0f, h);
@@ -919,6 +1723,7 @@ void nvgScissor(NVGcontext* ctx, float x, float y, float w, float h) {
 
     state->scissor.extent[0] = w * 0.5f;
     state->scissor.extent[1] = h * 0.5f;
+    state->scissorInverse.valid = 0;
 }
 
 static void nvg__isectRects(float* dst, float ax, float ay, float aw, float ah,
@@ -963,15 +1768,16 @@ void nvgIntersectScissor(NVGcontext* ctx, float x, float y, float w, float h) {
 }
 
 void nvgResetScissor(NVGcontext* ctx) {
-    NVGstate* state = nvg__getState(ctx);
+    NVGstate* state = nvg__writeState(ctx, NVG_STATE_SCISSOR);
     memset(state->scissor.xform, 0, sizeof(state->scissor.xform));
     state->scissor.extent[0] = -1.0f;
     state->scissor.extent[1] = -1.0f;
+    state->scissorInverse.valid = 0;
 }
 
 // Global composite operation.
 void nvgGlobalCompositeOperation(NVGcontext* ctx, int op) {
-    NVGstate* state = nvg__getState(ctx);
+    NVGstate* state = nvg__writeState(ctx, NVG_STATE_PAINT);
     state->compositeOperation =
         nvg__compositeOperationState(static_cast<NVGcompositeOperation>(op));
 }
@@ -990,7 +1796,7 @@ void nvgGlobalCompositeBlendFuncSeparate(NVGcontext* ctx, int srcRGB,
     op.srcAlpha = static_cast<NVGblendFactor>(srcAlpha);
     op.dstAlpha = static_cast<NVGblendFactor>(dstAlpha);
 
-    NVGstate* state = nvg__getState(ctx);
+    NVGstate* state = nvg__writeState(ctx, NVG_STATE_PAINT);
     state->compositeOperation = op;
 }
 
@@ -1019,62 +1825,149 @@ static float nvg__distPtSeg(float x, float y, float px, float py, float qx,
     return dx * dx + dy * dy;
 }
 
-static void nvg__appendCommands(NVGcontext* ctx, float* vals, int nvals) {
-    NVGstate* state = nvg__getState(ctx);
-    int i;
+// Transforms n points stored as x,y pairs from src to dst.
+static void nvg__transformPoints(float* dst, const float* src, int n,
+                                 const float* t) {
+    int i = 0;
+
+    if (t[0] == 1.0f && t[1] == 0.0f && t[2] == 0.0f && t[3] == 1.0f &&
+        t[4] == 0.0f && t[5] == 0.0f) {
+        if (n > 0 && dst != src) memcpy(dst, src, sizeof(float) * 2 * n);
+        return;
+    }
+
+#if defined(NVG_SSE2)
+    {
+        // Two points per iteration.
+        __m128 m0 = _mm_setr_ps(t[0], t[1], t[0], t[1]);
+        __m128 m1 = _mm_setr_ps(t[2], t[3], t[2], t[3]);
+        __m128 m2 = _mm_setr_ps(t[4], t[5], t[4], t[5]);
+        for (; i + 2 <= n; i += 2) {
+            __m128 p = _mm_loadu_ps(&src[i * 2]);
+            __m128 x = _mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 2, 0, 0));
+            __m128 y = _mm_shuffle_ps(p, p, _MM_SHUFFLE(3, 3, 1, 1));
+            __m128 r = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(x, m0), _mm_mul_ps(y, m1)), m2);
+            _mm_storeu_ps(&dst[i * 2], r);
+        }
+    }
+#elif defined(NVG_NEON)
+    {
+        // Four points per iteration, deinterleaved on load.
+        for (; i + 4 <= n; i += 4) {
+            float32x4x2_t p = vld2q_f32(&src[i * 2]);
+            float32x4x2_t r;
+            r.val[0] = vaddq_f32(vaddq_f32(vmulq_n_f32(p.val[0], t[0]),
+                                           vmulq_n_f32(p.val[1], t[2])),
+                                 vdupq_n_f32(t[4]));
+            r.val[1] = vaddq_f32(vaddq_f32(vmulq_n_f32(p.val[0], t[1]),
+                                           vmulq_n_f32(p.val[1], t[3])),
+                                 vdupq_n_f32(t[5]));
+            vst2q_f32(&dst[i * 2], r);
+        }
+    }
+#endif
+
+    for (; i < n; i++) {
+        float sx = src[i * 2], sy = src[i * 2 + 1];
+        dst[i * 2] = sx * t[0] + sy * t[2] + t[4];
+        dst[i * 2 + 1] = sx * t[1] + sy * t[3] + t[5];
+    }
+}
 
-    if (ctx->ncommands + nvals > ctx->ccommands) {
-        float* commands;
-        int ccommands = ctx->ncommands + nvals + ctx->ccommands / 2;
-        commands = (float*)realloc(ctx->commands, sizeof(float) * ccommands);
-        if (commands == NULL) return;
+// Grows bounds to contain n points stored as x,y pairs.
+static void nvg__addBounds(float* bounds, const float* pts, int n) {
+    float minx = bounds[0], miny = bounds[1];
+    float maxx = bounds[2], maxy = bounds[3];
+    int i;
+    for (i = 0; i < n; i++) {
+        minx = nvg__minf(minx, pts[i * 2]);
+        miny = nvg__minf(miny, pts[i * 2 + 1]);
+        maxx = nvg__maxf(maxx, pts[i * 2]);
+        maxy = nvg__maxf(maxy, pts[i * 2 + 1]);
+    }
+    bounds[0] = minx;
+    bounds[1] = miny;
+    bounds[2] = maxx;
+    bounds[3] = maxy;
+}
+
+// Makes sure there is room for ncmds more commands and npts more points.
+static int nvg__reserveCommands(NVGcontext* ctx, int ncmds, int npts) {
+    if (ctx->commands == NULL || ctx->ncommands + ncmds > ctx->ccommands) {
+        unsigned char* commands = (unsigned char*)nvg__frameGrow(
+            &ctx->allocator, ctx->commands, &ctx->ccommands,
+            ctx->ncommands + ncmds, 0, sizeof(unsigned char));
+        if (commands == NULL) return 0;
         ctx->commands = commands;
-        ctx->ccommands = ccommands;
     }
+    if (npts > 0 && (ctx->commandPts == NULL ||
+                     ctx->ncommandPts + npts > ctx->ccommandPts)) {
+        float* commandPts = (float*)nvg__frameGrow(
+            &ctx->allocator, ctx->commandPts, &ctx->ccommandPts,
+            ctx->ncommandPts + npts, 0, sizeof(float) * 2);
+        if (commandPts == NULL) return 0;
+        ctx->commandPts = commandPts;
+    }
+    return 1;
+}
+
+// Appends commands and their points. pts holds npts x,y pairs, which are
+// transformed by the current transform.
+static void nvg__appendCommands(NVGcontext* ctx, const unsigned char* cmds,
+                                int ncmds, const float* pts, int npts) {
+    NVGstate* state = nvg__getState(ctx);
+
+    if (!nvg__reserveCommands(ctx, ncmds, npts)) return;
 
-    if ((int)vals[0] != NVG_CLOSE && (int)vals[0] != NVG_WINDING) {
-        ctx->commandx = vals[nvals - 2];
-        ctx->commandy = vals[nvals - 1];
+    ctx->commandsHashValid = 0;
+
+    if (npts > 0) {
+        ctx->commandx = pts[npts * 2 - 2];
+        ctx->commandy = pts[npts * 2 - 1];
     }
 
-    // transform commands
-    i = 0;
-    while (i < nvals) {
-        int cmd = (int)vals[i];
-        switch (cmd) {
-            case NVG_MOVETO:
-                nvgTransformPoint(&vals[i + 1], &vals[i + 2], state->xform,
-                                  vals[i + 1], vals[i + 2]);
-                i += 3;
-                break;
-            case NVG_LINETO:
-                nvgTransformPoint(&vals[i + 1], &vals[i + 2], state->xform,
-                                  vals[i + 1], vals[i + 2]);
-                i += 3;
-                break;
-            case NVG_BEZIERTO:
-                nvgTransformPoint(&vals[i + 1], &vals[i + 2], state->xform,
-                                  vals[i + 1], vals[i + 2]);
-                nvgTransformPoint(&vals[i + 3], &vals[i + 4], state->xform,
-                                  vals[i + 3], vals[i + 4]);
-                nvgTransformPoint(&vals[i + 5], &vals[i + 6], state->xform,
-                                  vals[i + 5], vals[i + 6]);
-                i += 7;
-                break;
-            case NVG_CLOSE:
-                i++;
-                break;
-            case NVG_WINDING:
-                i += 2;
-                break;
-            default:
-                i++;
-        }
+    memcpy(&ctx->commands[ctx->ncommands], cmds, ncmds);
+    ctx->ncommands += ncmds;
+
+    if (npts > 0) {
+        float* dst = &ctx->commandPts[ctx->ncommandPts * 2];
+        nvg__transformPoints(dst, pts, npts, state->xform);
+        // Bezier curves stay within their control points, so these bounds
+        // contain the path.
+        nvg__addBounds(ctx->commandBounds, dst, npts);
+        ctx->ncommandPts += npts;
     }
+}
 
-    memcpy(&ctx->commands[ctx->ncommands], vals, nvals * sizeof(float));
+// Reduces each run of points which fall in the same device pixel column to
+// the first, lowest, highest and last point of the run, keeping their order.
+// Works in place and returns the new number of points.
+static int nvg__decimateColumns(float* pts, int n, float scale) {
+    int i = 0, j, k, nout = 0;
 
-    ctx->ncommands += nvals;
+    while (i < n) {
+        float col = floorf(pts[i * 2] * scale);
+        int lo = i, hi = i, idx[4];
+        for (j = i + 1; j < n && floorf(pts[j * 2] * scale) == col; j++) {
+            if (pts[j * 2 + 1] < pts[lo * 2 + 1]) lo = j;
+            if (pts[j * 2 + 1] > pts[hi * 2 + 1]) hi = j;
+        }
+        idx[0] = i;
+        idx[1] = nvg__mini(lo, hi);
+        idx[2] = nvg__maxi(lo, hi);
+        idx[3] = j - 1;
+        // The indices are ascending and never behind nout, so the copy
+        // does not clobber points which are still to be read.
+        for (k = 0; k < 4; k++) {
+            if (k > 0 && idx[k] == idx[k - 1]) continue;
+            pts[nout * 2] = pts[idx[k] * 2];
+            pts[nout * 2 + 1] = pts[idx[k] * 2 + 1];
+            nout++;
+        }
+        i = j;
+    }
+    return nout;
 }
 
 static void nvg__clearPathCache(NVGcontext* ctx) {
@@ -1090,13 +1983,13 @@ static NVGpath* nvg__lastPath(NVGcontext* ctx) {
 
 static void nvg__addPath(NVGcontext* ctx) {
     NVGpath* path;
-    if (ctx->cache->npaths + 1 > ctx->cache->cpaths) {
-        NVGpath* paths;
-        int cpaths = ctx->cache->npaths + 1 + ctx->cache->cpaths / 2;
-        paths = (NVGpath*)realloc(ctx->cache->paths, sizeof(NVGpath) * cpaths);
+    if (ctx->cache->paths == NULL ||
+        ctx->cache->npaths + 1 > ctx->cache->cpaths) {
+        NVGpath* paths = (NVGpath*)nvg__frameGrow(
+            &ctx->allocator, ctx->cache->paths, &ctx->cache->cpaths,
+            ctx->cache->npaths + 1, 0, sizeof(NVGpath));
         if (paths == NULL) return;
         ctx->cache->paths = paths;
-        ctx->cache->cpaths = cpaths;
     }
     path = &ctx->cache->paths[ctx->cache->npaths];
     memset(path, 0, sizeof(*path));
@@ -1106,45 +1999,96 @@ static void nvg__addPath(NVGcontext* ctx) {
     ctx->cache->npaths++;
 }
 
-static NVGpoint* nvg__lastPoint(NVGcontext* ctx) {
-    if (ctx->cache->npoints > 0)
-        return &ctx->cache->points[ctx->cache->npoints - 1];
-    return NULL;
+// Makes sure there is room for n more points. All the point arrays live in
+// one block of frame memory.
+static int nvg__reservePoints(NVGcontext* ctx, int n) {
+    NVGpathCache* c = ctx->cache;
+    float* fields[7] = {c->px, c->py, c->dx, c->dy, c->len, c->dmx, c->dmy};
+    unsigned char* mem;
+    float* dst;
+    int i, cpoints;
+
+    if (c->px != NULL && c->npoints + n <= c->cpoints) return 1;
+
+    if (c->px == NULL)
+        cpoints = nvg__maxi(c->npoints + n, c->cpoints);
+    else
+        cpoints = c->npoints + n + c->cpoints / 2;
+    cpoints = (cpoints + 3) & ~3;  // Keep the arrays 16 byte aligned.
+    mem = (unsigned char*)ctx->allocator.reallocate(
+        ctx->allocator.userPtr, NULL, 0, (sizeof(float) * 7 + 1) * cpoints);
+    if (mem == NULL) return 0;
+
+    dst = (float*)mem;
+    for (i = 0; i < 7; i++) {
+        if (c->px != NULL) memcpy(dst, fields[i], sizeof(float) * c->npoints);
+        fields[i] = dst;
+        dst += cpoints;
+    }
+    if (c->px != NULL) memcpy(dst, c->flags, c->npoints);
+    c->flags = (unsigned char*)dst;
+    c->px = fields[0];
+    c->py = fields[1];
+    c->dx = fields[2];
+    c->dy = fields[3];
+    c->len = fields[4];
+    c->dmx = fields[5];
+    c->dmy = fields[6];
+    c->cpoints = cpoints;
+    return 1;
 }
 
 static void nvg__addPoint(NVGcontext* ctx, float x, float y, int flags) {
+    NVGpathCache* c = ctx->cache;
     NVGpath* path = nvg__lastPath(ctx);
-    NVGpoint* pt;
+    int last = c->npoints - 1;
     if (path == NULL) return;
 
-    if (path->count > 0 && ctx->cache->npoints > 0) {
-        pt = nvg__lastPoint(ctx);
-        if (nvg__ptEquals(pt->x, pt->y, x, y, ctx->distTol)) {
-            pt->flags |= flags;
+    if (path->count > 0 && last >= 0) {
+        if (nvg__ptEquals(c->px[last], c->py[last], x, y, ctx->distTol)) {
+            c->flags[last] |= flags;
             return;
         }
     }
 
-    if (ctx->cache->npoints + 1 > ctx->cache->cpoints) {
-        NVGpoint* points;
-        int cpoints = ctx->cache->npoints + 1 + ctx->cache->cpoints / 2;
-        points =
-            (NVGpoint*)realloc(ctx->cache->points, sizeof(NVGpoint) * cpoints);
-        if (points == NULL) return;
-        ctx->cache->points = points;
-        ctx->cache->cpoints = cpoints;
-    }
+    if (!nvg__reservePoints(ctx, 1)) return;
 
-    pt = &ctx->cache->points[ctx->cache->npoints];
-    memset(pt, 0, sizeof(*pt));
-    pt->x = x;
-    pt->y = y;
-    pt->flags = (unsigned char)flags;
+    c->px[c->npoints] = x;
+    c->py[c->npoints] = y;
+    c->flags[c->npoints] = (unsigned char)flags;
 
-    ctx->cache->npoints++;
+    c->npoints++;
     path->count++;
 }
 
+// Adds n points stored as x,y pairs to the last path, dropping the ones which
+// coincide with the previous point.
+static void nvg__addPoints(NVGcontext* ctx, const float* pts, int n,
+                           int flags) {
+    NVGpathCache* c = ctx->cache;
+    NVGpath* path = nvg__lastPath(ctx);
+    int i, last;
+    if (path == NULL || n <= 0) return;
+
+    if (!nvg__reservePoints(ctx, n)) return;
+
+    last = path->count > 0 ? c->npoints - 1 : -1;
+    for (i = 0; i < n; i++) {
+        float x = pts[i * 2], y = pts[i * 2 + 1];
+        if (last >= 0 &&
+            nvg__ptEquals(c->px[last], c->py[last], x, y, ctx->distTol)) {
+            c->flags[last] |= flags;
+            continue;
+        }
+        last = c->npoints;
+        c->px[last] = x;
+        c->py[last] = y;
+        c->flags[last] = (unsigned char)flags;
+        c->npoints++;
+        path->count++;
+    }
+}
+
 static void nvg__closePath(NVGcontext* ctx) {
     NVGpath* path = nvg__lastPath(ctx);
     if (path == NULL) return;
@@ -1164,21 +2108,33 @@ static float nvg__getAverageScale(float* t) {
 }
 
 static NVGvertex* nvg__allocTempVerts(NVGcontext* ctx, int nverts) {
-    if (nverts > ctx->cache->cverts) {
+    if (ctx->cache->verts == NULL || nverts > ctx->cache->cverts) {
         NVGvertex* verts;
         int cverts =
             (nverts + 0xff) & ~0xff;  // Round up to prevent allocations when
                                       // things change just slightly.
-        verts =
-            (NVGvertex*)realloc(ctx->cache->verts, sizeof(NVGvertex) * cverts);
+        verts = (NVGvertex*)nvg__frameGrow(
+            &ctx->allocator, ctx->cache->verts, &ctx->cache->cverts, cverts,
+            0, sizeof(NVGvertex));
         if (verts == NULL) return NULL;
         ctx->cache->verts = verts;
-        ctx->cache->cverts = cverts;
     }
 
     return ctx->cache->verts;
 }
 
+// Reserves vertices for path expansion directly in the frame vertex buffer,
+// so that the expanded geometry does not need to be copied again when the
+// draw call is recorded.
+static NVGvertex* nvg__allocFrameVerts(NVGcontext* ctx, int nverts) {
+    // A tessellation worker keeps the vertices of each job in its own frame
+    // memory, until they are copied to the range reserved for the job.
+    if (ctx->tessWorker)
+        return (NVGvertex*)ctx->allocator.reallocate(
+            ctx->allocator.userPtr, NULL, 0, sizeof(NVGvertex) * nverts);
+    return ctx->params.reserveVerts(nverts);
+}
+
 static float nvg__triarea2(float ax, float ay, float bx, float by, float cx,
                            float cy) {
     float abx = bx - ax;
@@ -1188,25 +2144,28 @@ static float nvg__triarea2(float ax, float ay, float bx, float by, float cx,
     return acx * aby - abx * acy;
 }
 
-static float nvg__polyArea(NVGpoint* pts, int npts) {
+static float nvg__polyArea(const float* px, const float* py, int npts) {
     int i;
     float area = 0;
     for (i = 2; i < npts; i++) {
-        NVGpoint* a = &pts[0];
-        NVGpoint* b = &pts[i - 1];
-        NVGpoint* c = &pts[i];
-        area += nvg__triarea2(a->x, a->y, b->x, b->y, c->x, c->y);
+        area += nvg__triarea2(px[0], py[0], px[i - 1], py[i - 1], px[i], py[i]);
     }
     return area * 0.5f;
 }
 
-static void nvg__polyReverse(NVGpoint* pts, int npts) {
-    NVGpoint tmp;
-    int i = 0, j = npts - 1;
+// Reverses the positions and flags of npts points starting at first, the
+// other fields are not computed yet.
+static void nvg__polyReverse(NVGpathCache* c, int first, int npts) {
+    int i = first, j = first + npts - 1;
     while (i < j) {
-        tmp = pts[i];
-        pts[i] = pts[j];
-        pts[j] = tmp;
+        float tx = c->px[i], ty = c->py[i];
+        unsigned char tf = c->flags[i];
+        c->px[i] = c->px[j];
+        c->py[i] = c->py[j];
+        c->flags[i] = c->flags[j];
+        c->px[j] = tx;
+        c->py[j] = ty;
+        c->flags[j] = tf;
         i++;
         j--;
     }
@@ -1219,104 +2178,212 @@ static void nvg__vset(NVGvertex* vtx, float x, float y, float u, float v) {
     vtx->v = v;
 }
 
-static void nvg__tesselateBezier(NVGcontext* ctx, float x1, float y1, float x2,
-                                 float y2, float x3, float y3, float x4,
-                                 float y4, int level, int type) {
-    float x12, y12, x23, y23, x34, y34, x123, y123, x234, y234, x1234, y1234;
-    float dx, dy, d2, d3;
-
-    if (level > 10) return;
+// Flattens a cubic bezier into uniform segments. The segment count comes
+// from Wang's formula, which bounds the distance between the curve and its
+// flattening by tessTol, so all the points can be reserved up front and
+// generated with forward differencing.
+static void nvg__flattenBezier(NVGcontext* ctx, float x1, float y1, float x2,
+                               float y2, float x3, float y3, float x4,
+                               float y4, int type) {
+    NVGpathCache* cache = ctx->cache;
+    NVGpath* path = nvg__lastPath(ctx);
+    float dx, dy, d2, d3, ddx0, ddy0, ddx1, ddy1, dd, lx = 0, ly = 0;
+    double h, fx, fy, dfx, dfy, ddfx, ddfy, dddfx, dddfy;
+    double ax, ay, bx, by, cx, cy;
+    int i, n, np, prev;
 
-    x12 = (x1 + x2) * 0.5f;
-    y12 = (y1 + y2) * 0.5f;
-    x23 = (x2 + x3) * 0.5f;
-    y23 = (y2 + y3) * 0.5f;
-    x34 = (x3 + x4) * 0.5f;
-    y34 = (y3 + y4) * 0.5f;
-    x123 = (x12 + x23) * 0.5f;
-    y123 = (y12 + y23) * 0.5f;
+    if (path == NULL) return;
 
+    // Control points on the chord, a straight segment is enough.
     dx = x4 - x1;
     dy = y4 - y1;
-    d2 = nvg__absf(((x2 - x4) * dy - (y2 - y4) * dx));
-    d3 = nvg__absf(((x3 - x4) * dy - (y3 - y4) * dx));
-
+    d2 = nvg__absf((x2 - x4) * dy - (y2 - y4) * dx);
+    d3 = nvg__absf((x3 - x4) * dy - (y3 - y4) * dx);
     if ((d2 + d3) * (d2 + d3) < ctx->tessTol * (dx * dx + dy * dy)) {
         nvg__addPoint(ctx, x4, y4, type);
         return;
     }
 
-    /*	if (nvg__absf(x1+x3-x2-x2) + nvg__absf(y1+y3-y2-y2) +
-       nvg__absf(x2+x4-x3-x3) + nvg__absf(y2+y4-y3-y3) < ctx->tessTol) {
-                    nvg__addPoint(ctx, x4, y4, type);
-                    return;
-            }*/
-
-    x234 = (x23 + x34) * 0.5f;
-    y234 = (y23 + y34) * 0.5f;
-    x1234 = (x123 + x234) * 0.5f;
-    y1234 = (y123 + y234) * 0.5f;
+    ddx0 = x1 - 2.0f * x2 + x3;
+    ddy0 = y1 - 2.0f * y2 + y3;
+    ddx1 = x2 - 2.0f * x3 + x4;
+    ddy1 = y2 - 2.0f * y3 + y4;
+    dd = nvg__sqrtf(nvg__maxf(ddx0 * ddx0 + ddy0 * ddy0,
+                              ddx1 * ddx1 + ddy1 * ddy1));
+    n = (int)ceilf(nvg__sqrtf(dd * 0.75f / ctx->tessTol));
+    n = nvg__clampi(n, 1, NVG_MAX_BEZIER_SEGMENTS);
+
+    if (!nvg__reservePoints(ctx, n)) return;
+    np = cache->npoints;
+
+    // Polynomial coefficients and their forward differences for step h.
+    h = 1.0 / n;
+    ax = -x1 + 3.0 * x2 - 3.0 * x3 + x4;
+    ay = -y1 + 3.0 * y2 - 3.0 * y3 + y4;
+    bx = 3.0 * x1 - 6.0 * x2 + 3.0 * x3;
+    by = 3.0 * y1 - 6.0 * y2 + 3.0 * y3;
+    cx = 3.0 * (x2 - x1);
+    cy = 3.0 * (y2 - y1);
+    fx = x1;
+    fy = y1;
+    dfx = ((ax * h + bx) * h + cx) * h;
+    dfy = ((ay * h + by) * h + cy) * h;
+    ddfx = (6.0 * ax * h + 2.0 * bx) * h * h;
+    ddfy = (6.0 * ay * h + 2.0 * by) * h * h;
+    dddfx = 6.0 * ax * h * h * h;
+    dddfy = 6.0 * ay * h * h * h;
+
+    prev = path->count > 0 && np > 0;
+    if (prev) {
+        lx = cache->px[np - 1];
+        ly = cache->py[np - 1];
+    }
 
-    nvg__tesselateBezier(ctx, x1, y1, x12, y12, x123, y123, x1234, y1234,
-                         level + 1, 0);
-    nvg__tesselateBezier(ctx, x1234, y1234, x234, y234, x34, y34, x4, y4,
-                         level + 1, type);
+    for (i = 1; i <= n; i++) {
+        float x, y;
+        int flags;
+        if (i < n) {
+            fx += dfx;
+            fy += dfy;
+            dfx += ddfx;
+            dfy += ddfy;
+            ddfx += dddfx;
+            ddfy += dddfy;
+            x = (float)fx;
+            y = (float)fy;
+            flags = 0;
+        } else {
+            x = x4;
+            y = y4;
+            flags = type;
+        }
+        if (prev && nvg__ptEquals(lx, ly, x, y, ctx->distTol)) {
+            cache->flags[np - 1] |= (unsigned char)flags;
+            continue;
+        }
+        cache->px[np] = x;
+        cache->py[np] = y;
+        cache->flags[np] = (unsigned char)flags;
+        np++;
+        path->count++;
+        lx = x;
+        ly = y;
+        prev = 1;
+    }
+
+    cache->npoints = np;
+}
+
+// Calculates the direction and length of the segment from every point of a
+// path to the next, and grows bounds to include the points.
+static void nvg__segmentDirections(NVGpathCache* c, int first, int count,
+                                   float* bounds) {
+    float* px = &c->px[first];
+    float* py = &c->py[first];
+    float* dx = &c->dx[first];
+    float* dy = &c->dy[first];
+    float* len = &c->len[first];
+    int i = 0;
+
+#if defined(NVG_SSE2)
+    {
+        // The last segment wraps around to the first point, and is left to
+        // the scalar loop below.
+        __m128 one = _mm_set1_ps(1.0f);
+        __m128 eps = _mm_set1_ps(1e-6f);
+        __m128 minx = _mm_set1_ps(bounds[0]);
+        __m128 miny = _mm_set1_ps(bounds[1]);
+        __m128 maxx = _mm_set1_ps(bounds[2]);
+        __m128 maxy = _mm_set1_ps(bounds[3]);
+        float b[4][4];
+        int k;
+        for (; i + 4 < count; i += 4) {
+            __m128 x0 = _mm_loadu_ps(&px[i]);
+            __m128 y0 = _mm_loadu_ps(&py[i]);
+            __m128 vx = _mm_sub_ps(_mm_loadu_ps(&px[i + 1]), x0);
+            __m128 vy = _mm_sub_ps(_mm_loadu_ps(&py[i + 1]), y0);
+            __m128 d = _mm_sqrt_ps(
+                _mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)));
+            __m128 big = _mm_cmpgt_ps(d, eps);
+            __m128 id = _mm_or_ps(_mm_and_ps(big, _mm_div_ps(one, d)),
+                                  _mm_andnot_ps(big, one));
+            _mm_storeu_ps(&dx[i], _mm_mul_ps(vx, id));
+            _mm_storeu_ps(&dy[i], _mm_mul_ps(vy, id));
+            _mm_storeu_ps(&len[i], d);
+            minx = _mm_min_ps(minx, x0);
+            miny = _mm_min_ps(miny, y0);
+            maxx = _mm_max_ps(maxx, x0);
+            maxy = _mm_max_ps(maxy, y0);
+        }
+        _mm_storeu_ps(b[0], minx);
+        _mm_storeu_ps(b[1], miny);
+        _mm_storeu_ps(b[2], maxx);
+        _mm_storeu_ps(b[3], maxy);
+        for (k = 0; k < 4; k++) {
+            bounds[0] = nvg__minf(bounds[0], b[0][k]);
+            bounds[1] = nvg__minf(bounds[1], b[1][k]);
+            bounds[2] = nvg__maxf(bounds[2], b[2][k]);
+            bounds[3] = nvg__maxf(bounds[3], b[3][k]);
+        }
+    }
+#endif
+
+    for (; i < count; i++) {
+        int next = i + 1 < count ? i + 1 : 0;
+        dx[i] = px[next] - px[i];
+        dy[i] = py[next] - py[i];
+        len[i] = nvg__normalize(&dx[i], &dy[i]);
+        bounds[0] = nvg__minf(bounds[0], px[i]);
+        bounds[1] = nvg__minf(bounds[1], py[i]);
+        bounds[2] = nvg__maxf(bounds[2], px[i]);
+        bounds[3] = nvg__maxf(bounds[3], py[i]);
+    }
 }
 
 static void nvg__flattenPaths(NVGcontext* ctx) {
     NVGpathCache* cache = ctx->cache;
     //	NVGstate* state = nvg__getState(ctx);
-    NVGpoint* last;
-    NVGpoint* p0;
-    NVGpoint* p1;
-    NVGpoint* pts;
     NVGpath* path;
-    int i, j;
-    float* cp1;
-    float* cp2;
-    float* p;
+    int i, j, last;
+    const float* p;
     float area;
 
     if (cache->npaths > 0) return;
 
     // Flatten
-    i = 0;
-    while (i < ctx->ncommands) {
-        int cmd = (int)ctx->commands[i];
-        switch (cmd) {
+    p = ctx->commandPts;
+    for (i = 0; i < ctx->ncommands; i++) {
+        switch (ctx->commands[i]) {
             case NVG_MOVETO:
                 nvg__addPath(ctx);
-                p = &ctx->commands[i + 1];
                 nvg__addPoint(ctx, p[0], p[1], NVG_PT_CORNER);
-                i += 3;
+                p += 2;
                 break;
             case NVG_LINETO:
-                p = &ctx->commands[i + 1];
-                nvg__addPoint(ctx, p[0], p[1], NVG_PT_CORNER);
-                i += 3;
+                // Polylines produce long runs of line segments, add them in
+                // one go.
+                for (j = i + 1;
+                     j < ctx->ncommands && ctx->commands[j] == NVG_LINETO; j++)
+                    ;
+                nvg__addPoints(ctx, p, j - i, NVG_PT_CORNER);
+                p += (j - i) * 2;
+                i = j - 1;
                 break;
             case NVG_BEZIERTO:
-                last = nvg__lastPoint(ctx);
-                if (last != NULL) {
-                    cp1 = &ctx->commands[i + 1];
-                    cp2 = &ctx->commands[i + 3];
-                    p = &ctx->commands[i + 5];
-                    nvg__tesselateBezier(ctx, last->x, last->y, cp1[0], cp1[1],
-                                         cp2[0], cp2[1], p[0], p[1], 0,
-                                         NVG_PT_CORNER);
+                last = cache->npoints - 1;
+                if (last >= 0) {
+                    nvg__flattenBezier(ctx, cache->px[last], cache->py[last],
+                                       p[0], p[1], p[2], p[3], p[4], p[5],
+                                       NVG_PT_CORNER);
                 }
-                i += 7;
+                p += 6;
                 break;
             case NVG_CLOSE:
                 nvg__closePath(ctx);
-                i++;
                 break;
             case NVG_WINDING:
-                nvg__pathWinding(ctx, (int)ctx->commands[i + 1]);
-                i += 2;
+                nvg__pathWinding(ctx, ctx->commands[++i]);
                 break;
-            default:
-                i++;
         }
     }
 
@@ -1325,41 +2392,30 @@ static void nvg__flattenPaths(NVGcontext* ctx) {
 
     // Calculate the direction and length of line segments.
     for (j = 0; j < cache->npaths; j++) {
+        int first;
         path = &cache->paths[j];
-        pts = &cache->points[path->first];
+        first = path->first;
 
         // If the first and last points are the same, remove the last, mark as
         // closed path.
-        p0 = &pts[path->count - 1];
-        p1 = &pts[0];
-        if (nvg__ptEquals(p0->x, p0->y, p1->x, p1->y, ctx->distTol)) {
+        last = first + path->count - 1;
+        if (nvg__ptEquals(cache->px[last], cache->py[last], cache->px[first],
+                          cache->py[first], ctx->distTol)) {
             path->count--;
-            p0 = &pts[path->count - 1];
             path->closed = 1;
         }
 
         // Enforce winding.
         if (path->count > 2) {
-            area = nvg__polyArea(pts, path->count);
+            area = nvg__polyArea(&cache->px[first], &cache->py[first],
+                                 path->count);
             if (path->winding == NVG_CCW && area < 0.0f)
-                nvg__polyReverse(pts, path->count);
+                nvg__polyReverse(cache, first, path->count);
             if (path->winding == NVG_CW && area > 0.0f)
-                nvg__polyReverse(pts, path->count);
+                nvg__polyReverse(cache, first, path->count);
         }
 
-        for (i = 0; i < path->count; i++) {
-            // Calculate segment direction and length
-            p0->dx = p1->x - p0->x;
-            p0->dy = p1->y - p0->y;
-            p0->len = nvg__normalize(&p0->dx, &p0->dy);
-            // Update bounds
-            cache->bounds[0] = nvg__minf(cache->bounds[0], p0->x);
-            cache->bounds[1] = nvg__minf(cache->bounds[1], p0->y);
-            cache->bounds[2] = nvg__maxf(cache->bounds[2], p0->x);
-            cache->bounds[3] = nvg__maxf(cache->bounds[3], p0->y);
-            // Advance
-            p0 = p1++;
-        }
+        nvg__segmentDirections(cache, first, path->count, cache->bounds);
     }
 }
 
@@ -1368,34 +2424,37 @@ static int nvg__curveDivs(float r, float arc, float tol) {
     return nvg__maxi(2, (int)ceilf(arc / da));
 }
 
-static void nvg__chooseBevel(int bevel, NVGpoint* p0, NVGpoint* p1, float w,
-                             float* x0, float* y0, float* x1, float* y1) {
+static void nvg__chooseBevel(int bevel, const NVGpathCache* c, int i0,
+                             int i1, float w, float* x0, float* y0, float* x1,
+                             float* y1) {
     if (bevel) {
-        *x0 = p1->x + p0->dy * w;
-        *y0 = p1->y - p0->dx * w;
-        *x1 = p1->x + p1->dy * w;
-        *y1 = p1->y - p1->dx * w;
+        *x0 = c->px[i1] + c->dy[i0] * w;
+        *y0 = c->py[i1] - c->dx[i0] * w;
+        *x1 = c->px[i1] + c->dy[i1] * w;
+        *y1 = c->py[i1] - c->dx[i1] * w;
     } else {
-        *x0 = p1->x + p1->dmx * w;
-        *y0 = p1->y + p1->dmy * w;
-        *x1 = p1->x + p1->dmx * w;
-        *y1 = p1->y + p1->dmy * w;
+        *x0 = c->px[i1] + c->dmx[i1] * w;
+        *y0 = c->py[i1] + c->dmy[i1] * w;
+        *x1 = c->px[i1] + c->dmx[i1] * w;
+        *y1 = c->py[i1] + c->dmy[i1] * w;
     }
 }
 
-static NVGvertex* nvg__roundJoin(NVGvertex* dst, NVGpoint* p0, NVGpoint* p1,
-                                 float lw, float rw, float lu, float ru,
-                                 int ncap, float fringe) {
+static NVGvertex* nvg__roundJoin(NVGvertex* dst, const NVGpathCache* c,
+                                 int i0, int i1, float lw, float rw, float lu,
+                                 float ru, int ncap, float fringe) {
     int i, n;
-    float dlx0 = p0->dy;
-    float dly0 = -p0->dx;
-    float dlx1 = p1->dy;
-    float dly1 = -p1->dx;
+    float dlx0 = c->dy[i0];
+    float dly0 = -c->dx[i0];
+    float dlx1 = c->dy[i1];
+    float dly1 = -c->dx[i1];
+    float px = c->px[i1], py = c->py[i1];
+    int flags = c->flags[i1];
     NVG_NOTUSED(fringe);
 
-    if (p1->flags & NVG_PT_LEFT) {
+    if (flags & NVG_PT_LEFT) {
         float lx0, ly0, lx1, ly1, a0, a1;
-        nvg__chooseBevel(p1->flags & NVG_PR_INNERBEVEL, p0, p1, lw, &lx0, &ly0,
+        nvg__chooseBevel(flags & NVG_PR_INNERBEVEL, c, i0, i1, lw, &lx0, &ly0,
                          &lx1, &ly1);
         a0 = atan2f(-dly0, -dlx0);
         a1 = atan2f(-dly1, -dlx1);
@@ -1403,16 +2462,16 @@ static NVGvertex* nvg__roundJoin(NVGvertex* dst, NVGpoint* p0, NVGpoint* p1,
 
         nvg__vset(dst, lx0, ly0, lu, 1);
         dst++;
-        nvg__vset(dst, p1->x - dlx0 * rw, p1->y - dly0 * rw, ru, 1);
+        nvg__vset(dst, px - dlx0 * rw, py - dly0 * rw, ru, 1);
         dst++;
 
         n = nvg__clampi((int)ceilf(((a0 - a1) / NVG_PI) * ncap), 2, ncap);
         for (i = 0; i < n; i++) {
             float u = i / (float)(n - 1);
             float a = a0 + u * (a1 - a0);
-            float rx = p1->x + cosf(a) * rw;
-            float ry = p1->y + sinf(a) * rw;
-            nvg__vset(dst, p1->x, p1->y, 0.5f, 1);
+            float rx = px + cosf(a) * rw;
+            float ry = py + sinf(a) * rw;
+            nvg__vset(dst, px, py, 0.5f, 1);
             dst++;
             nvg__vset(dst, rx, ry, ru, 1);
             dst++;
@@ -1420,18 +2479,18 @@ static NVGvertex* nvg__roundJoin(NVGvertex* dst, NVGpoint* p0, NVGpoint* p1,
 
         nvg__vset(dst, lx1, ly1, lu, 1);
         dst++;
-        nvg__vset(dst, p1->x - dlx1 * rw, p1->y - dly1 * rw, ru, 1);
+        nvg__vset(dst, px - dlx1 * rw, py - dly1 * rw, ru, 1);
         dst++;
 
     } else {
         float rx0, ry0, rx1, ry1, a0, a1;
-        nvg__chooseBevel(p1->flags & NVG_PR_INNERBEVEL, p0, p1, -rw, &rx0, &ry0,
+        nvg__chooseBevel(flags & NVG_PR_INNERBEVEL, c, i0, i1, -rw, &rx0, &ry0,
                          &rx1, &ry1);
         a0 = atan2f(dly0, dlx0);
         a1 = atan2f(dly1, dlx1);
         if (a1 < a0) a1 += NVG_PI * 2;
 
-        nvg__vset(dst, p1->x + dlx0 * rw, p1->y + dly0 * rw, lu, 1);
+        nvg__vset(dst, px + dlx0 * rw, py + dly0 * rw, lu, 1);
         dst++;
         nvg__vset(dst, rx0, ry0, ru, 1);
         dst++;
@@ -1440,15 +2499,15 @@ static NVGvertex* nvg__roundJoin(NVGvertex* dst, NVGpoint* p0, NVGpoint* p1,
         for (i = 0; i < n; i++) {
             float u = i / (float)(n - 1);
             float a = a0 + u * (a1 - a0);
-            float lx = p1->x + cosf(a) * lw;
-            float ly = p1->y + sinf(a) * lw;
+            float lx = px + cosf(a) * lw;
+            float ly = py + sinf(a) * lw;
             nvg__vset(dst, lx, ly, lu, 1);
             dst++;
-            nvg__vset(dst, p1->x, p1->y, 0.5f, 1);
+            nvg__vset(dst, px, py, 0.5f, 1);
             dst++;
         }
 
-        nvg__vset(dst, p1->x + dlx1 * rw, p1->y + dly1 * rw, lu, 1);
+        nvg__vset(dst, px + dlx1 * rw, py + dly1 * rw, lu, 1);
         dst++;
         nvg__vset(dst, rx1, ry1, ru, 1);
         dst++;
@@ -1456,43 +2515,46 @@ static NVGvertex* nvg__roundJoin(NVGvertex* dst, NVGpoint* p0, NVGpoint* p1,
     return dst;
 }
 
-static NVGvertex* nvg__bevelJoin(NVGvertex* dst, NVGpoint* p0, NVGpoint* p1,
-                                 float lw, float rw, float lu, float ru,
-                                 float fringe) {
+static NVGvertex* nvg__bevelJoin(NVGvertex* dst, const NVGpathCache* c,
+                                 int i0, int i1, float lw, float rw, float lu,
+                                 float ru, float fringe) {
     float rx0, ry0, rx1, ry1;
     float lx0, ly0, lx1, ly1;
-    float dlx0 = p0->dy;
-    float dly0 = -p0->dx;
-    float dlx1 = p1->dy;
-    float dly1 = -p1->dx;
+    float dlx0 = c->dy[i0];
+    float dly0 = -c->dx[i0];
+    float dlx1 = c->dy[i1];
+    float dly1 = -c->dx[i1];
+    float px = c->px[i1], py = c->py[i1];
+    float dmx = c->dmx[i1], dmy = c->dmy[i1];
+    int flags = c->flags[i1];
     NVG_NOTUSED(fringe);
 
-    if (p1->flags & NVG_PT_LEFT) {
-        nvg__chooseBevel(p1->flags & NVG_PR_INNERBEVEL, p0, p1, lw, &lx0, &ly0,
+    if (flags & NVG_PT_LEFT) {
+        nvg__chooseBevel(flags & NVG_PR_INNERBEVEL, c, i0, i1, lw, &lx0, &ly0,
                          &lx1, &ly1);
 
         nvg__vset(dst, lx0, ly0, lu, 1);
         dst++;
-        nvg__vset(dst, p1->x - dlx0 * rw, p1->y - dly0 * rw, ru, 1);
+        nvg__vset(dst, px - dlx0 * rw, py - dly0 * rw, ru, 1);
         dst++;
 
-        if (p1->flags & NVG_PT_BEVEL) {
+        if (flags & NVG_PT_BEVEL) {
             nvg__vset(dst, lx0, ly0, lu, 1);
             dst++;
-            nvg__vset(dst, p1->x - dlx0 * rw, p1->y - dly0 * rw, ru, 1);
+            nvg__vset(dst, px - dlx0 * rw, py - dly0 * rw, ru, 1);
             dst++;
 
             nvg__vset(dst, lx1, ly1, lu, 1);
             dst++;
-            nvg__vset(dst, p1->x - dlx1 * rw, p1->y - dly1 * rw, ru, 1);
+            nvg__vset(dst, px - dlx1 * rw, py - dly1 * rw, ru, 1);
             dst++;
         } else {
-            rx0 = p1->x - p1->dmx * rw;
-            ry0 = p1->y - p1->dmy * rw;
+            rx0 = px - dmx * rw;
+            ry0 = py - dmy * rw;
 
-            nvg__vset(dst, p1->x, p1->y, 0.5f, 1);
+            nvg__vset(dst, px, py, 0.5f, 1);
             dst++;
-            nvg__vset(dst, p1->x - dlx0 * rw, p1->y - dly0 * rw, ru, 1);
+            nvg__vset(dst, px - dlx0 * rw, py - dly0 * rw, ru, 1);
             dst++;
 
             nvg__vset(dst, rx0, ry0, ru, 1);
@@ -1500,43 +2562,43 @@ static NVGvertex* nvg__bevelJoin(NVGvertex* dst, NVGpoint* p0, NVGpoint* p1,
             nvg__vset(dst, rx0, ry0, ru, 1);
             dst++;
 
-            nvg__vset(dst, p1->x, p1->y, 0.5f, 1);
+            nvg__vset(dst, px, py, 0.5f, 1);
             dst++;
-            nvg__vset(dst, p1->x - dlx1 * rw, p1->y - dly1 * rw, ru, 1);
+            nvg__vset(dst, px - dlx1 * rw, py - dly1 * rw, ru, 1);
             dst++;
         }
 
         nvg__vset(dst, lx1, ly1, lu, 1);
         dst++;
-        nvg__vset(dst, p1->x - dlx1 * rw, p1->y - dly1 * rw, ru, 1);
+        nvg__vset(dst, px - dlx1 * rw, py - dly1 * rw, ru, 1);
         dst++;
 
     } else {
-        nvg__chooseBevel(p1->flags & NVG_PR_INNERBEVEL, p0, p1, -rw, &rx0, &ry0,
+        nvg__chooseBevel(flags & NVG_PR_INNERBEVEL, c, i0, i1, -rw, &rx0, &ry0,
                          &rx1, &ry1);
 
-        nvg__vset(dst, p1->x + dlx0 * lw, p1->y + dly0 * lw, lu, 1);
+        nvg__vset(dst, px + dlx0 * lw, py + dly0 * lw, lu, 1);
         dst++;
         nvg__vset(dst, rx0, ry0, ru, 1);
         dst++;
 
-        if (p1->flags & NVG_PT_BEVEL) {
-            nvg__vset(dst, p1->x + dlx0 * lw, p1->y + dly0 * lw, lu, 1);
+        if (flags & NVG_PT_BEVEL) {
+            nvg__vset(dst, px + dlx0 * lw, py + dly0 * lw, lu, 1);
             dst++;
             nvg__vset(dst, rx0, ry0, ru, 1);
             dst++;
 
-            nvg__vset(dst, p1->x + dlx1 * lw, p1->y + dly1 * lw, lu, 1);
+            nvg__vset(dst, px + dlx1 * lw, py + dly1 * lw, lu, 1);
             dst++;
             nvg__vset(dst, rx1, ry1, ru, 1);
             dst++;
         } else {
-            lx0 = p1->x + p1->dmx * lw;
-            ly0 = p1->y + p1->dmy * lw;
+            lx0 = px + dmx * lw;
+            ly0 = py + dmy * lw;
 
-            nvg__vset(dst, p1->x + dlx0 * lw, p1->y + dly0 * lw, lu, 1);
+            nvg__vset(dst, px + dlx0 * lw, py + dly0 * lw, lu, 1);
             dst++;
-            nvg__vset(dst, p1->x, p1->y, 0.5f, 1);
+            nvg__vset(dst, px, py, 0.5f, 1);
             dst++;
 
             nvg__vset(dst, lx0, ly0, lu, 1);
@@ -1544,13 +2606,13 @@ static NVGvertex* nvg__bevelJoin(NVGvertex* dst, NVGpoint* p0, NVGpoint* p1,
             nvg__vset(dst, lx0, ly0, lu, 1);
             dst++;
 
-            nvg__vset(dst, p1->x + dlx1 * lw, p1->y + dly1 * lw, lu, 1);
+            nvg__vset(dst, px + dlx1 * lw, py + dly1 * lw, lu, 1);
             dst++;
-            nvg__vset(dst, p1->x, p1->y, 0.5f, 1);
+            nvg__vset(dst, px, py, 0.5f, 1);
             dst++;
         }
 
-        nvg__vset(dst, p1->x + dlx1 * lw, p1->y + dly1 * lw, lu, 1);
+        nvg__vset(dst, px + dlx1 * lw, py + dly1 * lw, lu, 1);
         dst++;
         nvg__vset(dst, rx1, ry1, ru, 1);
         dst++;
@@ -1559,11 +2621,11 @@ static NVGvertex* nvg__bevelJoin(NVGvertex* dst, NVGpoint* p0, NVGpoint* p1,
     return dst;
 }
 
-static NVGvertex* nvg__buttCapStart(NVGvertex* dst, NVGpoint* p, float dx,
-                                    float dy, float w, float d, float aa,
-                                    float u0, float u1) {
-    float px = p->x - dx * d;
-    float py = p->y - dy * d;
+static NVGvertex* nvg__buttCapStart(NVGvertex* dst, float x, float y,
+                                    float dx, float dy, float w, float d,
+                                    float aa, float u0, float u1) {
+    float px = x - dx * d;
+    float py = y - dy * d;
     float dlx = dy;
     float dly = -dx;
     nvg__vset(dst, px + dlx * w - dx * aa, py + dly * w - dy * aa, u0, 0);
@@ -1577,11 +2639,11 @@ static NVGvertex* nvg__buttCapStart(NVGvertex* dst, NVGpoint* p, float dx,
     return dst;
 }
 
-static NVGvertex* nvg__buttCapEnd(NVGvertex* dst, NVGpoint* p, float dx,
-                                  float dy, float w, float d, float aa,
-                                  float u0, float u1) {
-    float px = p->x + dx * d;
-    float py = p->y + dy * d;
+static NVGvertex* nvg__buttCapEnd(NVGvertex* dst, float x, float y,
+                                  float dx, float dy, float w, float d,
+                                  float aa, float u0, float u1) {
+    float px = x + dx * d;
+    float py = y + dy * d;
     float dlx = dy;
     float dly = -dx;
     nvg__vset(dst, px + dlx * w, py + dly * w, u0, 1);
@@ -1595,12 +2657,12 @@ static NVGvertex* nvg__buttCapEnd(NVGvertex* dst, NVGpoint* p, float dx,
     return dst;
 }
 
-static NVGvertex* nvg__roundCapStart(NVGvertex* dst, NVGpoint* p, float dx,
-                                     float dy, float w, int ncap, float aa,
-                                     float u0, float u1) {
+static NVGvertex* nvg__roundCapStart(NVGvertex* dst, float x, float y,
+                                     float dx, float dy, float w, int ncap,
+                                     float aa, float u0, float u1) {
     int i;
-    float px = p->x;
-    float py = p->y;
+    float px = x;
+    float py = y;
     float dlx = dy;
     float dly = -dx;
     NVG_NOTUSED(aa);
@@ -1619,12 +2681,12 @@ static NVGvertex* nvg__roundCapStart(NVGvertex* dst, NVGpoint* p, float dx,
     return dst;
 }
 
-static NVGvertex* nvg__roundCapEnd(NVGvertex* dst, NVGpoint* p, float dx,
-                                   float dy, float w, int ncap, float aa,
-                                   float u0, float u1) {
+static NVGvertex* nvg__roundCapEnd(NVGvertex* dst, float x, float y,
+                                   float dx, float dy, float w, int ncap,
+                                   float aa, float u0, float u1) {
     int i;
-    float px = p->x;
-    float py = p->y;
+    float px = x;
+    float py = y;
     float dlx = dy;
     float dly = -dx;
     NVG_NOTUSED(aa);
@@ -1643,6 +2705,55 @@ static NVGvertex* nvg__roundCapEnd(NVGvertex* dst, NVGpoint* p, float dx,
     return dst;
 }
 
+// Calculates the extrusion and join flags of point i1, whose previous point
+// is i0, and returns the flags.
+static int nvg__joinPoint(NVGpathCache* c, int i0, int i1, float iw,
+                          int lineJoin, float miterLimit) {
+    float dlx0 = c->dy[i0];
+    float dly0 = -c->dx[i0];
+    float dlx1 = c->dy[i1];
+    float dly1 = -c->dx[i1];
+    float dmx, dmy, dmr2, cross, limit;
+    int flags;
+
+    // Calculate extrusions
+    dmx = (dlx0 + dlx1) * 0.5f;
+    dmy = (dly0 + dly1) * 0.5f;
+    dmr2 = dmx * dmx + dmy * dmy;
+    if (dmr2 > 0.000001f) {
+        float scale = 1.0f / dmr2;
+        if (scale > 600.0f) {
+            scale = 600.0f;
+        }
+        dmx *= scale;
+        dmy *= scale;
+    }
+    c->dmx[i1] = dmx;
+    c->dmy[i1] = dmy;
+
+    // Clear flags, but keep the corner.
+    flags = (c->flags[i1] & NVG_PT_CORNER) ? NVG_PT_CORNER : 0;
+
+    // Keep track of left turns.
+    cross = c->dx[i1] * c->dy[i0] - c->dx[i0] * c->dy[i1];
+    if (cross > 0.0f) flags |= NVG_PT_LEFT;
+
+    // Calculate if we should use bevel or miter for inner join.
+    limit = nvg__maxf(1.01f, nvg__minf(c->len[i0], c->len[i1]) * iw);
+    if ((dmr2 * limit * limit) < 1.0f) flags |= NVG_PR_INNERBEVEL;
+
+    // Check to see if the corner needs to be beveled.
+    if (flags & NVG_PT_CORNER) {
+        if ((dmr2 * miterLimit * miterLimit) < 1.0f || lineJoin == NVG_BEVEL ||
+            lineJoin == NVG_ROUND) {
+            flags |= NVG_PT_BEVEL;
+        }
+    }
+
+    c->flags[i1] = (unsigned char)flags;
+    return flags;
+}
+
 static void nvg__calculateJoins(NVGcontext* ctx, float w, int lineJoin,
                                 float miterLimit) {
     NVGpathCache* cache = ctx->cache;
@@ -1655,58 +2766,92 @@ static void nvg__calculateJoins(NVGcontext* ctx, float w, int lineJoin,
     // count.
     for (i = 0; i < cache->npaths; i++) {
         NVGpath* path = &cache->paths[i];
-        NVGpoint* pts = &cache->points[path->first];
-        NVGpoint* p0 = &pts[path->count - 1];
-        NVGpoint* p1 = &pts[0];
+        int first = path->first;
         int nleft = 0;
+        int flags;
 
         path->nbevel = 0;
+        if (path->count == 0) {
+            path->convex = 1;
+            continue;
+        }
 
-        for (j = 0; j < path->count; j++) {
-            float dlx0, dly0, dlx1, dly1, dmr2, cross, limit;
-            dlx0 = p0->dy;
-            dly0 = -p0->dx;
-            dlx1 = p1->dy;
-            dly1 = -p1->dx;
-            // Calculate extrusions
-            p1->dmx = (dlx0 + dlx1) * 0.5f;
-            p1->dmy = (dly0 + dly1) * 0.5f;
-            dmr2 = p1->dmx * p1->dmx + p1->dmy * p1->dmy;
-            if (dmr2 > 0.000001f) {
-                float scale = 1.0f / dmr2;
-                if (scale > 600.0f) {
-                    scale = 600.0f;
-                }
-                p1->dmx *= scale;
-                p1->dmy *= scale;
-            }
-
-            // Clear flags, but keep the corner.
-            p1->flags = (p1->flags & NVG_PT_CORNER) ? NVG_PT_CORNER : 0;
-
-            // Keep track of left turns.
-            cross = p1->dx * p0->dy - p0->dx * p1->dy;
-            if (cross > 0.0f) {
-                nleft++;
-                p1->flags |= NVG_PT_LEFT;
-            }
-
-            // Calculate if we should use bevel or miter for inner join.
-            limit = nvg__maxf(1.01f, nvg__minf(p0->len, p1->len) * iw);
-            if ((dmr2 * limit * limit) < 1.0f) p1->flags |= NVG_PR_INNERBEVEL;
-
-            // Check to see if the corner needs to be beveled.
-            if (p1->flags & NVG_PT_CORNER) {
-                if ((dmr2 * miterLimit * miterLimit) < 1.0f ||
-                    lineJoin == NVG_BEVEL || lineJoin == NVG_ROUND) {
-                    p1->flags |= NVG_PT_BEVEL;
+        // The first point joins the segment from the last point.
+        flags = nvg__joinPoint(cache, first + path->count - 1, first, iw,
+                               lineJoin, miterLimit);
+        if (flags & NVG_PT_LEFT) nleft++;
+        if (flags & (NVG_PT_BEVEL | NVG_PR_INNERBEVEL)) path->nbevel++;
+        j = 1;
+
+#if defined(NVG_SSE2)
+        {
+            __m128 half = _mm_set1_ps(0.5f);
+            __m128 one = _mm_set1_ps(1.0f);
+            __m128 zero = _mm_setzero_ps();
+            __m128 sign = _mm_set1_ps(-0.0f);
+            __m128 eps = _mm_set1_ps(0.000001f);
+            __m128 maxScale = _mm_set1_ps(600.0f);
+            __m128 minLimit = _mm_set1_ps(1.01f);
+            __m128 viw = _mm_set1_ps(iw);
+            __m128 vml = _mm_set1_ps(miterLimit);
+            int bevelAll = lineJoin == NVG_BEVEL || lineJoin == NVG_ROUND;
+            for (; j + 4 <= path->count; j += 4) {
+                int k0 = first + j - 1, k1 = first + j, k, left, inner, miter;
+                __m128 dx0 = _mm_loadu_ps(&cache->dx[k0]);
+                __m128 dy0 = _mm_loadu_ps(&cache->dy[k0]);
+                __m128 dx1 = _mm_loadu_ps(&cache->dx[k1]);
+                __m128 dy1 = _mm_loadu_ps(&cache->dy[k1]);
+                __m128 dmx = _mm_mul_ps(_mm_add_ps(dy0, dy1), half);
+                __m128 dmy = _mm_mul_ps(
+                    _mm_add_ps(_mm_xor_ps(dx0, sign), _mm_xor_ps(dx1, sign)),
+                    half);
+                __m128 dmr2 =
+                    _mm_add_ps(_mm_mul_ps(dmx, dmx), _mm_mul_ps(dmy, dmy));
+                __m128 big = _mm_cmpgt_ps(dmr2, eps);
+                __m128 scale = _mm_min_ps(_mm_div_ps(one, dmr2), maxScale);
+                __m128 cross, limit;
+                scale = _mm_or_ps(_mm_and_ps(big, scale),
+                                  _mm_andnot_ps(big, one));
+                _mm_storeu_ps(&cache->dmx[k1], _mm_mul_ps(dmx, scale));
+                _mm_storeu_ps(&cache->dmy[k1], _mm_mul_ps(dmy, scale));
+
+                cross = _mm_sub_ps(_mm_mul_ps(dx1, dy0), _mm_mul_ps(dx0, dy1));
+                left = _mm_movemask_ps(_mm_cmpgt_ps(cross, zero));
+                limit = _mm_max_ps(
+                    minLimit,
+                    _mm_mul_ps(_mm_min_ps(_mm_loadu_ps(&cache->len[k0]),
+                                          _mm_loadu_ps(&cache->len[k1])),
+                               viw));
+                inner = _mm_movemask_ps(_mm_cmplt_ps(
+                    _mm_mul_ps(_mm_mul_ps(dmr2, limit), limit), one));
+                miter = _mm_movemask_ps(_mm_cmplt_ps(
+                    _mm_mul_ps(_mm_mul_ps(dmr2, vml), vml), one));
+
+                for (k = 0; k < 4; k++) {
+                    flags = (cache->flags[k1 + k] & NVG_PT_CORNER)
+                                ? NVG_PT_CORNER
+                                : 0;
+                    if (left & (1 << k)) {
+                        flags |= NVG_PT_LEFT;
+                        nleft++;
+                    }
+                    if (inner & (1 << k)) flags |= NVG_PR_INNERBEVEL;
+                    if ((flags & NVG_PT_CORNER) &&
+                        ((miter & (1 << k)) || bevelAll))
+                        flags |= NVG_PT_BEVEL;
+                    if (flags & (NVG_PT_BEVEL | NVG_PR_INNERBEVEL))
+                        path->nbevel++;
+                    cache->flags[k1 + k] = (unsigned char)flags;
                 }
             }
+        }
+#endif
 
-            if ((p1->flags & (NVG_PT_BEVEL | NVG_PR_INNERBEVEL)) != 0)
-                path->nbevel++;
-
-            p0 = p1++;
+        for (; j < path->count; j++) {
+            flags = nvg__joinPoint(cache, first + j - 1, first + j, iw,
+                                   lineJoin, miterLimit);
+            if (flags & NVG_PT_LEFT) nleft++;
+            if (flags & (NVG_PT_BEVEL | NVG_PR_INNERBEVEL)) path->nbevel++;
         }
 
         path->convex = (nleft == path->count) ? 1 : 0;
@@ -1755,14 +2900,12 @@ static int nvg__expandStroke(NVGcontext* ctx, float w, float fringe,
         }
     }
 
-    verts = nvg__allocTempVerts(ctx, cverts);
+    verts = nvg__allocFrameVerts(ctx, cverts);
     if (verts == NULL) return 0;
 
     for (i = 0; i < cache->npaths; i++) {
         NVGpath* path = &cache->paths[i];
-        NVGpoint* pts = &cache->points[path->first];
-        NVGpoint* p0;
-        NVGpoint* p1;
+        int i0, i1;
         int s, e, loop;
         float dx, dy;
 
@@ -1776,48 +2919,50 @@ static int nvg__expandStroke(NVGcontext* ctx, float w, float fringe,
 
         if (loop) {
             // Looping
-            p0 = &pts[path->count - 1];
-            p1 = &pts[0];
+            i0 = path->first + path->count - 1;
+            i1 = path->first;
             s = 0;
             e = path->count;
         } else {
             // Add cap
-            p0 = &pts[0];
-            p1 = &pts[1];
+            i0 = path->first;
+            i1 = path->first + 1;
             s = 1;
             e = path->count - 1;
         }
 
         if (loop == 0) {
             // Add cap
-            dx = p1->x - p0->x;
-            dy = p1->y - p0->y;
+            dx = cache->px[i1] - cache->px[i0];
+            dy = cache->py[i1] - cache->py[i0];
             nvg__normalize(&dx, &dy);
             if (lineCap == NVG_BUTT)
-                dst = nvg__buttCapStart(dst, p0, dx, dy, w, -aa * 0.5f, aa, u0,
-                                        u1);
+                dst = nvg__buttCapStart(dst, cache->px[i0], cache->py[i0], dx,
+                                        dy, w, -aa * 0.5f, aa, u0, u1);
             else if (lineCap == NVG_BUTT || lineCap == NVG_SQUARE)
-                dst = nvg__buttCapStart(dst, p0, dx, dy, w, w - aa, aa, u0, u1);
+                dst = nvg__buttCapStart(dst, cache->px[i0], cache->py[i0], dx,
+                                        dy, w, w - aa, aa, u0, u1);
             else if (lineCap == NVG_ROUND)
-                dst = nvg__roundCapStart(dst, p0, dx, dy, w, ncap, aa, u0, u1);
+                dst = nvg__roundCapStart(dst, cache->px[i0], cache->py[i0], dx,
+                                         dy, w, ncap, aa, u0, u1);
         }
 
         for (j = s; j < e; ++j) {
-            if ((p1->flags & (NVG_PT_BEVEL | NVG_PR_INNERBEVEL)) != 0) {
+            if ((cache->flags[i1] & (NVG_PT_BEVEL | NVG_PR_INNERBEVEL)) != 0) {
                 if (lineJoin == NVG_ROUND) {
-                    dst = nvg__roundJoin(dst, p0, p1, w, w, u0, u1, ncap, aa);
+                    dst = nvg__roundJoin(dst, cache, i0, i1, w, w, u0, u1, ncap,
+                                         aa);
                 } else {
-                    dst = nvg__bevelJoin(dst, p0, p1, w, w, u0, u1, aa);
+                    dst = nvg__bevelJoin(dst, cache, i0, i1, w, w, u0, u1, aa);
                 }
             } else {
-                nvg__vset(dst, p1->x + (p1->dmx * w), p1->y + (p1->dmy * w), u0,
-                          1);
+                float mx = cache->dmx[i1] * w, my = cache->dmy[i1] * w;
+                nvg__vset(dst, cache->px[i1] + mx, cache->py[i1] + my, u0, 1);
                 dst++;
-                nvg__vset(dst, p1->x - (p1->dmx * w), p1->y - (p1->dmy * w), u1,
-                          1);
+                nvg__vset(dst, cache->px[i1] - mx, cache->py[i1] - my, u1, 1);
                 dst++;
             }
-            p0 = p1++;
+            i0 = i1++;
         }
 
         if (loop) {
@@ -1828,16 +2973,18 @@ static int nvg__expandStroke(NVGcontext* ctx, float w, float fringe,
             dst++;
         } else {
             // Add cap
-            dx = p1->x - p0->x;
-            dy = p1->y - p0->y;
+            dx = cache->px[i1] - cache->px[i0];
+            dy = cache->py[i1] - cache->py[i0];
             nvg__normalize(&dx, &dy);
             if (lineCap == NVG_BUTT)
-                dst =
-                    nvg__buttCapEnd(dst, p1, dx, dy, w, -aa * 0.5f, aa, u0, u1);
+                dst = nvg__buttCapEnd(dst, cache->px[i1], cache->py[i1], dx,
+                                      dy, w, -aa * 0.5f, aa, u0, u1);
             else if (lineCap == NVG_BUTT || lineCap == NVG_SQUARE)
-                dst = nvg__buttCapEnd(dst, p1, dx, dy, w, w - aa, aa, u0, u1);
+                dst = nvg__buttCapEnd(dst, cache->px[i1], cache->py[i1], dx,
+                                      dy, w, w - aa, aa, u0, u1);
             else if (lineCap == NVG_ROUND)
-                dst = nvg__roundCapEnd(dst, p1, dx, dy, w, ncap, aa, u0, u1);
+                dst = nvg__roundCapEnd(dst, cache->px[i1], cache->py[i1], dx,
+                                       dy, w, ncap, aa, u0, u1);
         }
 
         path->nstroke = (int)(dst - verts);
@@ -1848,17 +2995,130 @@ static int nvg__expandStroke(NVGcontext* ctx, float w, float fringe,
     return 1;
 }
 
+// Returns true if the segments ab and cd intersect or touch. Collinear
+// segments with overlapping bounds count as touching.
+static int nvg__segmentsTouch(float ax, float ay, float bx, float by, float cx,
+                              float cy, float dx, float dy) {
+    float d1, d2, d3, d4;
+    if (nvg__maxf(ax, bx) < nvg__minf(cx, dx) ||
+        nvg__maxf(cx, dx) < nvg__minf(ax, bx) ||
+        nvg__maxf(ay, by) < nvg__minf(cy, dy) ||
+        nvg__maxf(cy, dy) < nvg__minf(ay, by))
+        return 0;
+    d1 = nvg__triarea2(ax, ay, bx, by, cx, cy);
+    d2 = nvg__triarea2(ax, ay, bx, by, dx, dy);
+    d3 = nvg__triarea2(cx, cy, dx, dy, ax, ay);
+    d4 = nvg__triarea2(cx, cy, dx, dy, bx, by);
+    return d1 * d2 <= 0.0f && d3 * d4 <= 0.0f;
+}
+
+// Returns true if the closed path is a small polygon whose edges do not
+// cross or touch each other, which can be filled without the stencil.
+static int nvg__simplePath(const NVGpathCache* cache, const NVGpath* path) {
+    const float* px = &cache->px[path->first];
+    const float* py = &cache->py[path->first];
+    int n = path->count, i, j;
+    if (n < 4 || n > NVG_MAX_TRIANGULATE_POINTS) return 0;
+    for (i = 0; i < n; i++) {
+        int i1 = i + 1 < n ? i + 1 : 0;
+        // Skip the neighbouring edges, they share a point with edge i.
+        for (j = i + 2; j < n; j++) {
+            int j1 = j + 1 < n ? j + 1 : 0;
+            if (j1 == i) continue;
+            if (nvg__segmentsTouch(px[i], py[i], px[i1], py[i1], px[j], py[j],
+                                   px[j1], py[j1]))
+                return 0;
+        }
+    }
+    return 1;
+}
+
+// Returns true if no other remaining vertex lies in the triangle abc. The
+// vertices at the triangle corners are skipped.
+static int nvg__isEar(const NVGvertex* pts, const int* next, int a, int b,
+                      int c, float sign) {
+    const NVGvertex *pa = &pts[a], *pb = &pts[b], *pc = &pts[c];
+    int i;
+    if (nvg__triarea2(pa->x, pa->y, pb->x, pb->y, pc->x, pc->y) * sign <= 0.0f)
+        return 0;
+    for (i = next[c]; i != a; i = next[i]) {
+        const NVGvertex* p = &pts[i];
+        if ((p->x == pa->x && p->y == pa->y) ||
+            (p->x == pb->x && p->y == pb->y) ||
+            (p->x == pc->x && p->y == pc->y))
+            continue;
+        if (nvg__triarea2(pa->x, pa->y, pb->x, pb->y, p->x, p->y) * sign >=
+                0.0f &&
+            nvg__triarea2(pb->x, pb->y, pc->x, pc->y, p->x, p->y) * sign >=
+                0.0f &&
+            nvg__triarea2(pc->x, pc->y, pa->x, pa->y, p->x, p->y) * sign >=
+                0.0f)
+            return 0;
+    }
+    return 1;
+}
+
+// Triangulates a simple polygon by ear clipping. The triangles keep the
+// winding of the polygon and are written to dst as a triangle list. Returns
+// the number of vertices written, or 0 if the polygon could not be clipped.
+static int nvg__triangulate(const NVGvertex* pts, int n, NVGvertex* dst) {
+    int prev[NVG_MAX_TRIANGULATE_POINTS * 2];
+    int next[NVG_MAX_TRIANGULATE_POINTS * 2];
+    int i, left = n, tries = 0, nverts = 0;
+    float area = 0.0f, sign;
+
+    if (n < 3 || n > NVG_MAX_TRIANGULATE_POINTS * 2) return 0;
+    for (i = 2; i < n; i++)
+        area += nvg__triarea2(pts[0].x, pts[0].y, pts[i - 1].x, pts[i - 1].y,
+                              pts[i].x, pts[i].y);
+    if (area == 0.0f) return 0;
+    sign = area > 0.0f ? 1.0f : -1.0f;
+    for (i = 0; i < n; i++) {
+        prev[i] = i > 0 ? i - 1 : n - 1;
+        next[i] = i + 1 < n ? i + 1 : 0;
+    }
+
+    i = 0;
+    while (left > 3) {
+        int a = prev[i], c = next[i];
+        if (nvg__isEar(pts, next, a, i, c, sign)) {
+            dst[nverts++] = pts[a];
+            dst[nverts++] = pts[i];
+            dst[nverts++] = pts[c];
+            next[a] = c;
+            prev[c] = a;
+            left--;
+            tries = 0;
+            i = a;
+        } else {
+            // A full round without an ear, the polygon is not simple.
+            if (++tries > left) return 0;
+            i = c;
+        }
+    }
+    dst[nverts++] = pts[prev[i]];
+    dst[nverts++] = pts[i];
+    dst[nverts++] = pts[next[i]];
+    return nverts;
+}
+
 static int nvg__expandFill(NVGcontext* ctx, float w, int lineJoin,
                            float miterLimit) {
     NVGpathCache* cache = ctx->cache;
     NVGvertex* verts;
     NVGvertex* dst;
-    int cverts, convex, i, j;
+    int cverts, convex, simple, i, j;
     float aa = ctx->fringeWidth;
     int fringe = w > 0.0f;
 
     nvg__calculateJoins(ctx, w, lineJoin, miterLimit);
 
+    convex = cache->npaths == 1 && cache->paths[0].convex;
+    // A single concave contour without self intersections is triangulated
+    // on the CPU, and drawn like a convex one.
+    simple = cache->npaths == 1 && !convex &&
+             nvg__simplePath(cache, &cache->paths[0]);
+
     // Calculate max vertex usage.
     cverts = 0;
     for (i = 0; i < cache->npaths; i++) {
@@ -1867,18 +3127,15 @@ static int nvg__expandFill(NVGcontext* ctx, float w, int lineJoin,
         if (fringe)
             cverts +=
                 (path->count + path->nbevel * 5 + 1) * 2;  // plus one for loop
+        if (simple) cverts += (path->count + path->nbevel) * 3;
     }
 
-    verts = nvg__allocTempVerts(ctx, cverts);
+    verts = nvg__allocFrameVerts(ctx, cverts);
     if (verts == NULL) return 0;
 
-    convex = cache->npaths == 1 && cache->paths[0].convex;
-
     for (i = 0; i < cache->npaths; i++) {
         NVGpath* path = &cache->paths[i];
-        NVGpoint* pts = &cache->points[path->first];
-        NVGpoint* p0;
-        NVGpoint* p1;
+        int i0, i1;
         float rw, lw, woff;
         float ru, lu;
 
@@ -1889,39 +3146,41 @@ static int nvg__expandFill(NVGcontext* ctx, float w, int lineJoin,
 
         if (fringe) {
             // Looping
-            p0 = &pts[path->count - 1];
-            p1 = &pts[0];
+            i0 = path->first + path->count - 1;
+            i1 = path->first;
             for (j = 0; j < path->count; ++j) {
-                if (p1->flags & NVG_PT_BEVEL) {
-                    float dlx0 = p0->dy;
-                    float dly0 = -p0->dx;
-                    float dlx1 = p1->dy;
-                    float dly1 = -p1->dx;
-                    if (p1->flags & NVG_PT_LEFT) {
-                        float lx = p1->x + p1->dmx * woff;
-                        float ly = p1->y + p1->dmy * woff;
+                if (cache->flags[i1] & NVG_PT_BEVEL) {
+                    float dlx0 = cache->dy[i0];
+                    float dly0 = -cache->dx[i0];
+                    float dlx1 = cache->dy[i1];
+                    float dly1 = -cache->dx[i1];
+                    if (cache->flags[i1] & NVG_PT_LEFT) {
+                        float lx = cache->px[i1] + cache->dmx[i1] * woff;
+                        float ly = cache->py[i1] + cache->dmy[i1] * woff;
                         nvg__vset(dst, lx, ly, 0.5f, 1);
                         dst++;
                     } else {
-                        float lx0 = p1->x + dlx0 * woff;
-                        float ly0 = p1->y + dly0 * woff;
-                        float lx1 = p1->x + dlx1 * woff;
-                        float ly1 = p1->y + dly1 * woff;
+                        float lx0 = cache->px[i1] + dlx0 * woff;
+                        float ly0 = cache->py[i1] + dly0 * woff;
+                        float lx1 = cache->px[i1] + dlx1 * woff;
+                        float ly1 = cache->py[i1] + dly1 * woff;
                         nvg__vset(dst, lx0, ly0, 0.5f, 1);
                         dst++;
                         nvg__vset(dst, lx1, ly1, 0.5f, 1);
                         dst++;
                     }
                 } else {
-                    nvg__vset(dst, p1->x + (p1->dmx * woff),
-                              p1->y + (p1->dmy * woff), 0.5f, 1);
+                    nvg__vset(dst, cache->px[i1] + (cache->dmx[i1] * woff),
+                              cache->py[i1] + (cache->dmy[i1] * woff), 0.5f,
+                              1);
                     dst++;
                 }
-                p0 = p1++;
+                i0 = i1++;
             }
         } else {
             for (j = 0; j < path->count; ++j) {
-                nvg__vset(dst, pts[j].x, pts[j].y, 0.5f, 1);
+                nvg__vset(dst, cache->px[path->first + j],
+                          cache->py[path->first + j], 0.5f, 1);
                 dst++;
             }
         }
@@ -1940,29 +3199,30 @@ static int nvg__expandFill(NVGcontext* ctx, float w, int lineJoin,
 
             // Create only half a fringe for convex shapes so that
             // the shape can be rendered without stenciling.
-            if (convex) {
+            if (convex || simple) {
                 lw = woff;  // This should generate the same vertex as fill
                             // inset above.
                 lu = 0.5f;  // Set outline fade at middle.
             }
 
             // Looping
-            p0 = &pts[path->count - 1];
-            p1 = &pts[0];
+            i0 = path->first + path->count - 1;
+            i1 = path->first;
 
             for (j = 0; j < path->count; ++j) {
-                if ((p1->flags & (NVG_PT_BEVEL | NVG_PR_INNERBEVEL)) != 0) {
-                    dst = nvg__bevelJoin(dst, p0, p1, lw, rw, lu, ru,
+                if ((cache->flags[i1] &
+                     (NVG_PT_BEVEL | NVG_PR_INNERBEVEL)) != 0) {
+                    dst = nvg__bevelJoin(dst, cache, i0, i1, lw, rw, lu, ru,
                                          ctx->fringeWidth);
                 } else {
-                    nvg__vset(dst, p1->x + (p1->dmx * lw),
-                              p1->y + (p1->dmy * lw), lu, 1);
+                    nvg__vset(dst, cache->px[i1] + (cache->dmx[i1] * lw),
+                              cache->py[i1] + (cache->dmy[i1] * lw), lu, 1);
                     dst++;
-                    nvg__vset(dst, p1->x - (p1->dmx * rw),
-                              p1->y - (p1->dmy * rw), ru, 1);
+                    nvg__vset(dst, cache->px[i1] - (cache->dmx[i1] * rw),
+                              cache->py[i1] - (cache->dmy[i1] * rw), ru, 1);
                     dst++;
                 }
-                p0 = p1++;
+                i0 = i1++;
             }
 
             // Loop it
@@ -1977,44 +3237,254 @@ static int nvg__expandFill(NVGcontext* ctx, float w, int lineJoin,
             path->stroke = NULL;
             path->nstroke = 0;
         }
+
+        // Replace the fan with a triangle list. If clipping fails the half
+        // fringe is still right for the stencil fill.
+        path->triangulated = 0;
+        if (simple) {
+            int n = nvg__triangulate(path->fill, path->nfill, verts);
+            if (n > 0) {
+                path->fill = verts;
+                path->nfill = n;
+                path->triangulated = 1;
+            }
+        }
     }
 
     return 1;
 }
 
+// Geometry cache
+static unsigned int nvg__hashWords(unsigned int h, const void* data,
+                                   int nwords) {
+    const unsigned int* w = (const unsigned int*)data;
+    int i;
+    for (i = 0; i < nwords; i++) {
+        h ^= w[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static unsigned int nvg__hashBytes(unsigned int h, const unsigned char* data,
+                                   int nbytes) {
+    int i;
+    for (i = 0; i < nbytes; i++) {
+        h ^= data[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// Final avalanche so that the low bits can be used as bucket index.
+static unsigned int nvg__hashFinish(unsigned int h) {
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35u;
+    h ^= h >> 16;
+    return h;
+}
+
+static unsigned int nvg__geomHash(NVGcontext* ctx, const NVGgeomKey* key) {
+    unsigned int h;
+    if (!ctx->commandsHashValid) {
+        h = nvg__hashBytes(2166136261u, ctx->commands, ctx->ncommands);
+        ctx->commandsHash =
+            nvg__hashWords(h, ctx->commandPts, ctx->ncommandPts * 2);
+        ctx->commandsHashValid = 1;
+    }
+    h = nvg__hashWords(ctx->commandsHash, key, sizeof(NVGgeomKey) / 4);
+    return nvg__hashFinish(h);
+}
+
+static void nvg__geomUnlink(NVGgeomCache* gc, NVGgeomEntry* entry) {
+    if (entry->lruPrev != NULL)
+        entry->lruPrev->lruNext = entry->lruNext;
+    else
+        gc->lruHead = entry->lruNext;
+    if (entry->lruNext != NULL)
+        entry->lruNext->lruPrev = entry->lruPrev;
+    else
+        gc->lruTail = entry->lruPrev;
+    entry->lruPrev = entry->lruNext = NULL;
+}
+
+static void nvg__geomPushFront(NVGgeomCache* gc, NVGgeomEntry* entry) {
+    entry->lruPrev = NULL;
+    entry->lruNext = gc->lruHead;
+    if (gc->lruHead != NULL) gc->lruHead->lruPrev = entry;
+    gc->lruHead = entry;
+    if (gc->lruTail == NULL) gc->lruTail = entry;
+}
+
+static void nvg__geomEvict(NVGgeomCache* gc, NVGgeomEntry* entry) {
+    NVGgeomEntry** link = &gc->lut[entry->hash & (NVG_GEOMCACHE_LUT_SIZE - 1)];
+    while (*link != NULL && *link != entry) link = &(*link)->next;
+    if (*link != NULL) *link = entry->next;
+    nvg__geomUnlink(gc, entry);
+    gc->bytes -= entry->size;
+    gc->nentries--;
+    gc->evictions++;
+    free(entry);
+}
+
+static void nvg__geomTrim(NVGgeomCache* gc, int budget) {
+    while (gc->lruTail != NULL && gc->bytes > budget)
+        nvg__geomEvict(gc, gc->lruTail);
+}
+
+static NVGgeomEntry* nvg__geomFind(NVGcontext* ctx, unsigned int hash,
+                                   const NVGgeomKey* key) {
+    NVGgeomCache* gc = ctx->geomCache;
+    NVGgeomEntry* entry = gc->lut[hash & (NVG_GEOMCACHE_LUT_SIZE - 1)];
+    while (entry != NULL) {
+        if (entry->hash == hash && entry->ncommands == ctx->ncommands &&
+            entry->ncommandPts == ctx->ncommandPts &&
+            memcmp(&entry->key, key, sizeof(NVGgeomKey)) == 0 &&
+            memcmp(entry->commands, ctx->commands, ctx->ncommands) == 0 &&
+            memcmp(entry->commandPts, ctx->commandPts,
+                   sizeof(float) * 2 * ctx->ncommandPts) == 0) {
+            nvg__geomUnlink(gc, entry);
+            nvg__geomPushFront(gc, entry);
+            gc->hits++;
+            return entry;
+        }
+        entry = entry->next;
+    }
+    gc->misses++;
+    return NULL;
+}
+
+// Stores the tessellated paths of the path cache. Geometry is only retained
+// the second time it is seen so that paths which change every frame do not
+// flush the cache.
+static void nvg__geomInsert(NVGcontext* ctx, unsigned int hash,
+                            const NVGgeomKey* key) {
+    NVGgeomCache* gc = ctx->geomCache;
+    NVGpathCache* cache = ctx->cache;
+    NVGgeomEntry* entry;
+    NVGvertex* dst;
+    unsigned int* seen = &gc->seen[hash & (NVG_GEOMCACHE_SEEN_SIZE - 1)];
+    int i, nverts = 0, size;
+
+    if (*seen != hash) {
+        *seen = hash;
+        return;
+    }
+
+    for (i = 0; i < cache->npaths; i++)
+        nverts += cache->paths[i].nfill + cache->paths[i].nstroke;
+    size = (int)(sizeof(NVGgeomEntry) + sizeof(NVGvertex) * nverts +
+                 sizeof(NVGpath) * cache->npaths +
+                 sizeof(float) * 2 * ctx->ncommandPts + ctx->ncommands);
+    if (size > gc->budget) return;
+    nvg__geomTrim(gc, gc->budget - size);
+
+    entry = (NVGgeomEntry*)malloc(size);
+    if (entry == NULL) return;
+    memset(entry, 0, sizeof(NVGgeomEntry));
+    entry->hash = hash;
+    entry->key = *key;
+    entry->size = size;
+    entry->verts = (NVGvertex*)(entry + 1);
+    entry->nverts = nverts;
+    entry->paths = (NVGpath*)(entry->verts + nverts);
+    entry->npaths = cache->npaths;
+    entry->commandPts = (float*)(entry->paths + cache->npaths);
+    entry->ncommandPts = ctx->ncommandPts;
+    if (ctx->ncommandPts > 0)
+        memcpy(entry->commandPts, ctx->commandPts,
+               sizeof(float) * 2 * ctx->ncommandPts);
+    entry->commands =
+        (unsigned char*)(entry->commandPts + ctx->ncommandPts * 2);
+    entry->ncommands = ctx->ncommands;
+    if (ctx->ncommands > 0)
+        memcpy(entry->commands, ctx->commands, ctx->ncommands);
+    memcpy(entry->bounds, cache->bounds, sizeof(entry->bounds));
+
+    dst = entry->verts;
+    for (i = 0; i < cache->npaths; i++) {
+        NVGpath* path = &entry->paths[i];
+        *path = cache->paths[i];
+        if (path->nfill > 0) {
+            memcpy(dst, path->fill, sizeof(NVGvertex) * path->nfill);
+            path->fill = dst;
+            dst += path->nfill;
+        }
+        if (path->nstroke > 0) {
+            memcpy(dst, path->stroke, sizeof(NVGvertex) * path->nstroke);
+            path->stroke = dst;
+            dst += path->nstroke;
+        }
+    }
+
+    entry->next = gc->lut[hash & (NVG_GEOMCACHE_LUT_SIZE - 1)];
+    gc->lut[hash & (NVG_GEOMCACHE_LUT_SIZE - 1)] = entry;
+    nvg__geomPushFront(gc, entry);
+    gc->bytes += size;
+    gc->nentries++;
+}
+
+void nvgGeometryCacheBudget(NVGcontext* ctx, int bytes) {
+    NVGgeomCache* gc = ctx->geomCache;
+    if (gc == NULL) return;
+    gc->budget = nvg__maxi(0, bytes);
+    nvg__geomTrim(gc, gc->budget);
+}
+
+void nvgGeometryCacheStats(NVGcontext* ctx, NVGgeometryCacheStats* stats) {
+    NVGgeomCache* gc = ctx->geomCache;
+    if (stats == NULL) return;
+    memset(stats, 0, sizeof(*stats));
+    if (gc == NULL) return;
+    stats->hits = gc->hits;
+    stats->misses = gc->misses;
+    stats->evictions = gc->evictions;
+    stats->entries = gc->nentries;
+    stats->bytes = gc->bytes;
+}
+
 // Draw
 void nvgBeginPath(NVGcontext* ctx) {
     ctx->ncommands = 0;
+    ctx->ncommandPts = 0;
+    ctx->commandsHashValid = 0;
+    ctx->shape.end = 0;
+    nvg__clearBounds(ctx->commandBounds);
     nvg__clearPathCache(ctx);
 }
 
 void nvgMoveTo(NVGcontext* ctx, float x, float y) {
-    float vals[] = {NVG_MOVETO, x, y};
-    nvg__appendCommands(ctx, vals, NVG_COUNTOF(vals));
+    unsigned char cmds[] = {NVG_MOVETO};
+    float pts[] = {x, y};
+    nvg__appendCommands(ctx, cmds, NVG_COUNTOF(cmds), pts, 1);
 }
 
 void nvgLineTo(NVGcontext* ctx, float x, float y) {
-    float vals[] = {NVG_LINETO, x, y};
-    nvg__appendCommands(ctx, vals, NVG_COUNTOF(vals));
+    unsigned char cmds[] = {NVG_LINETO};
+    float pts[] = {x, y};
+    nvg__appendCommands(ctx, cmds, NVG_COUNTOF(cmds), pts, 1);
 }
 
 void nvgBezierTo(NVGcontext* ctx, float c1x, float c1y, float c2x, float c2y,
                  float x, float y) {
-    float vals[] = {NVG_BEZIERTO, c1x, c1y, c2x, c2y, x, y};
-    nvg__appendCommands(ctx, vals, NVG_COUNTOF(vals));
+    unsigned char cmds[] = {NVG_BEZIERTO};
+    float pts[] = {c1x, c1y, c2x, c2y, x, y};
+    nvg__appendCommands(ctx, cmds, NVG_COUNTOF(cmds), pts, 3);
 }
 
 void nvgQuadTo(NVGcontext* ctx, float cx, float cy, float x, float y) {
     float x0 = ctx->commandx;
     float y0 = ctx->commandy;
-    float vals[] = {NVG_BEZIERTO,
-                    x0 + 2.0f / 3.0f * (cx - x0),
-                    y0 + 2.0f / 3.0f * (cy - y0),
-                    x + 2.0f / 3.0f * (cx - x),
-                    y + 2.0f / 3.0f * (cy - y),
-                    x,
-                    y};
-    nvg__appendCommands(ctx, vals, NVG_COUNTOF(vals));
+    unsigned char cmds[] = {NVG_BEZIERTO};
+    float pts[] = {x0 + 2.0f / 3.0f * (cx - x0),
+                   y0 + 2.0f / 3.0f * (cy - y0),
+                   x + 2.0f / 3.0f * (cx - x),
+                   y + 2.0f / 3.0f * (cy - y),
+                   x,
+                   y};
+    nvg__appendCommands(ctx, cmds, NVG_COUNTOF(cmds), pts, 3);
 }
 
 void nvgArcTo(NVGcontext* ctx, float x1, float y1, float x2, float y2,
@@ -2076,13 +3546,58 @@ void nvgArcTo(NVGcontext* ctx, float x1, float y1, float x2, float y2,
 }
 
 void nvgClosePath(NVGcontext* ctx) {
-    float vals[] = {NVG_CLOSE};
-    nvg__appendCommands(ctx, vals, NVG_COUNTOF(vals));
+    unsigned char cmds[] = {NVG_CLOSE};
+    nvg__appendCommands(ctx, cmds, NVG_COUNTOF(cmds), NULL, 0);
 }
 
 void nvgPathWinding(NVGcontext* ctx, int dir) {
-    float vals[] = {NVG_WINDING, (float)dir};
-    nvg__appendCommands(ctx, vals, NVG_COUNTOF(vals));
+    unsigned char cmds[] = {NVG_WINDING, (unsigned char)dir};
+    nvg__appendCommands(ctx, cmds, NVG_COUNTOF(cmds), NULL, 0);
+}
+
+void nvgPolyline(NVGcontext* ctx, const float* xy, int n, int flags) {
+    nvgPolylineStrided(ctx, xy, sizeof(float) * 2, xy + 1, sizeof(float) * 2,
+                       n, flags);
+}
+
+void nvgPolylineStrided(NVGcontext* ctx, const float* x, int xstride,
+                        const float* y, int ystride, int n, int flags) {
+    NVGstate* state = nvg__getState(ctx);
+    const unsigned char* xp = (const unsigned char*)x;
+    const unsigned char* yp = (const unsigned char*)y;
+    unsigned char* cmds;
+    float* pts;
+    int i, ncmds;
+
+    if (n <= 0) return;
+    if (!nvg__reserveCommands(ctx, n + 1, n)) return;
+
+    ctx->commandsHashValid = 0;
+    ctx->commandx = *(const float*)(xp + (size_t)(n - 1) * xstride);
+    ctx->commandy = *(const float*)(yp + (size_t)(n - 1) * ystride);
+
+    pts = &ctx->commandPts[ctx->ncommandPts * 2];
+    if (xstride == (int)sizeof(float) * 2 && ystride == xstride &&
+        y == x + 1) {
+        nvg__transformPoints(pts, x, n, state->xform);
+    } else {
+        for (i = 0; i < n; i++) {
+            pts[i * 2] = *(const float*)(xp + (size_t)i * xstride);
+            pts[i * 2 + 1] = *(const float*)(yp + (size_t)i * ystride);
+        }
+        nvg__transformPoints(pts, pts, n, state->xform);
+    }
+    if (flags & NVG_POLYLINE_DECIMATE)
+        n = nvg__decimateColumns(pts, n, ctx->devicePxRatio);
+    nvg__addBounds(ctx->commandBounds, pts, n);
+    ctx->ncommandPts += n;
+
+    cmds = &ctx->commands[ctx->ncommands];
+    cmds[0] = NVG_MOVETO;
+    memset(cmds + 1, NVG_LINETO, n - 1);
+    ncmds = n;
+    if (flags & NVG_POLYLINE_CLOSED) cmds[ncmds++] = NVG_CLOSE;
+    ctx->ncommands += ncmds;
 }
 
 void nvgArc(NVGcontext* ctx, float cx, float cy, float r, float a0, float a1,
@@ -2090,8 +3605,9 @@ void nvgArc(NVGcontext* ctx, float cx, float cy, float r, float a0, float a1,
     float a = 0, da = 0, hda = 0, kappa = 0;
     float dx = 0, dy = 0, x = 0, y = 0, tanx = 0, tany = 0;
     float px = 0, py = 0, ptanx = 0, ptany = 0;
-    float vals[3 + 5 * 7 + 100];
-    int i, ndivs, nvals;
+    unsigned char cmds[6];
+    float pts[2 + 5 * 6];
+    int i, ndivs, ncmds, npts;
     int move = ctx->ncommands > 0 ? NVG_LINETO : NVG_MOVETO;
 
     // Clamp angles
@@ -2118,7 +3634,7 @@ void nvgArc(NVGcontext* ctx, float cx, float cy, float r, float a0, float a1,
 
     if (dir == NVG_CCW) kappa = -kappa;
 
-    nvals = 0;
+    ncmds = npts = 0;
     for (i = 0; i <= ndivs; i++) {
         a = a0 + da * (i / (float)ndivs);
         dx = nvg__cosf(a);
@@ -2129,17 +3645,19 @@ void nvgArc(NVGcontext* ctx, float cx, float cy, float r, float a0, float a1,
         tany = dx * r * kappa;
 
         if (i == 0) {
-            vals[nvals++] = (float)move;
-            vals[nvals++] = x;
-            vals[nvals++] = y;
+            cmds[ncmds++] = (unsigned char)move;
+            pts[npts * 2 + 0] = x;
+            pts[npts * 2 + 1] = y;
+            npts += 1;
         } else {
-            vals[nvals++] = NVG_BEZIERTO;
-            vals[nvals++] = px + ptanx;
-            vals[nvals++] = py + ptany;
-            vals[nvals++] = x - tanx;
-            vals[nvals++] = y - tany;
-            vals[nvals++] = x;
-            vals[nvals++] = y;
+            cmds[ncmds++] = NVG_BEZIERTO;
+            pts[npts * 2 + 0] = px + ptanx;
+            pts[npts * 2 + 1] = py + ptany;
+            pts[npts * 2 + 2] = x - tanx;
+            pts[npts * 2 + 3] = y - tany;
+            pts[npts * 2 + 4] = x;
+            pts[npts * 2 + 5] = y;
+            npts += 3;
         }
         px = x;
         py = y;
@@ -2147,14 +3665,35 @@ void nvgArc(NVGcontext* ctx, float cx, float cy, float r, float a0, float a1,
         ptany = tany;
     }
 
-    nvg__appendCommands(ctx, vals, nvals);
+    nvg__appendCommands(ctx, cmds, ncmds, pts, npts);
+}
+
+// Remembers the shape which was just appended, if it is the only thing in the
+// current path. See nvg__fillShape().
+static void nvg__setShape(NVGcontext* ctx, int start, float x, float y,
+                          float w, float h, float r) {
+    NVGshape* shape = &ctx->shape;
+    if (start != 0) {
+        shape->end = 0;
+        return;
+    }
+    shape->end = ctx->ncommands;
+    memcpy(shape->xform, nvg__getState(ctx)->xform, sizeof(float) * 6);
+    shape->cx = x + w * 0.5f;
+    shape->cy = y + h * 0.5f;
+    shape->hw = nvg__absf(w) * 0.5f;
+    shape->hh = nvg__absf(h) * 0.5f;
+    shape->radius = r;
 }
 
 void nvgRect(NVGcontext* ctx, float x, float y, float w, float h) {
-    float vals[] = {NVG_MOVETO, x,          y,        NVG_LINETO, x,
-                    y + h,      NVG_LINETO, x + w,    y + h,      NVG_LINETO,
-                    x + w,      y,          NVG_CLOSE};
-    nvg__appendCommands(ctx, vals, NVG_COUNTOF(vals));
+    unsigned char cmds[] = {NVG_MOVETO, NVG_LINETO, NVG_LINETO, NVG_LINETO,
+                            NVG_CLOSE};
+    float pts[] = {x, y, x, y + h, x + w, y + h, x + w, y};
+    int start = ctx->ncommands;
+    nvg__appendCommands(ctx, cmds, NVG_COUNTOF(cmds), pts,
+                        NVG_COUNTOF(pts) / 2);
+    nvg__setShape(ctx, start, x, y, w, h, 0.0f);
 }
 
 void nvgRoundedRect(NVGcontext* ctx, float x, float y, float w, float h,
@@ -2180,88 +3719,92 @@ void nvgRoundedRectVarying(NVGcontext* ctx, float x, float y, float w, float h,
               ryTR = nvg__minf(radTopRight, halfh) * nvg__signf(h);
         float rxTL = nvg__minf(radTopLeft, halfw) * nvg__signf(w),
               ryTL = nvg__minf(radTopLeft, halfh) * nvg__signf(h);
-        float vals[] = {NVG_MOVETO,
-                        x,
-                        y + ryTL,
-                        NVG_LINETO,
-                        x,
-                        y + h - ryBL,
-                        NVG_BEZIERTO,
-                        x,
-                        y + h - ryBL * (1 - NVG_KAPPA90),
-                        x + rxBL * (1 - NVG_KAPPA90),
-                        y + h,
-                        x + rxBL,
-                        y + h,
-                        NVG_LINETO,
-                        x + w - rxBR,
-                        y + h,
-                        NVG_BEZIERTO,
-                        x + w - rxBR * (1 - NVG_KAPPA90),
-                        y + h,
-                        x + w,
-                        y + h - ryBR * (1 - NVG_KAPPA90),
-                        x + w,
-                        y + h - ryBR,
-                        NVG_LINETO,
-                        x + w,
-                        y + ryTR,
-                        NVG_BEZIERTO,
-                        x + w,
-                        y + ryTR * (1 - NVG_KAPPA90),
-                        x + w - rxTR * (1 - NVG_KAPPA90),
-                        y,
-                        x + w - rxTR,
-                        y,
-                        NVG_LINETO,
-                        x + rxTL,
-                        y,
-                        NVG_BEZIERTO,
-                        x + rxTL * (1 - NVG_KAPPA90),
-                        y,
-                        x,
-                        y + ryTL * (1 - NVG_KAPPA90),
-                        x,
-                        y + ryTL,
-                        NVG_CLOSE};
-        nvg__appendCommands(ctx, vals, NVG_COUNTOF(vals));
+        unsigned char cmds[] = {NVG_MOVETO,   NVG_LINETO,   NVG_BEZIERTO,
+                                NVG_LINETO,   NVG_BEZIERTO, NVG_LINETO,
+                                NVG_BEZIERTO, NVG_LINETO,   NVG_BEZIERTO,
+                                NVG_CLOSE};
+        float pts[] = {x,
+                       y + ryTL,
+                       x,
+                       y + h - ryBL,
+                       x,
+                       y + h - ryBL * (1 - NVG_KAPPA90),
+                       x + rxBL * (1 - NVG_KAPPA90),
+                       y + h,
+                       x + rxBL,
+                       y + h,
+                       x + w - rxBR,
+                       y + h,
+                       x + w - rxBR * (1 - NVG_KAPPA90),
+                       y + h,
+                       x + w,
+                       y + h - ryBR * (1 - NVG_KAPPA90),
+                       x + w,
+                       y + h - ryBR,
+                       x + w,
+                       y + ryTR,
+                       x + w,
+                       y + ryTR * (1 - NVG_KAPPA90),
+                       x + w - rxTR * (1 - NVG_KAPPA90),
+                       y,
+                       x + w - rxTR,
+                       y,
+                       x + rxTL,
+                       y,
+                       x + rxTL * (1 - NVG_KAPPA90),
+                       y,
+                       x,
+                       y + ryTL * (1 - NVG_KAPPA90),
+                       x,
+                       y + ryTL};
+        int start = ctx->ncommands;
+        nvg__appendCommands(ctx, cmds, NVG_COUNTOF(cmds), pts,
+                            NVG_COUNTOF(pts) / 2);
+        // Only circular corners of equal size can be described by the SDF.
+        if (radTopLeft == radTopRight && radTopLeft == radBottomRight &&
+            radTopLeft == radBottomLeft && rxTL * rxTL == ryTL * ryTL)
+            nvg__setShape(ctx, start, x, y, w, h, nvg__absf(rxTL));
+        else
+            ctx->shape.end = 0;
     }
 }
 
 void nvgEllipse(NVGcontext* ctx, float cx, float cy, float rx, float ry) {
-    float vals[] = {NVG_MOVETO,
-                    cx - rx,
-                    cy,
-                    NVG_BEZIERTO,
-                    cx - rx,
-                    cy + ry * NVG_KAPPA90,
-                    cx - rx * NVG_KAPPA90,
-                    cy + ry,
-                    cx,
-                    cy + ry,
-                    NVG_BEZIERTO,
-                    cx + rx * NVG_KAPPA90,
-                    cy + ry,
-                    cx + rx,
-                    cy + ry * NVG_KAPPA90,
-                    cx + rx,
-                    cy,
-                    NVG_BEZIERTO,
-                    cx + rx,
-                    cy - ry * NVG_KAPPA90,
-                    cx + rx * NVG_KAPPA90,
-                    cy - ry,
-                    cx,
-                    cy - ry,
-                    NVG_BEZIERTO,
-                    cx - rx * NVG_KAPPA90,
-                    cy - ry,
-                    cx - rx,
-                    cy - ry * NVG_KAPPA90,
-                    cx - rx,
-                    cy,
-                    NVG_CLOSE};
-    nvg__appendCommands(ctx, vals, NVG_COUNTOF(vals));
+    unsigned char cmds[] = {NVG_MOVETO,   NVG_BEZIERTO, NVG_BEZIERTO,
+                            NVG_BEZIERTO, NVG_BEZIERTO, NVG_CLOSE};
+    float pts[] = {cx - rx,
+                   cy,
+                   cx - rx,
+                   cy + ry * NVG_KAPPA90,
+                   cx - rx * NVG_KAPPA90,
+                   cy + ry,
+                   cx,
+                   cy + ry,
+                   cx + rx * NVG_KAPPA90,
+                   cy + ry,
+                   cx + rx,
+                   cy + ry * NVG_KAPPA90,
+                   cx + rx,
+                   cy,
+                   cx + rx,
+                   cy - ry * NVG_KAPPA90,
+                   cx + rx * NVG_KAPPA90,
+                   cy - ry,
+                   cx,
+                   cy - ry,
+                   cx - rx * NVG_KAPPA90,
+                   cy - ry,
+                   cx - rx,
+                   cy - ry * NVG_KAPPA90,
+                   cx - rx,
+                   cy};
+    int start = ctx->ncommands;
+    nvg__appendCommands(ctx, cmds, NVG_COUNTOF(cmds), pts,
+                        NVG_COUNTOF(pts) / 2);
+    if (rx == ry && rx > 0.0f)
+        nvg__setShape(ctx, start, cx - rx, cy - ry, rx * 2, ry * 2, rx);
+    else
+        ctx->shape.end = 0;
 }
 
 void nvgCircle(NVGcontext* ctx, float cx, float cy, float r) {
@@ -2289,33 +3832,343 @@ void nvgDebugDumpPathCache(NVGcontext* ctx) {
     }
 }
 
+// Returns the visible area, the view intersected with the bounding box of
+// the current scissor, as min x,y and max x,y.
+static void nvg__visibleBounds(NVGcontext* ctx, float* bounds) {
+    const NVGscissor* scissor = &nvg__getState(ctx)->scissor;
+    bounds[0] = 0.0f;
+    bounds[1] = 0.0f;
+    bounds[2] = ctx->viewWidth;
+    bounds[3] = ctx->viewHeight;
+    if (scissor->extent[0] >= 0.0f && scissor->extent[1] >= 0.0f) {
+        const float* t = scissor->xform;
+        float hw = nvg__absf(t[0]) * scissor->extent[0] +
+                   nvg__absf(t[2]) * scissor->extent[1];
+        float hh = nvg__absf(t[1]) * scissor->extent[0] +
+                   nvg__absf(t[3]) * scissor->extent[1];
+        bounds[0] = nvg__maxf(bounds[0], t[4] - hw);
+        bounds[1] = nvg__maxf(bounds[1], t[5] - hh);
+        bounds[2] = nvg__minf(bounds[2], t[4] + hw);
+        bounds[3] = nvg__minf(bounds[3], t[5] + hh);
+    }
+}
+
+// Returns true if the bounds grown by pad do not touch the visible area.
+static int nvg__outsideBounds(const float* bounds, const float* visible,
+                              float pad) {
+    return bounds[0] - pad > visible[2] || bounds[2] + pad < visible[0] ||
+           bounds[1] - pad > visible[3] || bounds[3] + pad < visible[1];
+}
+
+// Returns true if the current path can not produce visible pixels when
+// drawn with pad of extra reach around its points.
+static int nvg__pathCulled(NVGcontext* ctx, float pad) {
+    float visible[4];
+    if (ctx->commandBounds[0] > ctx->commandBounds[2]) return 0;
+    nvg__visibleBounds(ctx, visible);
+    return nvg__outsideBounds(ctx->commandBounds, visible, pad);
+}
+
+// Returns the scale of a transform which has no skew or non-uniform scale, so
+// that distances map uniformly to pixels, or 0 otherwise.
+static float nvg__uniformScale(const float* t) {
+    float scale = nvg__sqrtf(t[0] * t[0] + t[1] * t[1]);
+    if (scale < 1e-6f) return 0.0f;
+    if (nvg__absf(t[0] - t[3]) > scale * 1e-4f ||
+        nvg__absf(t[1] + t[2]) > scale * 1e-4f)
+        return 0.0f;
+    return scale;
+}
+
+// Returns the premultiplied color of a solid paint and turns the paint white,
+// or returns white for other paints. Instances carry the color, so that runs
+// of solid shapes in different colors can share one draw call. The cached
+// inverse of a paint turned white no longer applies and is set to NULL.
+static NVGcolor nvg__takeSolidColor(NVGpaint* paint, NVGinverse** inverse) {
+    NVGcolor c = paint->innerColor;
+    if (paint->image != 0 ||
+        memcmp(&paint->innerColor, &paint->outerColor, sizeof(NVGcolor)) != 0)
+        return nvgRGBAf(1.0f, 1.0f, 1.0f, 1.0f);
+    nvg__setPaintColor(paint, nvgRGBAf(1.0f, 1.0f, 1.0f, 1.0f));
+    *inverse = NULL;
+    return nvgRGBAf(c.r * c.a, c.g * c.a, c.b * c.a, c.a);
+}
+
+// Draws the current path as one instanced quad whose coverage is computed
+// from a signed distance function by the renderer. Only done when the path is
+// a single rectangle, rounded rectangle or circle and its transform has no
+// skew or non-uniform scale.
+static int nvg__fillShape(NVGcontext* ctx, NVGpaint* paint,
+                          NVGinverse* inverse, float w) {
+    NVGstate* state = nvg__getState(ctx);
+    const NVGshape* shape = &ctx->shape;
+    const float* t = shape->xform;
+    NVGinstance* it;
+    float scale;
+
+    if (shape->end == 0 || shape->end != ctx->ncommands) return 0;
+    scale = nvg__uniformScale(t);
+    if (scale == 0.0f) return 0;
+    if (shape->hw <= 0.0f || shape->hh <= 0.0f) return 0;
+
+    it = ctx->params.reserveInstances(1);
+    if (it == NULL) return 0;
+    nvgTransformPoint(&it->x, &it->y, t, shape->cx, shape->cy);
+    it->ux = t[0] / scale;
+    it->uy = t[1] / scale;
+    it->ex = shape->hw * scale;
+    it->ey = shape->hh * scale;
+    it->radius = shape->radius * scale;
+    it->fringe = w > 0.0f ? w : 0.001f;  // Practically a hard edge without AA.
+    it->color = nvg__takeSolidColor(paint, &inverse);
+
+    ctx->params.callInstances(paint, state->compositeOperation,
+                              &state->scissor, ctx->fringeWidth, 1, inverse,
+                              &state->scissorInverse);
+
+    ctx->fillTriCount += 2;
+    ctx->drawCallCount++;
+    return 1;
+}
+
+static void nvg__countFill(NVGcontext* ctx, const NVGpath* paths, int npaths) {
+    int i;
+    for (i = 0; i < npaths; i++) {
+        const NVGpath* path = &paths[i];
+        ctx->fillTriCount +=
+            path->triangulated ? path->nfill / 3 : path->nfill - 2;
+        ctx->fillTriCount += path->nstroke - 2;
+        ctx->drawCallCount += 2;
+    }
+}
+
+static void nvg__countStroke(NVGcontext* ctx, const NVGpath* paths,
+                             int npaths) {
+    int i;
+    for (i = 0; i < npaths; i++) {
+        ctx->strokeTriCount += paths[i].nstroke - 2;
+        ctx->drawCallCount++;
+    }
+}
+
+// Records the current path for nvg__flushTessellation() and reserves its
+// draw call. Returns NULL if the frame memory is exhausted, in which case the
+// path is tessellated right away.
+static NVGtessJob* nvg__deferTessellation(NVGcontext* ctx, int type,
+                                          const NVGpaint* paint,
+                                          const NVGinverse* paintInverse,
+                                          const NVGgeomKey* key,
+                                          unsigned int hash) {
+    NVGstate* state = nvg__getState(ctx);
+    size_t ptsSize = sizeof(float) * 2 * ctx->ncommandPts;
+    unsigned char* mem;
+    NVGtessJob* job;
+    int call;
+
+    // The pool may be there for NVG_ASYNC_GLYPHS only.
+    if ((ctx->params._flags & NVG_DEFERRED_TESSELLATION) == 0) return NULL;
+    if (ctx->tessJobs == NULL || ctx->ntessJobs + 1 > ctx->ctessJobs) {
+        NVGtessJob* jobs = (NVGtessJob*)nvg__frameGrow(
+            &ctx->allocator, ctx->tessJobs, &ctx->ctessJobs,
+            ctx->ntessJobs + 1, 0, sizeof(NVGtessJob));
+        if (jobs == NULL) return NULL;
+        ctx->tessJobs = jobs;
+    }
+    mem = (unsigned char*)ctx->allocator.reallocate(
+        ctx->allocator.userPtr, NULL, 0, ptsSize + ctx->ncommands);
+    if (mem == NULL) return NULL;
+    call = ctx->params.deferCall();
+    if (call == -1) return NULL;
+
+    job = &ctx->tessJobs[ctx->ntessJobs++];
+    memset(job, 0, sizeof(*job));
+    job->type = type;
+    job->call = call;
+    job->commandPts = (float*)mem;
+    job->ncommandPts = ctx->ncommandPts;
+    if (ptsSize > 0) memcpy(job->commandPts, ctx->commandPts, ptsSize);
+    job->commands = mem + ptsSize;
+    job->ncommands = ctx->ncommands;
+    if (ctx->ncommands > 0)
+        memcpy(job->commands, ctx->commands, ctx->ncommands);
+    job->paint = *paint;
+    job->paintInverse = *paintInverse;
+    job->compositeOperation = state->compositeOperation;
+    job->scissor = state->scissor;
+    job->scissorInverse = state->scissorInverse;
+    if (key != NULL) {
+        job->cacheInsert = 1;
+        job->hash = hash;
+        job->key = *key;
+    }
+    return job;
+}
+
 void nvgFill(NVGcontext* ctx) {
     NVGstate* state = nvg__getState(ctx);
-    const NVGpath* path;
+    const NVGpath* paths;
+    const float* bounds;
     NVGpaint fillPaint = state->fill;
-    int i;
+    NVGgeomEntry* entry = NULL;
+    NVGtessJob* job;
+    NVGgeomKey key;
+    unsigned int hash = 0;
+    int npaths;
+    float w = 0.0f;
 
-    nvg__flattenPaths(ctx);
     if (ctx->params.edgeAntiAlias && state->shapeAntiAlias)
-        nvg__expandFill(ctx, ctx->fringeWidth, NVG_MITER, 2.4f);
-    else
-        nvg__expandFill(ctx, 0.0f, NVG_MITER, 2.4f);
+        w = ctx->fringeWidth;
+
+    if (nvg__pathCulled(ctx, w)) {
+        ctx->culledFillCount++;
+        return;
+    }
 
     // Apply global alpha
     fillPaint.innerColor.a *= state->alpha;
     fillPaint.outerColor.a *= state->alpha;
 
+    if (nvg__fillShape(ctx, &fillPaint, &state->fillInverse, w)) return;
+
+    if (ctx->geomCache != NULL) {
+        memset(&key, 0, sizeof(key));
+        key.type = NVG_GEOM_FILL;
+        key.lineJoin = NVG_MITER;
+        key.width = w;
+        key.fringe = w;
+        key.miterLimit = 2.4f;
+        key.tessTol = ctx->tessTol;
+        hash = nvg__geomHash(ctx, &key);
+        entry = nvg__geomFind(ctx, hash, &key);
+    }
+
+    if (entry != NULL) {
+        paths = entry->paths;
+        npaths = entry->npaths;
+        bounds = entry->bounds;
+    } else if (ctx->tessPool != NULL &&
+               (job = nvg__deferTessellation(
+                    ctx, NVG_GEOM_FILL, &fillPaint, &state->fillInverse,
+                    ctx->geomCache != NULL ? &key : NULL, hash)) != NULL) {
+        job->width = w;
+        job->fringe = w;
+        return;
+    } else {
+        nvg__flattenPaths(ctx);
+        nvg__expandFill(ctx, w, NVG_MITER, 2.4f);
+        if (ctx->geomCache != NULL) nvg__geomInsert(ctx, hash, &key);
+        paths = ctx->cache->paths;
+        npaths = ctx->cache->npaths;
+        bounds = ctx->cache->bounds;
+    }
+
     ctx->params.callFill(&fillPaint, state->compositeOperation, &state->scissor,
-                         ctx->fringeWidth, ctx->cache->bounds,
-                         ctx->cache->paths, ctx->cache->npaths);
+                         ctx->fringeWidth, bounds, paths, npaths,
+                         &state->fillInverse, &state->scissorInverse);
+    nvg__countFill(ctx, paths, npaths);
+}
 
-    // Count triangles
-    for (i = 0; i < ctx->cache->npaths; i++) {
-        path = &ctx->cache->paths[i];
-        ctx->fillTriCount += path->nfill - 2;
-        ctx->fillTriCount += path->nstroke - 2;
-        ctx->drawCallCount += 2;
+void nvgRects(NVGcontext* ctx, const float* rects, const NVGcolor* colors,
+              int n) {
+    nvgRoundedRects(ctx, rects, NULL, colors, n);
+}
+
+void nvgRoundedRects(NVGcontext* ctx, const float* rects, const float* radii,
+                     const NVGcolor* colors, int n) {
+    NVGstate* state = nvg__getState(ctx);
+    const float* t = state->xform;
+    float scale = nvg__uniformScale(t);
+    NVGpaint paint = state->fill;
+    NVGinverse fillInverse = state->fillInverse;
+    NVGinverse* inverse = &state->fillInverse;
+    NVGinstance* inst;
+    NVGcolor color;
+    float w = 0.0f, ux, uy, visible[4];
+    int i, ninst = 0;
+
+    nvgBeginPath(ctx);
+    if (n <= 0) return;
+
+    if (scale == 0.0f) {
+        // The instances can not describe skewed rectangles, fill them one
+        // by one instead.
+        for (i = 0; i < n; i++) {
+            const float* r = &rects[i * 4];
+            if (colors != NULL) {
+                nvg__setPaintColor(&state->fill, colors[i]);
+                state->fillInverse.valid = 0;
+            }
+            nvgBeginPath(ctx);
+            nvgRoundedRect(ctx, r[0], r[1], r[2], r[3],
+                           radii != NULL ? radii[i] : 0.0f);
+            nvgFill(ctx);
+        }
+        state->fill = paint;
+        state->fillInverse = fillInverse;
+        nvgBeginPath(ctx);
+        return;
+    }
+
+    inst = ctx->params.reserveInstances(n);
+    if (inst == NULL) return;
+
+    if (ctx->params.edgeAntiAlias && state->shapeAntiAlias)
+        w = ctx->fringeWidth;
+    ux = t[0] / scale;
+    uy = t[1] / scale;
+
+    // Per instance colors replace the paint, global alpha goes to the
+    // instances as well.
+    paint.innerColor.a *= state->alpha;
+    paint.outerColor.a *= state->alpha;
+    if (colors != NULL) {
+        nvg__setPaintColor(&paint, nvgRGBAf(1.0f, 1.0f, 1.0f, 1.0f));
+        inverse = NULL;
     }
+    color = nvg__takeSolidColor(&paint, &inverse);
+
+    nvg__visibleBounds(ctx, visible);
+    for (i = 0; i < n; i++) {
+        const float* r = &rects[i * 4];
+        float hw = nvg__absf(r[2]) * 0.5f, hh = nvg__absf(r[3]) * 0.5f;
+        float cx, cy, ib[4], reach;
+        NVGinstance* it;
+        if (hw <= 0.0f || hh <= 0.0f) continue;
+        nvgTransformPoint(&cx, &cy, t, r[0] + r[2] * 0.5f, r[1] + r[3] * 0.5f);
+        // Bounding circle of the rectangle.
+        reach = nvg__sqrtf(hw * hw + hh * hh) * scale + w;
+        ib[0] = ib[2] = cx;
+        ib[1] = ib[3] = cy;
+        if (nvg__outsideBounds(ib, visible, reach)) {
+            ctx->culledInstanceCount++;
+            continue;
+        }
+        it = &inst[ninst++];
+        it->x = cx;
+        it->y = cy;
+        it->ux = ux;
+        it->uy = uy;
+        it->ex = hw * scale;
+        it->ey = hh * scale;
+        it->radius = 0.0f;
+        if (radii != NULL)
+            it->radius = nvg__clampf(radii[i], 0.0f, nvg__minf(hw, hh)) * scale;
+        it->fringe = w > 0.0f ? w : 0.001f;
+        it->color = color;
+        if (colors != NULL) {
+            NVGcolor c = colors[i];
+            float a = c.a * state->alpha;
+            it->color = nvgRGBAf(c.r * a, c.g * a, c.b * a, a);
+        }
+    }
+    if (ninst == 0) return;
+
+    ctx->params.callInstances(&paint, state->compositeOperation,
+                              &state->scissor, ctx->fringeWidth, ninst,
+                              inverse, &state->scissorInverse);
+
+    ctx->fillTriCount += ninst * 2;
+    ctx->drawCallCount++;
 }
 
 void nvgStroke(NVGcontext* ctx) {
@@ -2323,8 +4176,13 @@ void nvgStroke(NVGcontext* ctx) {
     float scale = nvg__getAverageScale(state->xform);
     float strokeWidth = nvg__clampf(state->strokeWidth * scale, 0.0f, 200.0f);
     NVGpaint strokePaint = state->stroke;
-    const NVGpath* path;
-    int i;
+    const NVGpath* paths;
+    NVGgeomEntry* entry = NULL;
+    NVGtessJob* job;
+    NVGgeomKey key;
+    unsigned int hash = 0;
+    int npaths;
+    float fringe = 0.0f, reach;
 
     if (strokeWidth < ctx->fringeWidth) {
         // If the stroke width is less than pixel size, use alpha to emulate
@@ -2339,56 +4197,209 @@ void nvgStroke(NVGcontext* ctx) {
     strokePaint.innerColor.a *= state->alpha;
     strokePaint.outerColor.a *= state->alpha;
 
-    nvg__flattenPaths(ctx);
-
     if (ctx->params.edgeAntiAlias && state->shapeAntiAlias)
-        nvg__expandStroke(ctx, strokeWidth * 0.5f, ctx->fringeWidth,
-                          state->lineCap, state->lineJoin, state->miterLimit);
-    else
-        nvg__expandStroke(ctx, strokeWidth * 0.5f, 0.0f, state->lineCap,
+        fringe = ctx->fringeWidth;
+
+    // Miter joins reach up to miterLimit half widths from the path, square
+    // caps sqrt(2) half widths.
+    reach = strokeWidth * 0.5f * nvg__maxf(state->miterLimit, 1.5f) + fringe;
+    if (nvg__pathCulled(ctx, reach)) {
+        ctx->culledStrokeCount++;
+        return;
+    }
+
+    if (ctx->geomCache != NULL) {
+        memset(&key, 0, sizeof(key));
+        key.type = NVG_GEOM_STROKE;
+        key.lineJoin = state->lineJoin;
+        key.lineCap = state->lineCap;
+        key.width = strokeWidth * 0.5f;
+        key.fringe = fringe;
+        key.miterLimit = state->miterLimit;
+        key.tessTol = ctx->tessTol;
+        hash = nvg__geomHash(ctx, &key);
+        entry = nvg__geomFind(ctx, hash, &key);
+    }
+
+    if (entry != NULL) {
+        paths = entry->paths;
+        npaths = entry->npaths;
+    } else if (ctx->tessPool != NULL &&
+               (job = nvg__deferTessellation(
+                    ctx, NVG_GEOM_STROKE, &strokePaint, &state->strokeInverse,
+                    ctx->geomCache != NULL ? &key : NULL, hash)) != NULL) {
+        job->width = strokeWidth;
+        job->fringe = fringe;
+        job->lineCap = state->lineCap;
+        job->lineJoin = state->lineJoin;
+        job->miterLimit = state->miterLimit;
+        return;
+    } else {
+        nvg__flattenPaths(ctx);
+        nvg__expandStroke(ctx, strokeWidth * 0.5f, fringe, state->lineCap,
                           state->lineJoin, state->miterLimit);
+        if (ctx->geomCache != NULL) nvg__geomInsert(ctx, hash, &key);
+        paths = ctx->cache->paths;
+        npaths = ctx->cache->npaths;
+    }
 
     ctx->params.callStroke(&strokePaint, state->compositeOperation,
                            &state->scissor, ctx->fringeWidth, strokeWidth,
-                           ctx->cache->paths, ctx->cache->npaths);
+                           paths, npaths, &state->strokeInverse,
+                           &state->scissorInverse);
+    nvg__countStroke(ctx, paths, npaths);
+}
+
+// Tessellates a deferred fill or stroke with the context of the worker.
+static void nvg__tessellateJob(void* userPtr, int worker, int index) {
+    NVGcontext* ctx = (NVGcontext*)userPtr;
+    NVGtessPool* pool = ctx->tessPool;
+    NVGcontext* wctx = pool->workers[worker];
+    NVGpathCache* cache = wctx->cache;
+    NVGtessJob* job = &ctx->tessJobs[index];
+    int i;
 
-    // Count triangles
-    for (i = 0; i < ctx->cache->npaths; i++) {
-        path = &ctx->cache->paths[i];
-        ctx->strokeTriCount += path->nstroke - 2;
-        ctx->drawCallCount++;
+    wctx->commands = job->commands;
+    wctx->ncommands = job->ncommands;
+    wctx->commandPts = job->commandPts;
+    wctx->ncommandPts = job->ncommandPts;
+    nvg__clearPathCache(wctx);
+    nvg__flattenPaths(wctx);
+    if (job->type == NVG_GEOM_FILL)
+        nvg__expandFill(wctx, job->width, NVG_MITER, 2.4f);
+    else
+        nvg__expandStroke(wctx, job->width * 0.5f, job->fringe, job->lineCap,
+                          job->lineJoin, job->miterLimit);
+    if (job->cacheInsert) {
+        std::lock_guard<std::mutex> lock(pool->geomMutex);
+        nvg__geomInsert(wctx, job->hash, &job->key);
+    }
+
+    // The path cache is reused by the next job of the worker.
+    job->paths = (NVGpath*)wctx->allocator.reallocate(
+        wctx->allocator.userPtr, NULL, 0, sizeof(NVGpath) * cache->npaths);
+    if (job->paths == NULL) return;
+    memcpy(job->paths, cache->paths, sizeof(NVGpath) * cache->npaths);
+    job->npaths = cache->npaths;
+    memcpy(job->bounds, cache->bounds, sizeof(job->bounds));
+    for (i = 0; i < job->npaths; i++)
+        job->nverts += job->paths[i].nfill + job->paths[i].nstroke;
+}
+
+// Copies the vertices of a tessellated job to its range of the frame vertex
+// buffer.
+static void nvg__placeJob(void* userPtr, int worker, int index) {
+    NVGtessJob* job = &((NVGcontext*)userPtr)->tessJobs[index];
+    NVGvertex* dst = job->verts;
+    int i;
+    NVG_NOTUSED(worker);
+    for (i = 0; i < job->npaths; i++) {
+        NVGpath* path = &job->paths[i];
+        if (path->nfill > 0) {
+            memcpy(dst, path->fill, sizeof(NVGvertex) * path->nfill);
+            path->fill = dst;
+            dst += path->nfill;
+        }
+        if (path->nstroke > 0) {
+            memcpy(dst, path->stroke, sizeof(NVGvertex) * path->nstroke);
+            path->stroke = dst;
+            dst += path->nstroke;
+        }
+    }
+}
+
+// Tessellates the fills and strokes deferred by NVG_DEFERRED_TESSELLATION on
+// the tessellation threads, and records their draw calls in the places
+// reserved for them.
+static void nvg__flushTessellation(NVGcontext* ctx) {
+    NVGtessPool* pool = ctx->tessPool;
+    NVGvertex* verts;
+    int i, nverts = 0, extra = 0;
+
+    if (pool == NULL || ctx->ntessJobs == 0) return;
+
+    for (i = 0; i < pool->nworkers; i++) {
+        nvg__resetFrameMemory(pool->workers[i]);
+        nvg__setDevicePixelRatio(pool->workers[i], ctx->devicePxRatio);
+    }
+    nvg__runJobs(pool, ctx->ntessJobs, nvg__tessellateJob, ctx);
+
+    // Reserve the vertices of the jobs in submission order, with room for
+    // the cover quads of the fills, so that the vertex buffer stays put
+    // while the calls are recorded.
+    for (i = 0; i < ctx->ntessJobs; i++) {
+        nverts += ctx->tessJobs[i].nverts;
+        if (ctx->tessJobs[i].type == NVG_GEOM_FILL) extra += 4;
+    }
+    verts = ctx->params.allocVerts(nverts, extra);
+    if (verts != NULL) {
+        for (i = 0; i < ctx->ntessJobs; i++) {
+            ctx->tessJobs[i].verts = verts;
+            verts += ctx->tessJobs[i].nverts;
+        }
+        nvg__runJobs(pool, ctx->ntessJobs, nvg__placeJob, ctx);
+
+        for (i = 0; i < ctx->ntessJobs; i++) {
+            NVGtessJob* job = &ctx->tessJobs[i];
+            if (job->npaths == 0) continue;
+            ctx->params.resumeCall(job->call);
+            if (job->type == NVG_GEOM_FILL) {
+                ctx->params.callFill(&job->paint, job->compositeOperation,
+                                     &job->scissor, ctx->fringeWidth,
+                                     job->bounds, job->paths, job->npaths,
+                                     &job->paintInverse, &job->scissorInverse);
+                nvg__countFill(ctx, job->paths, job->npaths);
+            } else {
+                ctx->params.callStroke(&job->paint, job->compositeOperation,
+                                       &job->scissor, ctx->fringeWidth,
+                                       job->width, job->paths, job->npaths,
+                                       &job->paintInverse,
+                                       &job->scissorInverse);
+                nvg__countStroke(ctx, job->paths, job->npaths);
+            }
+        }
     }
+    ctx->params.compactCalls(ctx->tessJobs[0].call);
+    ctx->ntessJobs = 0;
 }
 
 // Add fonts
 int nvgCreateFont(NVGcontext* ctx, const char* name, const char* filename) {
+    NVGfontLock lock(ctx);
     return fonsAddFont(ctx->fs, name, filename, 0);
 }
 
 int nvgCreateFontAtIndex(NVGcontext* ctx, const char* name,
                          const char* filename, const int fontIndex) {
+    NVGfontLock lock(ctx);
     return fonsAddFont(ctx->fs, name, filename, fontIndex);
 }
 
 int nvgCreateFontMem(NVGcontext* ctx, const char* name, unsigned char* data,
                      int ndata, int freeData) {
+    NVGfontLock lock(ctx);
     return fonsAddFontMem(ctx->fs, name, data, ndata, freeData, 0);
 }
 
 int nvgCreateFontMemAtIndex(NVGcontext* ctx, const char* name,
                             unsigned char* data, int ndata, int freeData,
                             const int fontIndex) {
+    NVGfontLock lock(ctx);
     return fonsAddFontMem(ctx->fs, name, data, ndata, freeData, fontIndex);
 }
 
 int nvgFindFont(NVGcontext* ctx, const char* name) {
+    NVGfontLock lock(ctx);
     if (name == NULL) return -1;
     return fonsGetFontByName(ctx->fs, name);
 }
 
 int nvgAddFallbackFontId(NVGcontext* ctx, int baseFont, int fallbackFont) {
+    NVGfontLock lock(ctx);
     if (baseFont == -1 || fallbackFont == -1) return 0;
-    return fonsAddFallbackFont(ctx->fs, baseFont, fallbackFont);
+    if (!fonsAddFallbackFont(ctx->fs, baseFont, fallbackFont)) return 0;
+    nvg__fonts(ctx)->fontGeneration++;
+    return 1;
 }
 
 int nvgAddFallbackFont(NVGcontext* ctx, const char* baseFont,
@@ -2398,7 +4409,9 @@ int nvgAddFallbackFont(NVGcontext* ctx, const char* baseFont,
 }
 
 void nvgResetFallbackFontsId(NVGcontext* ctx, int baseFont) {
+    NVGfontLock lock(ctx);
     fonsResetFallbackFont(ctx->fs, baseFont);
+    nvg__fonts(ctx)->fontGeneration++;
 }
 
 void nvgResetFallbackFonts(NVGcontext* ctx, const char* baseFont) {
@@ -2407,37 +4420,38 @@ void nvgResetFallbackFonts(NVGcontext* ctx, const char* baseFont) {
 
 // State setting
 void nvgFontSize(NVGcontext* ctx, float size) {
-    NVGstate* state = nvg__getState(ctx);
+    NVGstate* state = nvg__writeState(ctx, NVG_STATE_TEXT);
     state->fontSize = size;
 }
 
 void nvgFontBlur(NVGcontext* ctx, float blur) {
-    NVGstate* state = nvg__getState(ctx);
+    NVGstate* state = nvg__writeState(ctx, NVG_STATE_TEXT);
     state->fontBlur = blur;
 }
 
 void nvgTextLetterSpacing(NVGcontext* ctx, float spacing) {
-    NVGstate* state = nvg__getState(ctx);
+    NVGstate* state = nvg__writeState(ctx, NVG_STATE_TEXT);
     state->letterSpacing = spacing;
 }
 
 void nvgTextLineHeight(NVGcontext* ctx, float lineHeight) {
-    NVGstate* state = nvg__getState(ctx);
+    NVGstate* state = nvg__writeState(ctx, NVG_STATE_TEXT);
     state->lineHeight = lineHeight;
 }
 
 void nvgTextAlign(NVGcontext* ctx, int align) {
-    NVGstate* state = nvg__getState(ctx);
+    NVGstate* state = nvg__writeState(ctx, NVG_STATE_TEXT);
     state->textAlign = align;
 }
 
 void nvgFontFaceId(NVGcontext* ctx, int font) {
-    NVGstate* state = nvg__getState(ctx);
+    NVGstate* state = nvg__writeState(ctx, NVG_STATE_TEXT);
     state->fontId = font;
 }
 
 void nvgFontFace(NVGcontext* ctx, const char* font) {
-    NVGstate* state = nvg__getState(ctx);
+    NVGfontLock lock(ctx);
+    NVGstate* state = nvg__writeState(ctx, NVG_STATE_TEXT);
     state->fontId = fonsGetFontByName(ctx->fs, font);
 }
 
@@ -2453,59 +4467,67 @@ static float nvg__getFontScale(NVGstate* state) {
 static void nvg__flushTextTexture(NVGcontext* ctx) {
     int dirty[4];
 
-    if (fonsValidateTexture(ctx->fs, dirty)) {
-        int fontImage = ctx->fontImages[ctx->fontImageIdx];
+    // Textures are updated on the thread of the owner, in nvgGetDrawData().
+    if (ctx->fontOwner != NULL) return;
+    int npages = fonsGetPageCount(ctx->fs);
+    for (int i = 0; i < npages && i < NVG_MAX_FONTIMAGES; i++) {
+        int iw, ih;
+        const unsigned char* data = fonsGetPageData(ctx->fs, i, &iw, &ih);
+        if (ctx->fontImages[i] == 0) {
+            ctx->fontImages[i] = ctx->params.renderCreateTexture(
+                &ctx->params, NVG_TEXTURE_ALPHA, iw, ih,
+                nvg__fontImageFlags(ctx), NULL);
+        }
+        if (!fonsValidatePage(ctx->fs, i, dirty)) continue;
         // Update texture
-        if (fontImage != 0) {
-            int iw, ih;
-            const unsigned char* data = fonsGetTextureData(ctx->fs, &iw, &ih);
+        if (ctx->fontImages[i] != 0) {
             int x = dirty[0];
             int y = dirty[1];
             int w = dirty[2] - dirty[0];
             int h = dirty[3] - dirty[1];
-            ctx->params.renderUpdateTexture(&ctx->params, fontImage, x, y, w, h,
-                                            data);
+            ctx->params.renderUpdateTexture(&ctx->params, ctx->fontImages[i],
+                                            x, y, w, h, data);
         }
     }
 }
 
-static int nvg__allocTextAtlas(NVGcontext* ctx) {
-    int iw, ih;
-    nvg__flushTextTexture(ctx);
-    if (ctx->fontImageIdx >= NVG_MAX_FONTIMAGES - 1) return 0;
-    // if next fontImage already have a texture
-    if (ctx->fontImages[ctx->fontImageIdx + 1] != 0)
-        nvgImageSize(ctx, ctx->fontImages[ctx->fontImageIdx + 1], &iw, &ih);
-    else {  // calculate the new font image size and create it.
-        nvgImageSize(ctx, ctx->fontImages[ctx->fontImageIdx], &iw, &ih);
-        if (iw > ih)
-            ih *= 2;
-        else
-            iw *= 2;
-        if (iw > NVG_MAX_FONTIMAGE_SIZE || ih > NVG_MAX_FONTIMAGE_SIZE)
-            iw = ih = NVG_MAX_FONTIMAGE_SIZE;
-        ctx->fontImages[ctx->fontImageIdx + 1] =
-            ctx->params.renderCreateTexture(&ctx->params, NVG_TEXTURE_ALPHA, iw,
-                                            ih, 0, NULL);
-    }
-    ++ctx->fontImageIdx;
-    fonsResetAtlas(ctx->fs, iw, ih);
-    return 1;
+// Limits the atlas pages glyphs may be added to. A recorder cannot create
+// textures, so it is held to the pages which have one.
+static void nvg__limitTextAtlas(NVGcontext* ctx) {
+    if (ctx->fontOwner != NULL)
+        fonsSetMaxPages(ctx->fs, fonsGetPageCount(ctx->fs));
+    else
+        fonsSetMaxPages(ctx->fs, ctx->maxFontPages);
+}
+
+// Called when a glyph did not fit any page which is not in use this frame.
+static void nvg__textAtlasFull(NVGcontext* ctx) {
+    // Left to the owner, the missing glyphs appear next frame.
+    if (ctx->fontOwner != NULL) ctx->fontOwner->atlasFull = 1;
 }
 
-static void nvg__renderText(NVGcontext* ctx, NVGvertex* verts, int nverts) {
+static void nvg__renderText(NVGcontext* ctx, NVGvertex* verts, int nverts,
+                            int page) {
     NVGstate* state = nvg__getState(ctx);
     NVGpaint paint = state->fill;
+    NVGcontext* fonts = nvg__fonts(ctx);
 
     // Render triangles.
-    paint.image = ctx->fontImages[ctx->fontImageIdx];
+    paint.image = fonts->fontImages[page];
+    if (fonsGetFlags(fonts->fs) & FONS_SDF_GLYPHS) {
+        // The blur in distance field units, which change by 0.5 over
+        // FONS_SDF_PADDING pixels at FONS_SDF_SIZE.
+        paint.feather = state->fontBlur * FONS_SDF_SIZE * 0.5f /
+                        (state->fontSize * FONS_SDF_PADDING);
+    }
 
     // Apply global alpha
     paint.innerColor.a *= state->alpha;
     paint.outerColor.a *= state->alpha;
 
     ctx->params.callTriangles(&paint, state->compositeOperation,
-                              &state->scissor, verts, nverts, ctx->fringeWidth);
+                              &state->scissor, verts, nverts, ctx->fringeWidth,
+                              &state->fillInverse, &state->scissorInverse);
 
     ctx->drawCallCount++;
     ctx->textTriCount += nverts / 3;
@@ -2516,17 +4538,366 @@ static int nvg__isTransformFlipped(const float* xform) {
     return (det < 0);
 }
 
+static unsigned int nvg__textHash(const NVGtextKey* key, const char* string,
+                                  int nstring) {
+    unsigned int h = nvg__hashBytes(2166136261u, (const unsigned char*)string,
+                                    nstring);
+    h = nvg__hashWords(h, key, sizeof(NVGtextKey) / 4);
+    return nvg__hashFinish(h);
+}
+
+static void nvg__textUnlink(NVGtextCache* tc, NVGtextEntry* entry) {
+    if (entry->lruPrev != NULL)
+        entry->lruPrev->lruNext = entry->lruNext;
+    else
+        tc->lruHead = entry->lruNext;
+    if (entry->lruNext != NULL)
+        entry->lruNext->lruPrev = entry->lruPrev;
+    else
+        tc->lruTail = entry->lruPrev;
+    entry->lruPrev = entry->lruNext = NULL;
+}
+
+static void nvg__textPushFront(NVGtextCache* tc, NVGtextEntry* entry) {
+    entry->lruPrev = NULL;
+    entry->lruNext = tc->lruHead;
+    if (tc->lruHead != NULL) tc->lruHead->lruPrev = entry;
+    tc->lruHead = entry;
+    if (tc->lruTail == NULL) tc->lruTail = entry;
+}
+
+static void nvg__textEvict(NVGtextCache* tc, NVGtextEntry* entry) {
+    NVGtextEntry** link = &tc->lut[entry->hash & (NVG_TEXTCACHE_LUT_SIZE - 1)];
+    while (*link != NULL && *link != entry) link = &(*link)->next;
+    if (*link != NULL) *link = entry->next;
+    nvg__textUnlink(tc, entry);
+    tc->bytes -= entry->size;
+    tc->nentries--;
+    tc->evictions++;
+    free(entry);
+}
+
+static void nvg__textTrim(NVGtextCache* tc, int budget) {
+    while (tc->lruTail != NULL && tc->bytes > budget)
+        nvg__textEvict(tc, tc->lruTail);
+}
+
+// Returns 1 if none of the atlas pages of the entry were emptied since its
+// glyphs were laid out.
+static int nvg__textPagesValid(FONScontext* fs, const NVGtextEntry* entry) {
+    unsigned int pages = entry->pages;
+    for (int p = 0; pages != 0; p++, pages >>= 1) {
+        if ((pages & 1) != 0 &&
+            fonsGetPageGeneration(fs, p) > entry->atlasGeneration)
+            return 0;
+    }
+    return 1;
+}
+
+// Layouts of an older font generation, or with glyphs on a page emptied
+// since, are evicted when they are found.
+static NVGtextEntry* nvg__textFind(NVGtextCache* tc, FONScontext* fs,
+                                   unsigned int hash, const NVGtextKey* key,
+                                   const char* string, int nstring,
+                                   int fontGeneration) {
+    NVGtextEntry* entry = tc->lut[hash & (NVG_TEXTCACHE_LUT_SIZE - 1)];
+    while (entry != NULL) {
+        if (entry->hash == hash && entry->nstring == nstring &&
+            memcmp(&entry->key, key, sizeof(NVGtextKey)) == 0 &&
+            memcmp(entry->string, string, nstring) == 0) {
+            if (entry->fontGeneration != fontGeneration ||
+                !nvg__textPagesValid(fs, entry)) {
+                nvg__textEvict(tc, entry);
+                break;
+            }
+            nvg__textUnlink(tc, entry);
+            nvg__textPushFront(tc, entry);
+            tc->hits++;
+            return entry;
+        }
+        entry = entry->next;
+    }
+    tc->misses++;
+    return NULL;
+}
+
+// Stores a layout the second time it is seen, so that strings which change
+// every frame do not flush the cache.
+static void nvg__textInsert(NVGtextCache* tc, unsigned int hash,
+                            const NVGtextKey* key, const char* string,
+                            int nstring, int fontGeneration,
+                            int atlasGeneration,
+                            const NVGtextLayout* layout) {
+    NVGtextEntry* entry;
+    unsigned int bit = hash & (NVG_TEXTCACHE_SEEN_SIZE * 32 - 1);
+    unsigned int* seen = &tc->seen[bit >> 5];
+    int n = layout->nquads, size;
+
+    if ((*seen & (1u << (bit & 31))) == 0) {
+        // Forget the strings seen once when a quarter of the bits are set.
+        if (++tc->nseen > NVG_TEXTCACHE_SEEN_SIZE * 8) {
+            memset(tc->seen, 0, sizeof(tc->seen));
+            tc->nseen = 1;
+        }
+        *seen |= 1u << (bit & 31);
+        return;
+    }
+
+    size = (int)(sizeof(NVGtextEntry) + sizeof(float) * 12 * n +
+                 sizeof(int) * n + nstring);
+    if (size > tc->budget) return;
+    nvg__textTrim(tc, tc->budget - size);
+
+    entry = (NVGtextEntry*)malloc(size);
+    if (entry == NULL) return;
+    memset(entry, 0, sizeof(NVGtextEntry));
+    entry->hash = hash;
+    entry->key = *key;
+    entry->fontGeneration = fontGeneration;
+    entry->atlasGeneration = atlasGeneration;
+    for (int i = 0; i < n; i++) entry->pages |= 1u << layout->pages[i];
+    entry->size = size;
+    entry->layout.pts = (float*)(entry + 1);
+    entry->layout.uvs = entry->layout.pts + n * 8;
+    entry->layout.pages = (int*)(entry->layout.uvs + n * 4);
+    entry->layout.nquads = n;
+    entry->layout.nextx = layout->nextx;
+    if (n > 0) {
+        memcpy(entry->layout.pts, layout->pts, sizeof(float) * 8 * n);
+        memcpy(entry->layout.uvs, layout->uvs, sizeof(float) * 4 * n);
+        memcpy(entry->layout.pages, layout->pages, sizeof(int) * n);
+    }
+    entry->string = (char*)(entry->layout.pages + n);
+    entry->nstring = nstring;
+    memcpy(entry->string, string, nstring);
+
+    entry->next = tc->lut[hash & (NVG_TEXTCACHE_LUT_SIZE - 1)];
+    tc->lut[hash & (NVG_TEXTCACHE_LUT_SIZE - 1)] = entry;
+    nvg__textPushFront(tc, entry);
+    tc->bytes += size;
+    tc->nentries++;
+}
+
+// Draws the quads of a layout at the whole pixel ox,oy in font pixels. The
+// corners of all quads are transformed in one pass. Glyphs of one paint
+// blend the same in any order, so the quads of each atlas page are drawn
+// with one call even when the pages alternate along the string.
+static void nvg__drawTextLayout(NVGcontext* ctx, const NVGtextLayout* layout,
+                                float ox, float oy, float scale) {
+    // Corners of the two triangles of a quad, the triangles are flipped
+    // with the quad when the transform mirrors the text.
+    static const int order[2][6] = {{0, 2, 1, 0, 3, 2}, {3, 1, 2, 3, 0, 1}};
+    NVGstate* state = nvg__getState(ctx);
+    const int* corner = order[nvg__isTransformFlipped(state->xform)];
+    float invscale = 1.0f / scale;
+    int i, j, p, first, nverts, n = layout->nquads;
+    unsigned int pages = 0;
+    NVGvertex* verts;
+    float t[6];
+    float* c;
+
+    if (n == 0) return;
+
+    // The transformed corners go after the vertices.
+    verts = nvg__allocTempVerts(ctx, n * 8);
+    if (verts == NULL) return;
+    c = (float*)&verts[n * 6];
+    nvgTransformScale(t, invscale, invscale);
+    t[4] = ox * invscale;
+    t[5] = oy * invscale;
+    nvgTransformMultiply(t, state->xform);
+    nvg__transformPoints(c, layout->pts, n * 4, t);
+
+    for (i = 0; i < n; i++) pages |= 1u << layout->pages[i];
+    nverts = 0;
+    for (p = 0; pages != 0; p++, pages >>= 1) {
+        if ((pages & 1) == 0) continue;
+        first = nverts;
+        for (i = 0; i < n; i++) {
+            if (layout->pages[i] != p) continue;
+            const float* uv = &layout->uvs[i * 4];
+            const float u[4] = {uv[0], uv[2], uv[2], uv[0]};
+            const float v[4] = {uv[1], uv[1], uv[3], uv[3]};
+            for (j = 0; j < 6; j++) {
+                int k = corner[j];
+                nvg__vset(&verts[nverts++], c[i * 8 + k * 2],
+                          c[i * 8 + k * 2 + 1], u[k], v[k]);
+            }
+        }
+        nvg__renderText(ctx, &verts[first], nverts - first, p);
+    }
+}
+
+// Lays out the glyph quads of a string at x,y in font pixels and draws them
+// offset by the whole pixel ox,oy. Returns 1 if the layout is complete, 0 if
+// glyphs did not fit the font atlas, and -1 on allocation failure.
+static int nvg__layoutText(NVGcontext* ctx, float x, float y,
+                           const char* string, const char* end, float ox,
+                           float oy, float scale, NVGtextLayout* layout) {
+    FONStextIter iter;
+    FONSquad q;
+    int cquads = nvg__maxi(2, (int)(end - string));  // conservative estimate.
+    int complete = 1;
+
+    layout->pts = (float*)ctx->allocator.reallocate(
+        ctx->allocator.userPtr, NULL, 0,
+        (sizeof(float) * 12 + sizeof(int)) * cquads);
+    if (layout->pts == NULL) return -1;
+    layout->uvs = layout->pts + cquads * 8;
+    layout->pages = (int*)(layout->uvs + cquads * 4);
+    layout->nquads = 0;
+
+    nvg__limitTextAtlas(ctx);
+    fonsTextIterInit(ctx->fs, &iter, x, y, string, end,
+                     FONS_GLYPH_BITMAP_REQUIRED);
+    while (fonsTextIterNext(ctx->fs, &iter, &q)) {
+        if (iter.prevGlyphIndex == -1) {  // can not retrieve glyph?
+            nvg__textAtlasFull(ctx);
+            complete = 0;
+            continue;
+        }
+        if (layout->nquads < cquads) {
+            float* p = &layout->pts[layout->nquads * 8];
+            float* uv = &layout->uvs[layout->nquads * 4];
+            p[0] = q.x0;
+            p[1] = q.y0;
+            p[2] = q.x1;
+            p[3] = q.y0;
+            p[4] = q.x1;
+            p[5] = q.y1;
+            p[6] = q.x0;
+            p[7] = q.y1;
+            uv[0] = q.s0;
+            uv[1] = q.t0;
+            uv[2] = q.s1;
+            uv[3] = q.t1;
+            layout->pages[layout->nquads] = iter.page;
+            layout->nquads++;
+        }
+    }
+    layout->nextx = iter.nextx;
+
+    nvg__flushTextTexture(ctx);
+
+    nvg__drawTextLayout(ctx, layout, ox, oy, scale);
+    return complete;
+}
+
+// nvgText() with NVG_TEXT_CACHE. The text is laid out at the fraction of the
+// pixel it starts at, and moved to the whole pixel when drawn.
+static float nvg__cachedText(NVGcontext* ctx, float x, float y,
+                             const char* string, const char* end,
+                             float scale) {
+    NVGstate* state = nvg__getState(ctx);
+    NVGtextCache* tc = ctx->textCache;
+    NVGtextEntry* entry;
+    NVGtextLayout layout;
+    NVGtextKey key;
+    float ox = floorf(x * scale);
+    float oy = floorf(y * scale);
+    int nstring = (int)(end - string);
+    int fontGeneration = nvg__fonts(ctx)->fontGeneration;
+    unsigned int hash;
+    int i;
+
+    memset(&key, 0, sizeof(key));
+    key.fontId = state->fontId;
+    key.align = state->textAlign;
+    key.size = state->fontSize * scale;
+    key.spacing = state->letterSpacing * scale;
+    key.blur = state->fontBlur * scale;
+    key.originx = x * scale - ox;
+    key.originy = y * scale - oy;
+    hash = nvg__textHash(&key, string, nstring);
+
+    entry = nvg__textFind(tc, ctx->fs, hash, &key, string, nstring,
+                          fontGeneration);
+    if (entry != NULL) {
+        // Keeps the pages of the glyphs from being evicted this frame.
+        for (i = 0; i < entry->layout.nquads; i++)
+            fonsTouchPage(ctx->fs, entry->layout.pages[i]);
+        nvg__drawTextLayout(ctx, &entry->layout, ox, oy, scale);
+        return (entry->layout.nextx + ox) / scale;
+    }
+
+    switch (nvg__layoutText(ctx, key.originx, key.originy, string, end, ox, oy,
+                            scale, &layout)) {
+        case -1:
+            return x;
+        case 1:
+            // Pages evicted during the layout held none of its glyphs.
+            nvg__textInsert(tc, hash, &key, string, nstring, fontGeneration,
+                            fonsGetAtlasGeneration(ctx->fs), &layout);
+            break;
+    }
+    return (layout.nextx + ox) / scale;
+}
+
+void nvgTextAtlasBudget(NVGcontext* ctx, int bytes) {
+    const int pageBytes = NVG_FONTPAGE_SIZE * NVG_FONTPAGE_SIZE;
+    if (ctx->fontOwner != NULL) return;
+    NVGfontLock lock(ctx);
+    ctx->maxFontPages = nvg__clampi(bytes / pageBytes, 1, NVG_MAX_FONTIMAGES);
+    if (ctx->fs == NULL) return;
+    fonsSetMaxPages(ctx->fs, ctx->maxFontPages);
+    fonsTrimPages(ctx->fs, ctx->maxFontPages);
+    for (int i = fonsGetPageCount(ctx->fs); i < NVG_MAX_FONTIMAGES; i++) {
+        if (ctx->fontImages[i] != 0) {
+            nvgDeleteImage(ctx, ctx->fontImages[i]);
+            ctx->fontImages[i] = 0;
+        }
+    }
+}
+
+int nvgSaveFontAtlas(NVGcontext* ctx, const char* filename) {
+    if (ctx->fontOwner != NULL) return 0;
+    NVGfontLock lock(ctx);
+    return fonsSaveAtlas(ctx->fs, filename);
+}
+
+int nvgLoadFontAtlas(NVGcontext* ctx, const char* filename) {
+    if (ctx->fontOwner != NULL) return 0;
+    NVGfontLock lock(ctx);
+    int res = fonsLoadAtlas(ctx->fs, filename);
+    // Uploads the loaded pages as the initial font textures.
+    nvg__flushTextTexture(ctx);
+    return res;
+}
+
+int nvgLoadFontAtlasMem(NVGcontext* ctx, const unsigned char* data,
+                        int ndata) {
+    if (ctx->fontOwner != NULL) return 0;
+    NVGfontLock lock(ctx);
+    int res = fonsLoadAtlasMem(ctx->fs, data, ndata);
+    nvg__flushTextTexture(ctx);
+    return res;
+}
+
+void nvgTextCacheBudget(NVGcontext* ctx, int bytes) {
+    NVGtextCache* tc = ctx->textCache;
+    if (tc == NULL) return;
+    tc->budget = nvg__maxi(0, bytes);
+    nvg__textTrim(tc, tc->budget);
+}
+
+void nvgTextCacheStats(NVGcontext* ctx, NVGtextCacheStats* stats) {
+    NVGtextCache* tc = ctx->textCache;
+    if (stats == NULL) return;
+    memset(stats, 0, sizeof(*stats));
+    if (tc == NULL) return;
+    stats->hits = tc->hits;
+    stats->misses = tc->misses;
+    stats->evictions = tc->evictions;
+    stats->entries = tc->nentries;
+    stats->bytes = tc->bytes;
+}
+
 float nvgText(NVGcontext* ctx, float x, float y, const char* string,
               const char* end) {
+    NVGfontLock lock(ctx);
     NVGstate* state = nvg__getState(ctx);
-    FONStextIter iter, prevIter;
-    FONSquad q;
-    NVGvertex* verts;
+    NVGtextLayout layout;
     float scale = nvg__getFontScale(state) * ctx->devicePxRatio;
-    float invscale = 1.0f / scale;
-    int cverts = 0;
-    int nverts = 0;
-    int isFlipped = nvg__isTransformFlipped(state->xform);
 
     if (end == NULL) end = string + strlen(string);
 
@@ -2538,69 +4909,13 @@ float nvgText(NVGcontext* ctx, float x, float y, const char* string,
     fonsSetAlign(ctx->fs, state->textAlign);
     fonsSetFont(ctx->fs, state->fontId);
 
-    cverts = nvg__maxi(2, (int)(end - string)) * 6;  // conservative estimate.
-    verts = nvg__allocTempVerts(ctx, cverts);
-    if (verts == NULL) return x;
+    if (ctx->textCache != NULL)
+        return nvg__cachedText(ctx, x, y, string, end, scale);
 
-    fonsTextIterInit(ctx->fs, &iter, x * scale, y * scale, string, end,
-                     FONS_GLYPH_BITMAP_REQUIRED);
-    prevIter = iter;
-    while (fonsTextIterNext(ctx->fs, &iter, &q)) {
-        float c[4 * 2];
-        if (iter.prevGlyphIndex == -1) {  // can not retrieve glyph?
-            if (nverts != 0) {
-                nvg__renderText(ctx, verts, nverts);
-                nverts = 0;
-            }
-            if (!nvg__allocTextAtlas(ctx)) break;  // no memory :(
-            iter = prevIter;
-            fonsTextIterNext(ctx->fs, &iter, &q);  // try again
-            if (iter.prevGlyphIndex == -1)         // still can not find glyph?
-                break;
-        }
-        prevIter = iter;
-        if (isFlipped) {
-            float tmp;
-
-            tmp = q.y0;
-            q.y0 = q.y1;
-            q.y1 = tmp;
-            tmp = q.t0;
-            q.t0 = q.t1;
-            q.t1 = tmp;
-        }
-        // Transform corners.
-        nvgTransformPoint(&c[0], &c[1], state->xform, q.x0 * invscale,
-                          q.y0 * invscale);
-        nvgTransformPoint(&c[2], &c[3], state->xform, q.x1 * invscale,
-                          q.y0 * invscale);
-        nvgTransformPoint(&c[4], &c[5], state->xform, q.x1 * invscale,
-                          q.y1 * invscale);
-        nvgTransformPoint(&c[6], &c[7], state->xform, q.x0 * invscale,
-                          q.y1 * invscale);
-        // Create triangles
-        if (nverts + 6 <= cverts) {
-            nvg__vset(&verts[nverts], c[0], c[1], q.s0, q.t0);
-            nverts++;
-            nvg__vset(&verts[nverts], c[4], c[5], q.s1, q.t1);
-            nverts++;
-            nvg__vset(&verts[nverts], c[2], c[3], q.s1, q.t0);
-            nverts++;
-            nvg__vset(&verts[nverts], c[0], c[1], q.s0, q.t0);
-            nverts++;
-            nvg__vset(&verts[nverts], c[6], c[7], q.s0, q.t1);
-            nverts++;
-            nvg__vset(&verts[nverts], c[4], c[5], q.s1, q.t1);
-            nverts++;
-        }
-    }
-
-    // TODO: add back-end bit to do this just once per frame.
-    nvg__flushTextTexture(ctx);
-
-    nvg__renderText(ctx, verts, nverts);
-
-    return iter.nextx / scale;
+    if (nvg__layoutText(ctx, x * scale, y * scale, string, end, 0, 0, scale,
+                        &layout) < 0)
+        return x;
+    return layout.nextx / scale;
 }
 
 void nvgTextBox(NVGcontext* ctx, float x, float y, float breakRowWidth,
@@ -2641,13 +4956,23 @@ void nvgTextBox(NVGcontext* ctx, float x, float y, float breakRowWidth,
     state->textAlign = oldAlign;
 }
 
+// Distance field glyph quads reach FONS_SDF_PADDING reference pixels past
+// the glyph. Returns how far to move their edges in when measuring text of
+// the font pixel size.
+static float nvg__textQuadInset(NVGcontext* ctx, float size) {
+    if ((fonsGetFlags(ctx->fs) & FONS_SDF_GLYPHS) == 0) return 0.0f;
+    return FONS_SDF_PADDING * size / FONS_SDF_SIZE;
+}
+
 int nvgTextGlyphPositions(NVGcontext* ctx, float x, float y, const char* string,
                           const char* end, NVGglyphPosition* positions,
                           int maxPositions) {
+    NVGfontLock lock(ctx);
     NVGstate* state = nvg__getState(ctx);
     float scale = nvg__getFontScale(state) * ctx->devicePxRatio;
     float invscale = 1.0f / scale;
-    FONStextIter iter, prevIter;
+    float inset = nvg__textQuadInset(ctx, state->fontSize * scale);
+    FONStextIter iter;
     FONSquad q;
     int npos = 0;
 
@@ -2665,18 +4990,12 @@ int nvgTextGlyphPositions(NVGcontext* ctx, float x, float y, const char* string,
 
     fonsTextIterInit(ctx->fs, &iter, x * scale, y * scale, string, end,
                      FONS_GLYPH_BITMAP_OPTIONAL);
-    prevIter = iter;
+    // Glyphs without bitmaps take no room in the atlas.
     while (fonsTextIterNext(ctx->fs, &iter, &q)) {
-        if (iter.prevGlyphIndex < 0 &&
-            nvg__allocTextAtlas(ctx)) {  // can not retrieve glyph?
-            iter = prevIter;
-            fonsTextIterNext(ctx->fs, &iter, &q);  // try again
-        }
-        prevIter = iter;
         positions[npos].str = iter.str;
         positions[npos].x = iter.x * invscale;
-        positions[npos].minx = nvg__minf(iter.x, q.x0) * invscale;
-        positions[npos].maxx = nvg__maxf(iter.nextx, q.x1) * invscale;
+        positions[npos].minx = nvg__minf(iter.x, q.x0 + inset) * invscale;
+        positions[npos].maxx = nvg__maxf(iter.nextx, q.x1 - inset) * invscale;
         npos++;
         if (npos >= maxPositions) break;
     }
@@ -2693,10 +5012,12 @@ enum NVGcodepointType {
 
 int nvgTextBreakLines(NVGcontext* ctx, const char* string, const char* end,
                       float breakRowWidth, NVGtextRow* rows, int maxRows) {
+    NVGfontLock lock(ctx);
     NVGstate* state = nvg__getState(ctx);
     float scale = nvg__getFontScale(state) * ctx->devicePxRatio;
     float invscale = 1.0f / scale;
-    FONStextIter iter, prevIter;
+    float inset = nvg__textQuadInset(ctx, state->fontSize * scale);
+    FONStextIter iter;
     FONSquad q;
     int nrows = 0;
     float rowStartX = 0;
@@ -2731,14 +5052,10 @@ int nvgTextBreakLines(NVGcontext* ctx, const char* string, const char* end,
 
     fonsTextIterInit(ctx->fs, &iter, 0, 0, string, end,
                      FONS_GLYPH_BITMAP_OPTIONAL);
-    prevIter = iter;
+    // Glyphs without bitmaps take no room in the atlas.
     while (fonsTextIterNext(ctx->fs, &iter, &q)) {
-        if (iter.prevGlyphIndex < 0 &&
-            nvg__allocTextAtlas(ctx)) {  // can not retrieve glyph?
-            iter = prevIter;
-            fonsTextIterNext(ctx->fs, &iter, &q);  // try again
-        }
-        prevIter = iter;
+        q.x0 += inset;
+        q.x1 -= inset;
         switch (iter.codepoint) {
             case 9:       // \t
             case 11:      // \v
@@ -2905,6 +5222,7 @@ int nvgTextBreakLines(NVGcontext* ctx, const char* string, const char* end,
 
 float nvgTextBounds(NVGcontext* ctx, float x, float y, const char* string,
                     const char* end, float* bounds) {
+    NVGfontLock lock(ctx);
     NVGstate* state = nvg__getState(ctx);
     float scale = nvg__getFontScale(state) * ctx->devicePxRatio;
     float invscale = 1.0f / scale;
@@ -2932,6 +5250,7 @@ float nvgTextBounds(NVGcontext* ctx, float x, float y, const char* string,
 
 void nvgTextBoxBounds(NVGcontext* ctx, float x, float y, float breakRowWidth,
                       const char* string, const char* end, float* bounds) {
+    NVGfontLock lock(ctx);
     NVGstate* state = nvg__getState(ctx);
     NVGtextRow rows[2];
     float scale = nvg__getFontScale(state) * ctx->devicePxRatio;
@@ -3004,6 +5323,7 @@ void nvgTextBoxBounds(NVGcontext* ctx, float x, float y, float breakRowWidth,
 
 void nvgTextMetrics(NVGcontext* ctx, float* ascender, float* descender,
                     float* lineh) {
+    NVGfontLock lock(ctx);
     NVGstate* state = nvg__getState(ctx);
     float scale = nvg__getFontScale(state) * ctx->devicePxRatio;
     float invscale = 1.0f / scale;
@@ -3024,7 +5344,7 @@ void nvgTextMetrics(NVGcontext* ctx, float* ascender, float* descender,
 
 static int glnvg__maxi(int a, int b) { return a > b ? a : b; }
 
-static void glnvg__xformToMat3x4(float* m3, float* t) {
+static void glnvg__xformToMat3x4(float* m3, const float* t) {
     m3[0] = t[0];
     m3[1] = t[1];
     m3[2] = 0.0f;
@@ -3046,15 +5366,6 @@ static NVGcolor glnvg__premulColor(NVGcolor c) {
     return c;
 }
 
-static int glnvg__maxVertCount(const NVGpath* paths, int npaths) {
-    int i, count = 0;
-    for (i = 0; i < npaths; i++) {
-        count += paths[i].nfill;
-        count += paths[i].nstroke;
-    }
-    return count;
-}
-
 static void glnvg__vset(NVGvertex* vtx, float x, float y, float u, float v) {
     vtx->x = x;
     vtx->y = y;
@@ -3062,33 +5373,86 @@ static void glnvg__vset(NVGvertex* vtx, float x, float y, float u, float v) {
     vtx->v = v;
 }
 
-static int fragSize() { return 256; }
-
 class NVGDrawImpl {
     NVGdrawData _drawdata = {};
-    // Per frame buffers
-    std::vector<GLNVGcall> _calls;
-    std::vector<GLNVGpath> _paths;
+    const NVGallocator* _allocator = {};
+    // Per frame buffers, allocated from the frame allocator. clear() forgets
+    // them but keeps the capacities as the initial size for the next frame.
+    GLNVGcall* _calls = {};
+    int _ncalls = {};
+    int _ccalls = {};
+    GLNVGpath* _paths = {};
+    int _npaths = {};
+    int _cpaths = {};
     NVGvertex* _verts = {};
     int _nverts = {};
     int _cverts = {};
     unsigned char* _uniforms = {};
     int _cuniforms = {};
     int _nuniforms = {};
+    int _fragSize = 256;
+    // Hash of the uniform blocks recorded this frame to their offset + 1,
+    // for sharing blocks between calls with the same paint.
+    unsigned int _uniformHash[NVG_UNIFORM_LUT_SIZE] = {};
+    int _uniformLut[NVG_UNIFORM_LUT_SIZE] = {};
+    NVGinstance* _instances = {};
+    int _ninstances = {};
+    int _cinstances = {};
+    const NVGvertex* _commitBase = {};
+    int _commitCount = {};
+    unsigned int* _indices = {};
+    int _nindices = {};
+    int _cindices = {};
+    // The indices narrowed to 16 bits for drawdata(), when they fit.
+    unsigned short* _shortIndices = {};
+    int _nshortIndices = {};
+    int _cshortIndices = {};
+    NVGcompactVertex* _compactVerts = {};
+    int _ncompactVerts = {};
+    int _ccompactVerts = {};
+    // Call reserved by glnvg__deferCall() which glnvg__allocCall() returns
+    // next, or -1.
+    int _resumeCall = -1;
 
    public:
-    void setViewSize(int width, int height) {
+    void setAllocator(const NVGallocator* allocator) {
+        _allocator = allocator;
+    }
+    void setViewSize(int width, int height, float devicePixelRatio) {
         _drawdata.view[0] = width;
         _drawdata.view[1] = height;
+        _drawdata.devicePixelRatio = devicePixelRatio;
     }
-    NVGdrawData* drawdata() {
-        _drawdata.drawData = _calls.data();
-        _drawdata.drawCount = _calls.size();
+    // Sets the stride of the uniform blocks, rounded up so that a block
+    // always fits.
+    void setFragSize(int size) {
+        int minSize = (sizeof(GLNVGfragUniforms) + 15) & ~15;
+        _fragSize = nvg__maxi(size, minSize);
+    }
+    int fragSize() const { return _fragSize; }
+    NVGdrawData* drawdata(int compact) {
+        _drawdata.drawData = _calls;
+        _drawdata.drawCount = _ncalls;
         _drawdata.pUniform = _uniforms;
-        _drawdata.uniformByteSize = _nuniforms * 256;  // _renderer->fragSize();
+        _drawdata.uniformByteSize = _nuniforms * _fragSize;
         _drawdata.pVertex = _verts;
         _drawdata.vertexCount = _nverts;
-        _drawdata.pPath = _paths.data();
+        _drawdata.vertexFormat = NVG_VERTEX_FLOAT;
+        _drawdata.pCompactVertex = NULL;
+        if (compact && _nverts > 0 && glnvg__compactVerts()) {
+            _drawdata.vertexFormat = NVG_VERTEX_COMPACT;
+            _drawdata.pCompactVertex = _compactVerts;
+        }
+        _drawdata.pPath = _paths;
+        _drawdata.pInstance = _instances;
+        _drawdata.instanceCount = _ninstances;
+        _drawdata.pIndex = _indices;
+        _drawdata.indexCount = _nindices;
+        _drawdata.indexSize = sizeof(unsigned int);
+        if (_nindices > 0 && _nverts <= 0x10000 && glnvg__narrowIndices()) {
+            _drawdata.pIndex = _shortIndices;
+            _drawdata.indexSize = sizeof(unsigned short);
+        }
         return &_drawdata;
     }
     GLNVGpath& get_path(size_t index) { return _paths[index]; }
@@ -3098,62 +5462,513 @@ class NVGDrawImpl {
     }
 
     void clear() {
+        _calls = NULL;
+        _ncalls = 0;
+        _paths = NULL;
+        _npaths = 0;
+        _verts = NULL;
         _nverts = 0;
-        _paths.clear();
-        _calls.clear();
+        _uniforms = NULL;
         _nuniforms = 0;
+        memset(_uniformLut, 0, sizeof(_uniformLut));
+        _instances = NULL;
+        _ninstances = 0;
+        _indices = NULL;
+        _nindices = 0;
+        _shortIndices = NULL;
+        _nshortIndices = 0;
+        _compactVerts = NULL;
+        _ncompactVerts = 0;
+        _resumeCall = -1;
+    }
+
+    // Reserves a call which stays GLNVG_NONE until it is recorded with
+    // _resumeCall set.
+    int glnvg__deferCall() {
+        if (glnvg__allocCall() == NULL) return -1;
+        return _ncalls - 1;
     }
+    void glnvg__resumeCall(int call) { _resumeCall = call; }
 
     GLNVGcall* glnvg__allocCall() {
-        _calls.push_back({});
-        return &_calls.back();
+        if (_resumeCall >= 0) {
+            GLNVGcall* call = &_calls[_resumeCall];
+            _resumeCall = -1;
+            memset(call, 0, sizeof(GLNVGcall));
+            return call;
+        }
+        if (_calls == NULL || _ncalls + 1 > _ccalls) {
+            GLNVGcall* calls = (GLNVGcall*)nvg__frameGrow(
+                _allocator, _calls, &_ccalls, _ncalls + 1, 128,
+                sizeof(GLNVGcall));
+            if (calls == NULL) return NULL;
+            _calls = calls;
+        }
+        GLNVGcall* call = &_calls[_ncalls++];
+        memset(call, 0, sizeof(GLNVGcall));
+        return call;
     }
 
     int glnvg__allocPaths(int n) {
-        auto ret = _paths.size();
-        _paths.resize(ret + n);
+        int ret = 0;
+        if (_paths == NULL || _npaths + n > _cpaths) {
+            GLNVGpath* paths = (GLNVGpath*)nvg__frameGrow(
+                _allocator, _paths, &_cpaths, _npaths + n, 128,
+                sizeof(GLNVGpath));
+            if (paths == NULL) return -1;
+            _paths = paths;
+        }
+        ret = _npaths;
+        _npaths += n;
         return ret;
     }
 
     int glnvg__allocVerts(int n) {
         int ret = 0;
-        if (_nverts + n > _cverts) {
-            NVGvertex* verts;
-            int cverts = glnvg__maxi(_nverts + n, 4096) +
-                         _cverts / 2;  // 1.5x Overallocate
-            verts = (NVGvertex*)realloc(_verts, sizeof(NVGvertex) * cverts);
+        if (_verts == NULL || _nverts + n > _cverts) {
+            NVGvertex* verts = (NVGvertex*)nvg__frameGrow(
+                _allocator, _verts, &_cverts, _nverts + n, 4096,
+                sizeof(NVGvertex));
             if (verts == NULL) return -1;
             _verts = verts;
-            _cverts = cverts;
         }
         ret = _nverts;
         _nverts += n;
         return ret;
     }
 
+    // Makes sure there is room for n vertices past the used part of the
+    // vertex buffer and returns a pointer to it. The space is taken into use
+    // when a draw call referencing the vertices is recorded.
+    NVGvertex* glnvg__reserveVerts(int n) {
+        if (_verts == NULL || _nverts + n > _cverts) {
+            NVGvertex* verts = (NVGvertex*)nvg__frameGrow(
+                _allocator, _verts, &_cverts, _nverts + n, 4096,
+                sizeof(NVGvertex));
+            if (verts == NULL) return NULL;
+            _verts = verts;
+        }
+        return &_verts[_nverts];
+    }
+
+    // Returns the offset of vertices which were written directly to the
+    // vertex buffer, or -1 if they live in some other memory.
+    int glnvg__residentOffset(const NVGvertex* verts, const NVGvertex* base,
+                              int count) {
+        if (verts == NULL || base == NULL || verts < base ||
+            verts >= base + count)
+            return -1;
+        return (int)(verts - base);
+    }
+
+    // Takes the vertices of the paths which were expanded in place into use,
+    // and returns the number of vertices which still need to be copied.
+    // Remembers the buffer the paths were expanded to, as allocating room
+    // for the copies may move it.
+    int glnvg__commitVerts(const NVGpath* paths, int npaths, int fill) {
+        int i, ncopy = 0;
+        _commitBase = _verts;
+        _commitCount = _cverts;
+        for (i = 0; i < npaths; i++) {
+            if (fill)
+                ncopy += glnvg__commitRange(paths[i].fill, paths[i].nfill);
+            ncopy += glnvg__commitRange(paths[i].stroke, paths[i].nstroke);
+        }
+        return ncopy;
+    }
+
+    int glnvg__commitRange(const NVGvertex* verts, int n) {
+        int offset;
+        if (n <= 0) return 0;
+        offset = glnvg__residentOffset(verts, _verts, _cverts);
+        if (offset == -1) return n;
+        _nverts = glnvg__maxi(_nverts, offset + n);
+        return 0;
+    }
+
+    // Returns the offset of the vertices in the vertex buffer, copying them
+    // to *offset first if they were not expanded in place.
+    int glnvg__placeVerts(const NVGvertex* verts, int n, int* offset) {
+        int ret = glnvg__residentOffset(verts, _commitBase, _commitCount);
+        if (ret != -1) return ret;
+        ret = *offset;
+        memcpy(&_verts[ret], verts, sizeof(NVGvertex) * n);
+        *offset += n;
+        return ret;
+    }
+
+    // Returns the number of triangle list indices for n fan or strip
+    // vertices, or for a list of n vertices.
+    static int glnvg__listIndexCount(int n, int list) {
+        if (list) return n;
+        return n >= 3 ? (n - 2) * 3 : 0;
+    }
+
+    // Records the paths of the call as triangle list indices. The fills are
+    // fans, or lists for triangulated concave fills, and the fringes and
+    // strokes are strips. The winding of the triangles is kept.
+    void glnvg__indexCall(GLNVGcall* call) {
+        const GLNVGpath* paths = &_paths[call->pathOffset];
+        int list = call->type == GLNVG_CONCAVEFILL;
+        int i, j, nfill = 0, nstroke = 0;
+        unsigned int* dst;
+
+        for (i = 0; i < call->pathCount; i++) {
+            if (call->type != GLNVG_STROKE)
+                nfill += glnvg__listIndexCount(paths[i].fillCount, list);
+            nstroke += glnvg__listIndexCount(paths[i].strokeCount, 0);
+        }
+        if (_indices == NULL || _nindices + nfill + nstroke > _cindices) {
+            unsigned int* indices = (unsigned int*)nvg__frameGrow(
+                _allocator, _indices, &_cindices, _nindices + nfill + nstroke,
+                4096, sizeof(unsigned int));
+            if (indices == NULL) return;
+            _indices = indices;
+        }
+
+        dst = &_indices[_nindices];
+        for (i = 0; i < call->pathCount && nfill > 0; i++) {
+            unsigned int b = (unsigned int)paths[i].fillOffset;
+            int n = paths[i].fillCount;
+            if (list) {
+                for (j = 0; j < n; j++) *dst++ = b + j;
+                continue;
+            }
+            for (j = 1; j + 1 < n; j++) {
+                *dst++ = b;
+                *dst++ = b + j;
+                *dst++ = b + j + 1;
+            }
+        }
+        for (i = 0; i < call->pathCount; i++) {
+            unsigned int b = (unsigned int)paths[i].strokeOffset;
+            int n = paths[i].strokeCount;
+            // Every other triangle of a strip is flipped to keep the
+            // winding.
+            for (j = 0; j + 2 < n; j++) {
+                *dst++ = b + j + (j & 1);
+                *dst++ = b + j + 1 - (j & 1);
+                *dst++ = b + j + 2;
+            }
+        }
+
+        call->indexOffset = _nindices;
+        call->indexCount = nfill + nstroke;
+        call->fillIndexCount = nfill;
+        _nindices += nfill + nstroke;
+    }
+
+    // Copies the indices to 16 bit ones, returns 0 if there is no memory.
+    int glnvg__narrowIndices() {
+        int i;
+        if (_nshortIndices == _nindices) return 1;
+        if (_shortIndices == NULL || _nindices > _cshortIndices) {
+            unsigned short* indices = (unsigned short*)nvg__frameGrow(
+                _allocator, NULL, &_cshortIndices, _nindices, 4096,
+                sizeof(unsigned short));
+            if (indices == NULL) return 0;
+            _shortIndices = indices;
+        }
+        for (i = 0; i < _nindices; i++)
+            _shortIndices[i] = (unsigned short)_indices[i];
+        _nshortIndices = _nindices;
+        return 1;
+    }
+
+    // Converts the vertices to NVGcompactVertex. Returns 0 if a vertex is
+    // out of range of the compact format, or if there is no memory.
+    int glnvg__compactVerts() {
+        const float scale = (float)NVG_COMPACT_SUBPIXELS;
+        const float limit = 32767.0f / scale;
+        int i;
+        if (_ncompactVerts == _nverts) return 1;
+        for (i = 0; i < _nverts; i++) {
+            const NVGvertex* v = &_verts[i];
+            if (!(v->x >= -limit && v->x <= limit && v->y >= -limit &&
+                  v->y <= limit && v->u >= 0.0f && v->u <= 1.0f &&
+                  v->v >= 0.0f && v->v <= 1.0f))
+                return 0;
+        }
+        if (_compactVerts == NULL || _nverts > _ccompactVerts) {
+            NVGcompactVertex* verts = (NVGcompactVertex*)nvg__frameGrow(
+                _allocator, NULL, &_ccompactVerts, _nverts, 4096,
+                sizeof(NVGcompactVertex));
+            if (verts == NULL) return 0;
+            _compactVerts = verts;
+        }
+        for (i = 0; i < _nverts; i++) {
+            const NVGvertex* v = &_verts[i];
+            NVGcompactVertex* dst = &_compactVerts[i];
+            dst->x = (short)floorf(v->x * scale + 0.5f);
+            dst->y = (short)floorf(v->y * scale + 0.5f);
+            dst->u = (unsigned short)(v->u * 65535.0f + 0.5f);
+            dst->v = (unsigned short)(v->v * 65535.0f + 0.5f);
+        }
+        _ncompactVerts = _nverts;
+        return 1;
+    }
+
+    // Clips the call with glScissor when the scissor is an axis aligned
+    // rectangle with its edges on device pixels, where the fragment shader
+    // mask would be exactly 0 or 1 too. Returns the scissor for the fragment
+    // shader, none in that case.
+    NVGscissor* glnvg__setupScissor(GLNVGcall* call, NVGscissor* scissor) {
+        static NVGscissor none = {{0}, {-1.0f, -1.0f}};
+        const float* t = scissor->xform;
+        float ratio = _drawdata.devicePixelRatio;
+        float ex, ey, edges[4];
+        int i;
+        if (scissor->extent[0] < -0.5f || scissor->extent[1] < -0.5f)
+            return scissor;
+        if (t[1] != 0.0f || t[2] != 0.0f) return scissor;
+        ex = nvg__absf(t[0]) * scissor->extent[0];
+        ey = nvg__absf(t[3]) * scissor->extent[1];
+        edges[0] = (t[4] - ex) * ratio;
+        edges[1] = (t[5] - ey) * ratio;
+        edges[2] = (t[4] + ex) * ratio;
+        edges[3] = (t[5] + ey) * ratio;
+        for (i = 0; i < 4; i++) {
+            float e = floorf(edges[i] + 0.5f);
+            if (nvg__absf(edges[i] - e) > 1.0f / 256.0f) return scissor;
+            edges[i] = e;
+        }
+        call->hwScissor = 1;
+        call->scissorRect[0] = (int)edges[0];
+        call->scissorRect[1] = (int)edges[1];
+        call->scissorRect[2] = (int)(edges[2] - edges[0]);
+        call->scissorRect[3] = (int)(edges[3] - edges[1]);
+        return &none;
+    }
+
+    // Like glnvg__reserveVerts(), for the instance buffer.
+    NVGinstance* glnvg__reserveInstances(int n) {
+        if (_instances == NULL || _ninstances + n > _cinstances) {
+            NVGinstance* instances = (NVGinstance*)nvg__frameGrow(
+                _allocator, _instances, &_cinstances, _ninstances + n, 256,
+                sizeof(NVGinstance));
+            if (instances == NULL) return NULL;
+            _instances = instances;
+        }
+        return &_instances[_ninstances];
+    }
+
+    int glnvg__allocInstances(int n) {
+        int ret = _ninstances;
+        _ninstances += n;
+        return ret;
+    }
+
     int glnvg__allocFragUniforms(int n) {
         int ret = 0;
-        int structSize = fragSize();
-        if (_nuniforms + n > _cuniforms) {
-            unsigned char* uniforms;
-            int cuniforms = glnvg__maxi(_nuniforms + n, 128) +
-                            _cuniforms / 2;  // 1.5x Overallocate
-            uniforms =
-                (unsigned char*)realloc(_uniforms, structSize * cuniforms);
+        int structSize = _fragSize;
+        if (_uniforms == NULL || _nuniforms + n > _cuniforms) {
+            unsigned char* uniforms = (unsigned char*)nvg__frameGrow(
+                _allocator, _uniforms, &_cuniforms, _nuniforms + n, 128,
+                structSize);
             if (uniforms == NULL) return -1;
             _uniforms = uniforms;
-            _cuniforms = cuniforms;
         }
         ret = _nuniforms * structSize;
         _nuniforms += n;
         return ret;
     }
 
+    int glnvg__equalFragUniforms(int a, int b, int n) {
+        for (int i = 0; i < n; i++) {
+            if (memcmp(&_uniforms[a + i * _fragSize],
+                       &_uniforms[b + i * _fragSize],
+                       sizeof(GLNVGfragUniforms)) != 0)
+                return 0;
+        }
+        return 1;
+    }
+
+    // Looks for n earlier uniform blocks equal to the n blocks just written
+    // at offset. If there are, the new blocks are released and the offset of
+    // the earlier ones is returned.
+    int glnvg__internFragUniforms(int offset, int n) {
+        unsigned int h = 2166136261u;
+        int i, slot, prev;
+        if (offset != (_nuniforms - n) * _fragSize) return offset;
+
+        // Runs of calls with the same paint are the common case, check the
+        // blocks right before first.
+        prev = offset - n * _fragSize;
+        if (prev >= 0 && glnvg__equalFragUniforms(prev, offset, n)) {
+            _nuniforms -= n;
+            return prev;
+        }
+
+        for (i = 0; i < n; i++)
+            h = nvg__hashWords(h, &_uniforms[offset + i * _fragSize],
+                               sizeof(GLNVGfragUniforms) / 4);
+        h ^= h >> 16;
+        h *= 0x85ebca6bu;
+        h ^= h >> 13;
+        slot = (int)(h & (NVG_UNIFORM_LUT_SIZE - 1));
+        prev = _uniformLut[slot] - 1;
+        if (prev >= 0 && _uniformHash[slot] == h &&
+            glnvg__equalFragUniforms(prev, offset, n)) {
+            _nuniforms -= n;
+            return prev;
+        }
+        _uniformHash[slot] = h;
+        _uniformLut[slot] = offset + 1;
+        return offset;
+    }
+
+    // Folds call into prev when both draw with the same state and their
+    // geometry is adjacent, returns 1 if it did. Equal uniforms have been
+    // interned, so they share the offset. The renderer may draw the paths of
+    // a merged convex fill in a different order, which gives the same result
+    // for identical paints only with source over blending.
+    int glnvg__mergeCalls(GLNVGcall* prev, const GLNVGcall* call) {
+        NVGcompositeOperationState over =
+            nvg__compositeOperationState(NVG_SOURCE_OVER);
+
+        if (prev->type != call->type || prev->image != call->image) return 0;
+        if (memcmp(&call->blendFunc, &over, sizeof(over)) != 0 ||
+            memcmp(&prev->blendFunc, &over, sizeof(over)) != 0)
+            return 0;
+        if (prev->uniformOffset != call->uniformOffset) return 0;
+        if (prev->hwScissor != call->hwScissor ||
+            memcmp(prev->scissorRect, call->scissorRect,
+                   sizeof(call->scissorRect)) != 0)
+            return 0;
+
+        switch (call->type) {
+            case GLNVG_CONVEXFILL:
+            case GLNVG_CONCAVEFILL:
+            case GLNVG_STROKE:
+                if (prev->pathOffset + prev->pathCount != call->pathOffset ||
+                    prev->indexOffset + prev->indexCount != call->indexOffset)
+                    return 0;
+                prev->pathCount += call->pathCount;
+                // The merged index range interleaves the fills and the
+                // fringes per path, which is drawn in one go.
+                prev->indexCount += call->indexCount;
+                break;
+            case GLNVG_TRIANGLES:
+                if (prev->triangleOffset + prev->triangleCount !=
+                    call->triangleOffset)
+                    return 0;
+                prev->triangleCount += call->triangleCount;
+                break;
+            case GLNVG_INSTANCES:
+                if (prev->instanceOffset + prev->instanceCount !=
+                    call->instanceOffset)
+                    return 0;
+                prev->instanceCount += call->instanceCount;
+                // Drop the unit quad of the merged call.
+                if (call->triangleOffset + call->triangleCount == _nverts)
+                    _nverts = call->triangleOffset;
+                break;
+            default:
+                return 0;
+        }
+        return 1;
+    }
+
+    // Folds the latest call into the previous one.
+    void glnvg__mergeCall() {
+        if (_ncalls < 2) return;
+        if (glnvg__mergeCalls(&_calls[_ncalls - 2], &_calls[_ncalls - 1]))
+            _ncalls--;
+    }
+
+    // Drops the calls reserved by glnvg__deferCall() from first on which
+    // were never recorded, and merges the calls which became adjacent.
+    // Stencil strokes cover overlaps once per call, so they are merged only
+    // if mergeStrokes is set.
+    void glnvg__compactCalls(int first, int mergeStrokes) {
+        int i, n = first;
+        for (i = first; i < _ncalls; i++) {
+            GLNVGcall* call = &_calls[i];
+            if (call->type == GLNVG_NONE) continue;
+            if (n > 0 && (mergeStrokes || call->type != GLNVG_STROKE) &&
+                glnvg__mergeCalls(&_calls[n - 1], call))
+                continue;
+            if (n != i) _calls[n] = _calls[i];
+            n++;
+        }
+        _ncalls = n;
+    }
+
+    // Appends the frame of src, rebasing the offsets of its calls and paths
+    // past the vertices, paths, uniforms, instances and indices recorded so
+    // far. Returns the index of the first appended call, or -1 on failure.
+    int glnvg__append(const NVGDrawImpl* src) {
+        int first = _ncalls;
+        int vbase, pbase, ubase, xbase, ibase, i;
+        GLNVGcall* call;
+
+        vbase = glnvg__allocVerts(src->_nverts);
+        pbase = glnvg__allocPaths(src->_npaths);
+        ubase = glnvg__allocFragUniforms(src->_nuniforms);
+        if (vbase == -1 || pbase == -1 || ubase == -1) return -1;
+        if (glnvg__reserveInstances(src->_ninstances) == NULL) return -1;
+        xbase = glnvg__allocInstances(src->_ninstances);
+        if (_indices == NULL || _nindices + src->_nindices > _cindices) {
+            unsigned int* indices = (unsigned int*)nvg__frameGrow(
+                _allocator, _indices, &_cindices, _nindices + src->_nindices,
+                4096, sizeof(unsigned int));
+            if (indices == NULL) return -1;
+            _indices = indices;
+        }
+        ibase = _nindices;
+        _nindices += src->_nindices;
+
+        if (src->_nverts > 0)
+            memcpy(&_verts[vbase], src->_verts,
+                   sizeof(NVGvertex) * src->_nverts);
+        for (i = 0; i < src->_npaths; i++) {
+            GLNVGpath* path = &_paths[pbase + i];
+            *path = src->_paths[i];
+            path->fillOffset += vbase;
+            path->strokeOffset += vbase;
+        }
+        // The stride differs only if the contexts were given different
+        // uniform sizes.
+        for (i = 0; i < src->_nuniforms; i++)
+            memcpy(&_uniforms[ubase + i * _fragSize],
+                   &src->_uniforms[i * src->_fragSize],
+                   nvg__mini(_fragSize, src->_fragSize));
+        if (src->_ninstances > 0)
+            memcpy(&_instances[xbase], src->_instances,
+                   sizeof(NVGinstance) * src->_ninstances);
+        for (i = 0; i < src->_nindices; i++)
+            _indices[ibase + i] = src->_indices[i] + (unsigned int)vbase;
+
+        for (i = 0; i < src->_ncalls; i++) {
+            if ((call = glnvg__allocCall()) == NULL) return -1;
+            *call = src->_calls[i];
+            call->pathOffset += pbase;
+            call->triangleOffset += vbase;
+            call->instanceOffset += xbase;
+            call->indexOffset += ibase;
+            call->uniformOffset =
+                ubase + call->uniformOffset / src->_fragSize * _fragSize;
+        }
+        return first;
+    }
+
     int glnvg__convertPaint(
         GLNVGfragUniforms* frag, NVGpaint* paint, NVGscissor* scissor,
         float width, float fringe, float strokeThr,
-        const std::function<NVGtextureInfo*(int)>& getTexture) {
-        float invxform[6];
+        const std::function<NVGtextureInfo*(int)>& getTexture,
+        NVGinverse* paintInverse, NVGinverse* scissorInverse) {
+        NVGinverse paintLocal, scissorLocal;
+        const float* invxform;
+        float flipped[6];
+
+        if (paintInverse == NULL) {
+            paintLocal.valid = 0;
+            paintInverse = &paintLocal;
+        }
+        if (scissorInverse == NULL) {
+            scissorLocal.valid = 0;
+            scissorInverse = &scissorLocal;
+        }
 
         memset(frag, 0, sizeof(*frag));
 
@@ -3161,24 +5976,19 @@ class NVGDrawImpl {
         frag->outerCol = glnvg__premulColor(paint->outerColor);
 
         if (scissor->extent[0] < -0.5f || scissor->extent[1] < -0.5f) {
+            // Negative extent skips the scissor mask in the shader.
             memset(frag->scissorMat, 0, sizeof(frag->scissorMat));
-            frag->scissorExt[0] = 1.0f;
-            frag->scissorExt[1] = 1.0f;
+            frag->scissorExt[0] = -1.0f;
+            frag->scissorExt[1] = -1.0f;
             frag->scissorScale[0] = 1.0f;
             frag->scissorScale[1] = 1.0f;
         } else {
-            nvgTransformInverse(invxform, scissor->xform);
-            glnvg__xformToMat3x4(frag->scissorMat, invxform);
+            nvg__cacheScissor(scissorInverse, scissor->xform);
+            glnvg__xformToMat3x4(frag->scissorMat, scissorInverse->xform);
             frag->scissorExt[0] = scissor->extent[0];
             frag->scissorExt[1] = scissor->extent[1];
-            frag->scissorScale[0] =
-                sqrtf(scissor->xform[0] * scissor->xform[0] +
-                      scissor->xform[2] * scissor->xform[2]) /
-                fringe;
-            frag->scissorScale[1] =
-                sqrtf(scissor->xform[1] * scissor->xform[1] +
-                      scissor->xform[3] * scissor->xform[3]) /
-                fringe;
+            frag->scissorScale[0] = scissorInverse->scale[0] / fringe;
+            frag->scissorScale[1] = scissorInverse->scale[1] / fringe;
         }
 
         memcpy(frag->extent, paint->extent, sizeof(frag->extent));
@@ -3188,30 +5998,35 @@ class NVGDrawImpl {
         if (paint->image != 0) {
             auto tex = getTexture(paint->image);
             if (tex == NULL) return 0;
+            nvg__cachePaint(paintInverse, paint->xform);
+            invxform = paintInverse->xform;
             if ((tex->_flags & NVG_IMAGE_FLIPY) != 0) {
-                float m1[6], m2[6];
-                nvgTransformTranslate(m1, 0.0f, frag->extent[1] * 0.5f);
-                nvgTransformMultiply(m1, paint->xform);
-                nvgTransformScale(m2, 1.0f, -1.0f);
-                nvgTransformMultiply(m2, m1);
-                nvgTransformTranslate(m1, 0.0f, -frag->extent[1] * 0.5f);
-                nvgTransformMultiply(m1, m2);
-                nvgTransformInverse(invxform, m1);
-            } else {
-                nvgTransformInverse(invxform, paint->xform);
+                // The image is flipped about its horizontal center line
+                // before the paint transform, flip after the inverse.
+                memcpy(flipped, invxform, sizeof(flipped));
+                flipped[1] = -flipped[1];
+                flipped[3] = -flipped[3];
+                flipped[5] = frag->extent[1] - flipped[5];
+                invxform = flipped;
             }
             frag->type = NSVG_SHADER_FILLIMG;
 
-            if (tex->_type == NVG_TEXTURE_RGBA)
+            if (tex->_type == NVG_TEXTURE_RGBA) {
                 frag->texType = (tex->_flags & NVG_IMAGE_PREMULTIPLIED) ? 0 : 1;
-            else
+            } else if (tex->_flags & NVG_IMAGE_SDF) {
+                // Distance field, the feather widens the edge.
+                frag->texType = 3;
+                frag->feather = paint->feather;
+            } else {
                 frag->texType = 2;
+            }
             //		printf("frag->texType = %d\n", frag->texType);
         } else {
             frag->type = NSVG_SHADER_FILLGRAD;
             frag->radius = paint->radius;
             frag->feather = paint->feather;
-            nvgTransformInverse(invxform, paint->xform);
+            nvg__cachePaint(paintInverse, paint->xform);
+            invxform = paintInverse->xform;
         }
 
         glnvg__xformToMat3x4(frag->paintMat, invxform);
@@ -3227,18 +6042,50 @@ NVGparams::NVGparams() : _draw(new NVGDrawImpl) {}
 
 NVGparams::~NVGparams() { delete _draw; }
 
-NVGdrawData* NVGparams::drawdata() { return _draw->drawdata(); }
-void NVGparams::setViewSize(int width, int height) {
-    _draw->setViewSize(width, height);
+void NVGparams::setAllocator(const NVGallocator* allocator) {
+    _draw->setAllocator(allocator);
+}
+NVGdrawData* NVGparams::drawdata() {
+    return _draw->drawdata(_flags & NVG_COMPACT_VERTICES);
+}
+NVGvertex* NVGparams::reserveVerts(int n) {
+    return _draw->glnvg__reserveVerts(n);
+}
+NVGvertex* NVGparams::allocVerts(int n, int extra) {
+    NVGvertex* verts = _draw->glnvg__reserveVerts(n + extra);
+    if (verts == NULL) return NULL;
+    _draw->glnvg__allocVerts(n);
+    return verts;
+}
+NVGinstance* NVGparams::reserveInstances(int n) {
+    return _draw->glnvg__reserveInstances(n);
+}
+void NVGparams::setViewSize(int width, int height, float devicePixelRatio) {
+    _draw->setViewSize(width, height, devicePixelRatio);
+    _draw->setFragSize(renderUniformSize != NULL ? renderUniformSize() : 256);
 }
 void NVGparams::clear() { _draw->clear(); }
+int NVGparams::deferCall() { return _draw->glnvg__deferCall(); }
+void NVGparams::resumeCall(int call) { _draw->glnvg__resumeCall(call); }
+void NVGparams::compactCalls(int first) {
+    _draw->glnvg__compactCalls(first, !(_flags & NVG_STENCIL_STROKES));
+}
+int NVGparams::appendDrawData(const NVGparams* src) {
+    int first = _draw->glnvg__append(src->_draw);
+    if (first == -1) return 0;
+    // Merges the first appended call with the last one before it.
+    compactCalls(first);
+    return 1;
+}
 
 void NVGparams::callFill(NVGpaint* paint,
                          NVGcompositeOperationState compositeOperation,
                          NVGscissor* scissor, float fringe, const float* bounds,
-                         const NVGpath* paths, int npaths) {
+                         const NVGpath* paths, int npaths,
+                         NVGinverse* paintInverse, NVGinverse* scissorInverse) {
     auto call = _draw->glnvg__allocCall();
     assert(call);
+    scissor = _draw->glnvg__setupScissor(call, scissor);
 
     call->type = GLNVG_FILL;
     call->triangleCount = 4;
@@ -3248,14 +6095,15 @@ void NVGparams::callFill(NVGpaint* paint,
     call->image = paint->image;
     call->blendFunc = compositeOperation;
 
-    if (npaths == 1 && paths[0].convex) {
-        call->type = GLNVG_CONVEXFILL;
+    if (npaths == 1 && (paths[0].convex || paths[0].triangulated)) {
+        call->type = paths[0].convex ? GLNVG_CONVEXFILL : GLNVG_CONCAVEFILL;
         call->triangleCount =
             0;  // Bounding box fill quad not needed for convex fill
     }
 
-    // Allocate vertices for all the paths.
-    int maxverts = glnvg__maxVertCount(paths, npaths) + call->triangleCount;
+    // Allocate vertices for the paths which were not expanded in place.
+    int maxverts =
+        _draw->glnvg__commitVerts(paths, npaths, 1) + call->triangleCount;
     int offset = _draw->glnvg__allocVerts(maxverts);
     if (offset == -1) return;
 
@@ -3264,20 +6112,17 @@ void NVGparams::callFill(NVGpaint* paint,
         const NVGpath* path = &paths[i];
         memset(copy, 0, sizeof(GLNVGpath));
         if (path->nfill > 0) {
-            copy->fillOffset = offset;
+            copy->fillOffset =
+                _draw->glnvg__placeVerts(path->fill, path->nfill, &offset);
             copy->fillCount = path->nfill;
-            memcpy(&_draw->get_vertex(offset), path->fill,
-                   sizeof(NVGvertex) * path->nfill);
-            offset += path->nfill;
         }
         if (path->nstroke > 0) {
-            copy->strokeOffset = offset;
+            copy->strokeOffset =
+                _draw->glnvg__placeVerts(path->stroke, path->nstroke, &offset);
             copy->strokeCount = path->nstroke;
-            memcpy(&_draw->get_vertex(offset), path->stroke,
-                   sizeof(NVGvertex) * path->nstroke);
-            offset += path->nstroke;
         }
     }
+    if (_flags & NVG_INDEXED) _draw->glnvg__indexCall(call);
 
     // Setup uniforms for draw calls
     if (call->type == GLNVG_FILL) {
@@ -3298,10 +6143,14 @@ void NVGparams::callFill(NVGpaint* paint,
         frag->type = NSVG_SHADER_SIMPLE;
         // Fill shader
         _draw->glnvg__convertPaint(
-            _draw->nvg__fragUniformPtr(call->uniformOffset + fragSize()), paint,
-            scissor, fringe, fringe, -1.0f, [this](int image) {
+            _draw->nvg__fragUniformPtr(call->uniformOffset +
+                                       _draw->fragSize()),
+            paint, scissor, fringe, fringe, -1.0f, [this](int image) {
                 return this->renderGetTexture(nullptr, image);
-            });
+            },
+            paintInverse, scissorInverse);
+        call->uniformOffset =
+            _draw->glnvg__internFragUniforms(call->uniformOffset, 2);
     } else {
         call->uniformOffset = _draw->glnvg__allocFragUniforms(1);
         if (call->uniformOffset == -1) return;
@@ -3310,16 +6159,23 @@ void NVGparams::callFill(NVGpaint* paint,
             _draw->nvg__fragUniformPtr(call->uniformOffset), paint, scissor,
             fringe, fringe, -1.0f, [this](int image) {
                 return this->renderGetTexture(nullptr, image);
-            });
+            },
+            paintInverse, scissorInverse);
+        call->uniformOffset =
+            _draw->glnvg__internFragUniforms(call->uniformOffset, 1);
+        _draw->glnvg__mergeCall();
     }
 }
 
 void NVGparams::callStroke(NVGpaint* paint,
                            NVGcompositeOperationState compositeOperation,
                            NVGscissor* scissor, float fringe, float strokeWidth,
-                           const NVGpath* paths, int npaths) {
+                           const NVGpath* paths, int npaths,
+                           NVGinverse* paintInverse,
+                           NVGinverse* scissorInverse) {
     GLNVGcall* call = _draw->glnvg__allocCall();
     assert(call);
+    scissor = _draw->glnvg__setupScissor(call, scissor);
     int i, maxverts, offset;
 
     call->type = GLNVG_STROKE;
@@ -3329,8 +6185,8 @@ void NVGparams::callStroke(NVGpaint* paint,
     call->image = paint->image;
     call->blendFunc = compositeOperation;
 
-    // Allocate vertices for all the paths.
-    maxverts = glnvg__maxVertCount(paths, npaths);
+    // Allocate vertices for the paths which were not expanded in place.
+    maxverts = _draw->glnvg__commitVerts(paths, npaths, 0);
     offset = _draw->glnvg__allocVerts(maxverts);
     if (offset == -1) return;
 
@@ -3339,13 +6195,12 @@ void NVGparams::callStroke(NVGpaint* paint,
         const NVGpath* path = &paths[i];
         memset(copy, 0, sizeof(GLNVGpath));
         if (path->nstroke) {
-            copy->strokeOffset = offset;
+            copy->strokeOffset =
+                _draw->glnvg__placeVerts(path->stroke, path->nstroke, &offset);
             copy->strokeCount = path->nstroke;
-            memcpy(&_draw->get_vertex(offset), path->stroke,
-                   sizeof(NVGvertex) * path->nstroke);
-            offset += path->nstroke;
         }
     }
+    if (_flags & NVG_INDEXED) _draw->glnvg__indexCall(call);
 
     if (_flags & NVG_STENCIL_STROKES) {
         // Fill shader
@@ -3356,13 +6211,18 @@ void NVGparams::callStroke(NVGpaint* paint,
             _draw->nvg__fragUniformPtr(call->uniformOffset), paint, scissor,
             strokeWidth, fringe, -1.0f, [this](int image) {
                 return this->renderGetTexture(nullptr, image);
-            });
+            },
+            paintInverse, scissorInverse);
         _draw->glnvg__convertPaint(
-            _draw->nvg__fragUniformPtr(call->uniformOffset + fragSize()), paint,
-            scissor, strokeWidth, fringe, 1.0f - 0.5f / 255.0f,
+            _draw->nvg__fragUniformPtr(call->uniformOffset +
+                                       _draw->fragSize()),
+            paint, scissor, strokeWidth, fringe, 1.0f - 0.5f / 255.0f,
             [this](int image) {
                 return this->renderGetTexture(nullptr, image);
-            });
+            },
+            paintInverse, scissorInverse);
+        call->uniformOffset =
+            _draw->glnvg__internFragUniforms(call->uniformOffset, 2);
     } else {
         // Fill shader
         call->uniformOffset = _draw->glnvg__allocFragUniforms(1);
@@ -3371,18 +6231,25 @@ void NVGparams::callStroke(NVGpaint* paint,
             _draw->nvg__fragUniformPtr(call->uniformOffset), paint, scissor,
             strokeWidth, fringe, -1.0f, [this](int image) {
                 return this->renderGetTexture(nullptr, image);
-            });
+            },
+            paintInverse, scissorInverse);
+        call->uniformOffset =
+            _draw->glnvg__internFragUniforms(call->uniformOffset, 1);
+        _draw->glnvg__mergeCall();
     }
 }
 
 void NVGparams::callTriangles(NVGpaint* paint,
                               NVGcompositeOperationState compositeOperation,
                               NVGscissor* scissor, const NVGvertex* verts,
-                              int nverts, float fringe) {
+                              int nverts, float fringe,
+                              NVGinverse* paintInverse,
+                              NVGinverse* scissorInverse) {
     GLNVGcall* call = _draw->glnvg__allocCall();
     GLNVGfragUniforms* frag;
 
     if (call == NULL) return;
+    scissor = _draw->glnvg__setupScissor(call, scissor);
 
     call->type = GLNVG_TRIANGLES;
     call->image = paint->image;
@@ -3402,10 +6269,111 @@ void NVGparams::callTriangles(NVGpaint* paint,
     frag = _draw->nvg__fragUniformPtr(call->uniformOffset);
     _draw->glnvg__convertPaint(
         frag, paint, scissor, 1.0f, fringe, -1.0f,
-        [this](int image) { return this->renderGetTexture(nullptr, image); });
+        [this](int image) { return this->renderGetTexture(nullptr, image); },
+        paintInverse, scissorInverse);
     frag->type = NSVG_SHADER_IMG;
+    call->uniformOffset =
+        _draw->glnvg__internFragUniforms(call->uniformOffset, 1);
+    _draw->glnvg__mergeCall();
+}
+
+void NVGparams::callInstances(NVGpaint* paint,
+                              NVGcompositeOperationState compositeOperation,
+                              NVGscissor* scissor, float fringe, int n,
+                              NVGinverse* paintInverse,
+                              NVGinverse* scissorInverse) {
+    GLNVGcall* call = _draw->glnvg__allocCall();
+    NVGvertex* quad;
+
+    if (call == NULL) return;
+    scissor = _draw->glnvg__setupScissor(call, scissor);
+
+    call->type = GLNVG_INSTANCES;
+    call->image = paint->image;
+    call->blendFunc = compositeOperation;
+
+    // Unit quad, expanded per instance in the vertex shader.
+    call->triangleOffset = _draw->glnvg__allocVerts(4);
+    if (call->triangleOffset == -1) return;
+    call->triangleCount = 4;
+    quad = &_draw->get_vertex(call->triangleOffset);
+    glnvg__vset(&quad[0], 1.0f, 1.0f, 0.0f, 0.0f);
+    glnvg__vset(&quad[1], 1.0f, -1.0f, 0.0f, 0.0f);
+    glnvg__vset(&quad[2], -1.0f, 1.0f, 0.0f, 0.0f);
+    glnvg__vset(&quad[3], -1.0f, -1.0f, 0.0f, 0.0f);
+
+    call->instanceOffset = _draw->glnvg__allocInstances(n);
+    call->instanceCount = n;
+
+    call->uniformOffset = _draw->glnvg__allocFragUniforms(1);
+    if (call->uniformOffset == -1) return;
+    _draw->glnvg__convertPaint(
+        _draw->nvg__fragUniformPtr(call->uniformOffset), paint, scissor,
+        fringe, fringe, -1.0f,
+        [this](int image) { return this->renderGetTexture(nullptr, image); },
+        paintInverse, scissorInverse);
+    call->uniformOffset =
+        _draw->glnvg__internFragUniforms(call->uniformOffset, 1);
+    _draw->glnvg__mergeCall();
+}
+
+void nvgDrawRecorder(NVGcontext* ctx, NVGcontext* recorder) {
+    if (recorder == NULL || recorder->fontOwner != ctx) return;
+    if (!ctx->params.appendDrawData(&recorder->params)) return;
+    ctx->drawCallCount += recorder->drawCallCount;
+    ctx->fillTriCount += recorder->fillTriCount;
+    ctx->strokeTriCount += recorder->strokeTriCount;
+    ctx->textTriCount += recorder->textTriCount;
+    ctx->culledFillCount += recorder->culledFillCount;
+    ctx->culledStrokeCount += recorder->culledStrokeCount;
+    ctx->culledInstanceCount += recorder->culledInstanceCount;
+}
+
+static void nvg__rasterizeGlyphJob(void* userPtr, int worker, int index) {
+    fonsRasterizeGlyph(((NVGcontext*)userPtr)->fs, index, worker);
+}
+
+// Rasterizes the glyphs NVG_ASYNC_GLYPHS left empty in the font atlas, on
+// the tessellation threads, until the time budget of the frame runs out.
+// The rest stay empty until the next frame.
+static void nvg__rasterizeGlyphs(NVGcontext* ctx) {
+    NVGtessPool* pool = ctx->tessPool;
+    auto start = std::chrono::steady_clock::now();
+    int i, n, batch = NVG_GLYPH_BATCH_SIZE;
+
+    if (pool != NULL) batch *= pool->nworkers;
+    while ((n = fonsGetPendingGlyphs(ctx->fs)) > 0) {
+        if (ctx->glyphBudget > 0.0f) n = nvg__mini(n, batch);
+        if (pool != NULL) {
+            nvg__runJobs(pool, n, nvg__rasterizeGlyphJob, ctx);
+        } else {
+            for (i = 0; i < n; i++) fonsRasterizeGlyph(ctx->fs, i, 0);
+        }
+        fonsCommitGlyphs(ctx->fs, n);
+        std::chrono::duration<float, std::milli> elapsed =
+            std::chrono::steady_clock::now() - start;
+        if (ctx->glyphBudget > 0.0f && elapsed.count() >= ctx->glyphBudget)
+            break;
+    }
+}
+
+void nvgGlyphRasterBudget(NVGcontext* ctx, float ms) {
+    ctx->glyphBudget = ms;
 }
 
 NVGdrawData* nvgGetDrawData(struct NVGcontext* ctx) {
+    nvg__flushTessellation(ctx);
+    if (ctx->fs != NULL && ctx->fontOwner == NULL) {
+        // Rasterize the deferred glyphs, upload the glyphs the recorders
+        // added, and add the atlas page they could not add themselves.
+        NVGfontLock lock(ctx);
+        if (ctx->atlasFull) {
+            ctx->atlasFull = 0;
+            if (fonsGetPageCount(ctx->fs) < ctx->maxFontPages)
+                fonsAddPage(ctx->fs);
+        }
+        if (fonsGetPendingGlyphs(ctx->fs) > 0) nvg__rasterizeGlyphs(ctx);
+        nvg__flushTextTexture(ctx);
+    }
     return ctx->params.drawdata();
 }
@@ -48,6 +48,38 @@ enum NVGcreateFlags {
     NVG_STENCIL_STROKES = 1 << 1,
     // Flag indicating that additional debug checks are done.
     NVG_DEBUG = 1 << 2,
+    // Flag indicating that tessellated fill and stroke geometry is retained
+    // between frames and reused when the same path is drawn again with the
+    // same style. See nvgGeometryCacheBudget().
+    NVG_GEOMETRY_CACHE = 1 << 3,
+    // Flag indicating that the draw data carries an index buffer. The fill
+    // fans and the stroke strips of each call are converted to triangle
+    // lists, so that a call draws all its paths with one glDrawElements.
+    NVG_INDEXED = 1 << 4,
+    // Flag indicating that the vertices are handed to the renderer as 8 byte
+    // NVGcompactVertex when the frame fits in their range.
+    NVG_COMPACT_VERTICES = 1 << 5,
+    // Flag indicating that nvgFill() and nvgStroke() only record the path
+    // and its style, and the tessellation of all the recorded paths is done
+    // by nvgGetDrawData() on a pool of threads. The draw calls keep their
+    // order. The fill and stroke triangles of nvgFrameStats() are counted
+    // by nvgGetDrawData() as well. Ignored on a single core machine.
+    NVG_DEFERRED_TESSELLATION = 1 << 6,
+    // Flag indicating that the glyph quads laid out by nvgText() are
+    // retained between frames and reused when the same string is drawn
+    // again with the same text style. See nvgTextCacheBudget().
+    NVG_TEXT_CACHE = 1 << 7,
+    // Flag indicating that glyphs missing from the font atlas are not
+    // rasterized by the text calls. They are rasterized together by
+    // nvgGetDrawData(), on a pool of threads, within the time budget of
+    // nvgGlyphRasterBudget(). Glyphs over the budget are drawn empty until
+    // a later frame rasterizes them. Not supported with FreeType.
+    NVG_ASYNC_GLYPHS = 1 << 8,
+    // Flag indicating that glyphs are kept in the font atlas as signed
+    // distance fields, one per code point at a reference size, and scaled
+    // when drawn. Text of any size or zoom needs no new glyphs, and font
+    // blur is applied by the shader. Not supported with FreeType.
+    NVG_SDF_TEXT = 1 << 9,
 };
 
 typedef struct NVGcontext NVGcontext;
@@ -83,6 +115,11 @@ enum NVGsolidity {
     NVG_HOLE = 2,   // CW
 };
 
+enum NVGpolylineFlags {
+    NVG_POLYLINE_CLOSED = 1 << 0,    // Close the sub-path after the last point.
+    NVG_POLYLINE_DECIMATE = 1 << 1,  // Reduce points per device pixel column.
+};
+
 enum NVGlineCap {
     NVG_BUTT,
     NVG_ROUND,
@@ -169,6 +206,8 @@ enum NVGimageFlags {
     NVG_IMAGE_PREMULTIPLIED = 1 << 4,  // Image data has premultiplied alpha.
     NVG_IMAGE_NEAREST =
         1 << 5,  // Image interpolation is Nearest instead Linear
+    NVG_IMAGE_SDF =
+        1 << 6,  // Alpha image holds a distance field with the edge at 0.5.
 };
 
 // Begin drawing a new frame
@@ -258,6 +297,8 @@ NVGcolor nvgHSLA(float h, float s, float l, unsigned char a);
 
 // Pushes and saves the current render state into a state stack.
 // A matching nvgRestore() must be used to restore the state.
+// The stack grows as needed. Saving is cheap, the parts of the state
+// (transform, paint, scissor and text) are copied when first changed.
 void nvgSave(NVGcontext *ctx);
 
 // Pops and restores current render state.
@@ -559,6 +600,22 @@ void nvgClosePath(NVGcontext *ctx);
 // Sets the current sub-path winding, see NVGwinding and NVGsolidity.
 void nvgPathWinding(NVGcontext *ctx, int dir);
 
+// Creates new sub-path from n points stored as interleaved x,y pairs. The
+// points are appended in one batch which is much cheaper than calling
+// nvgMoveTo() and nvgLineTo() per point. Flags is a combination of
+// NVGpolylineFlags, passing 1 closes the sub-path.
+void nvgPolyline(NVGcontext *ctx, const float *xy, int n, int flags);
+
+// Like nvgPolyline(), but reads x and y from separate arrays. The strides are
+// the distances in bytes between consecutive x and y values, which allows
+// plotting columns of an array of structs directly.
+// With NVG_POLYLINE_DECIMATE, consecutive points which fall in the same device
+// pixel column are reduced to the first, lowest, highest and last of them.
+// For series sorted by x this keeps the plot identical while the cost is
+// bound by the plot width rather than the number of samples.
+void nvgPolylineStrided(NVGcontext *ctx, const float *x, int xstride,
+                        const float *y, int ystride, int n, int flags);
+
 // Creates new circle arc shaped sub-path. The arc center is at cx,cy, the
 // arc radius is r, and the arc is drawn from angle a0 to a1, and swept in
 // direction dir (NVG_CCW, or NVG_CW). Angles are specified in radians.
@@ -590,6 +647,106 @@ void nvgFill(NVGcontext *ctx);
 // Fills the current path with current stroke style.
 void nvgStroke(NVGcontext *ctx);
 
+//
+// Batches
+//
+// Draw many rectangles with a single draw call, for heatmaps, charts and
+// the like. The batch functions clear the current path, as nvgBeginPath()
+// does, since skewed transforms fall back to filling path rectangles.
+
+// Fills n rectangles stored as x,y,w,h quadruples in rects. Each rectangle is
+// filled with its color from colors, or with the current fill paint when
+// colors is NULL. Global alpha, composite operation and scissor apply to the
+// whole batch.
+void nvgRects(NVGcontext *ctx, const float *rects, const NVGcolor *colors,
+              int n);
+
+// Like nvgRects(), but with a corner radius per rectangle. Radii may be NULL
+// for square corners. The radius is clamped to half of the shorter side.
+void nvgRoundedRects(NVGcontext *ctx, const float *rects, const float *radii,
+                     const NVGcolor *colors, int n);
+
+//
+// Geometry cache
+//
+// When the context is created with NVG_GEOMETRY_CACHE, nvgFill() and
+// nvgStroke() look up the tessellated geometry of the current path from a
+// cache keyed by the transformed path commands and the stroke style (width,
+// join, cap, miter limit and fringe). A path is added to the cache the
+// second time it is seen, so geometry which changes every frame does not
+// churn the cache. Least recently used entries are evicted when the cache
+// grows over its byte budget.
+
+struct NVGgeometryCacheStats {
+    int hits;       // Number of fills and strokes served from the cache.
+    int misses;     // Number of fills and strokes which were tessellated.
+    int evictions;  // Number of entries evicted to stay under the budget.
+    int entries;    // Number of entries currently in the cache.
+    int bytes;      // Memory currently used by the cache entries.
+};
+typedef struct NVGgeometryCacheStats NVGgeometryCacheStats;
+
+// Sets the memory budget of the geometry cache in bytes, evicting entries if
+// needed. The default budget is 4MB.
+void nvgGeometryCacheBudget(NVGcontext *ctx, int bytes);
+
+// Returns the geometry cache counters. The hit, miss and eviction counts are
+// accumulated since the context was created. All values are zero if the
+// context was not created with NVG_GEOMETRY_CACHE.
+void nvgGeometryCacheStats(NVGcontext *ctx, NVGgeometryCacheStats *stats);
+
+//
+// Frame statistics
+//
+// Counters of the current frame, reset by nvgBeginFrame(). Fills, strokes
+// and batch rectangles whose bounds are outside the view and the current
+// scissor are skipped before tessellation and counted as culled.
+
+struct NVGframeStats {
+    int drawCalls;        // Number of fills, strokes, batches and text runs.
+    int fillTriangles;    // Number of triangles produced by fills.
+    int strokeTriangles;  // Number of triangles produced by strokes.
+    int textTriangles;    // Number of triangles produced by text.
+    int culledFills;      // Number of fills which were culled.
+    int culledStrokes;    // Number of strokes which were culled.
+    int culledInstances;  // Number of batch rectangles which were culled.
+};
+typedef struct NVGframeStats NVGframeStats;
+
+// Returns the counters of the current frame.
+void nvgFrameStats(NVGcontext *ctx, NVGframeStats *stats);
+
+//
+// Frame memory
+//
+// The path commands, the flattened paths and the draw data built during a
+// frame are allocated from a frame allocator which is reset by
+// nvgBeginFrame(). The default allocator is a bump arena owned by the
+// context. It keeps its memory between frames and, after a frame which did
+// not fit in its block, replaces the blocks with a single block of the high
+// water mark size, so that a steady state frame does no heap calls.
+
+struct NVGallocator {
+    // Resizes a block returned earlier by the allocator from oldSize to
+    // newSize bytes, or allocates a new block if ptr is NULL. The contents
+    // up to the smaller size must be preserved. Returns NULL on failure.
+    void *(*reallocate)(void *userPtr, void *ptr, size_t oldSize,
+                        size_t newSize);
+    // Releases all the memory handed out since the previous reset.
+    void (*reset)(void *userPtr);
+    void *userPtr;
+};
+typedef struct NVGallocator NVGallocator;
+
+// Sets the frame allocator of the context. Passing NULL restores the default
+// arena. Must be called outside of a frame, the memory allocated with the
+// previous allocator is released.
+void nvgFrameAllocator(NVGcontext *ctx, const NVGallocator *allocator);
+
+// Returns the largest amount of memory the default arena has used during a
+// single frame, in bytes.
+size_t nvgFrameMemoryHighWater(NVGcontext *ctx);
+
 //
 // Text
 //
@@ -732,6 +889,70 @@ void nvgTextMetrics(NVGcontext *ctx, float *ascender, float *descender,
 int nvgTextBreakLines(NVGcontext *ctx, const char *string, const char *end,
                       float breakRowWidth, NVGtextRow *rows, int maxRows);
 
+// Sets the memory budget of the glyph atlas in bytes. Glyphs are packed to
+// 512x512 alpha texture pages which are added as needed up to the budget,
+// after that the least recently used page is emptied and its glyphs are
+// rasterized again when drawn. Pages in use by the current frame are never
+// emptied, glyphs which do not fit are skipped. The budget is at least one
+// page and at most 16, the default is 4MB. Call it between frames, on the
+// context which created any recorders.
+void nvgTextAtlasBudget(NVGcontext *ctx, int bytes);
+
+// Saves the glyph atlas and the glyphs of the fonts to a file, so that a
+// later run can start with the glyphs already rasterized. Each font is
+// keyed by a hash of its data. Returns 1 on success.
+int nvgSaveFontAtlas(NVGcontext *ctx, const char *filename);
+
+// Loads a glyph atlas saved by nvgSaveFontAtlas() and uploads it as the
+// font textures. Call it after the fonts are created and before text is
+// drawn, glyphs of fonts missing from the file are rasterized as usual.
+// Fails if the file was saved by a different version, with a different
+// NVG_SDF_TEXT setting or with more pages than the atlas budget.
+int nvgLoadFontAtlas(NVGcontext *ctx, const char *filename);
+
+// Loads the atlas from memory, for example from a memory mapped file. The
+// data is copied and not kept.
+int nvgLoadFontAtlasMem(NVGcontext *ctx, const unsigned char *data,
+                        int ndata);
+
+// Sets the time nvgGetDrawData() may spend on rasterizing the glyphs of
+// NVG_ASYNC_GLYPHS in milliseconds. The budget is checked between batches
+// of glyphs, so a frame may go a batch over it. A budget of zero or less
+// rasterizes all glyphs in the frame they are first drawn. The default
+// budget is 4ms.
+void nvgGlyphRasterBudget(NVGcontext *ctx, float ms);
+
+//
+// Text layout cache
+//
+// When the context is created with NVG_TEXT_CACHE, nvgText() and
+// nvgTextBox() look up the glyph quads of a string from a cache keyed by
+// the string, font, size, letter spacing, blur, align and the sub-pixel
+// position of the text. The quads are kept in font pixels and transformed
+// by the current transform when drawn, so text which only moves by whole
+// pixels or is transformed differently still hits. Like the geometry cache,
+// a layout is added the second time it is seen, least recently used
+// layouts are evicted over the byte budget, and layouts are dropped when
+// fonts are added or the font atlas is reset.
+
+struct NVGtextCacheStats {
+    int hits;       // Number of strings served from the cache.
+    int misses;     // Number of strings which were laid out.
+    int evictions;  // Number of layouts evicted to stay under the budget.
+    int entries;    // Number of layouts currently in the cache.
+    int bytes;      // Memory currently used by the cached layouts.
+};
+typedef struct NVGtextCacheStats NVGtextCacheStats;
+
+// Sets the memory budget of the text layout cache in bytes, evicting
+// layouts if needed. The default budget is 4MB.
+void nvgTextCacheBudget(NVGcontext *ctx, int bytes);
+
+// Returns the text layout cache counters. The hit, miss and eviction counts
+// are accumulated since the context was created. All values are zero if
+// the context was not created with NVG_TEXT_CACHE.
+void nvgTextCacheStats(NVGcontext *ctx, NVGtextCacheStats *stats);
+
 //
 // Internal Render API
 //
@@ -751,6 +972,20 @@ struct NVGvertex {
 };
 typedef struct NVGvertex NVGvertex;
 
+// Vertex of NVG_COMPACT_VERTICES. The position is in 1/NVG_COMPACT_SUBPIXELS
+// pixels, the texture coordinates are unsigned normalized.
+#define NVG_COMPACT_SUBPIXELS 8
+struct NVGcompactVertex {
+    short x, y;
+    unsigned short u, v;
+};
+typedef struct NVGcompactVertex NVGcompactVertex;
+
+enum NVGvertexFormat {
+    NVG_VERTEX_FLOAT,    // NVGvertex
+    NVG_VERTEX_COMPACT,  // NVGcompactVertex
+};
+
 struct NVGpath {
     int first;
     int count;
@@ -762,6 +997,7 @@ struct NVGpath {
     int nstroke;
     int winding;
     int convex;
+    int triangulated;  // The fill is a triangle list instead of a fan.
 };
 typedef struct NVGpath NVGpath;
 
@@ -785,10 +1021,24 @@ enum GLNVGcallType {
     GLNVG_NONE = 0,
     GLNVG_FILL,
     GLNVG_CONVEXFILL,
+    GLNVG_CONCAVEFILL,  // Simple polygon triangulated on the CPU.
     GLNVG_STROKE,
     GLNVG_TRIANGLES,
+    GLNVG_INSTANCES,  // Unit quad drawn once per NVGinstance.
 };
 
+// Per instance attributes of GLNVG_INSTANCES calls, a rounded rectangle in
+// pixels. The quad corners in the vertex buffer are at (+-1, +-1).
+struct NVGinstance {
+    float x, y;      // Center.
+    float ux, uy;    // Unit x axis of the rectangle, y axis is (-uy, ux).
+    float ex, ey;    // Half extents.
+    float radius;    // Corner radius.
+    float fringe;    // Anti-aliasing width.
+    NVGcolor color;  // Premultiplied, multiplies the paint.
+};
+typedef struct NVGinstance NVGinstance;
+
 struct GLNVGcall {
     int type;
     int image;
@@ -796,7 +1046,18 @@ struct GLNVGcall {
     int pathCount;
     int triangleOffset;
     int triangleCount;
+    int instanceOffset;
+    int instanceCount;
     int uniformOffset;
+    // NVG_INDEXED: triangle list indices of the paths, the fills first and
+    // then the fringes or strokes. Zero when the call has no indices.
+    int indexOffset;
+    int indexCount;
+    int fillIndexCount;
+    // Scissor applied with glScissor instead of in the fragment shader,
+    // x, y, width and height in device pixels from the top left corner.
+    int hwScissor;
+    int scissorRect[4];
     struct NVGcompositeOperationState blendFunc;
 };
 
@@ -809,13 +1070,23 @@ struct GLNVGpath {
 
 struct NVGdrawData {
     float view[2];
+    float devicePixelRatio;
     GLNVGcall *drawData;
     size_t drawCount;
     void *pUniform;
     int uniformByteSize;
     NVGvertex *pVertex;
     int vertexCount;
+    // NVG_VERTEX_COMPACT when pCompactVertex holds the vertices to upload,
+    // pVertex is still valid.
+    int vertexFormat;
+    NVGcompactVertex *pCompactVertex;
     GLNVGpath *pPath;
+    NVGinstance *pInstance;
+    int instanceCount;
+    void *pIndex;
+    int indexCount;
+    int indexSize;  // 2 or 4 bytes, 2 when all the vertices can be reached.
 };
 
 enum GLNVGshaderType {
@@ -849,6 +1120,9 @@ struct NVGparams {
                                                int image) = {};
 
     // shader interface
+    // Returns the stride of the uniform blocks in NVGdrawData, the size of
+    // GLNVGfragUniforms rounded up to the uniform buffer offset alignment.
+    // 256 bytes are used when not set.
     int (*renderUniformSize)() = {};
 
     int _flags = {};
@@ -857,21 +1131,58 @@ struct NVGparams {
 	~NVGparams();
 
     class NVGDrawImpl *_draw = {};
+    // Sets the allocator the per frame buffers are allocated from.
+    void setAllocator(const NVGallocator *allocator);
     NVGdrawData *drawdata();
-    void setViewSize(int width, int height);
+    // Returns room for n vertices at the end of the frame vertex buffer.
+    // Paths whose vertices are written there are recorded without a copy.
+    NVGvertex *reserveVerts(int n);
+    // Takes n vertices at the end of the frame vertex buffer into use and
+    // returns them. There is room for extra more vertices behind them, so
+    // that the buffer does not move while they are recorded.
+    NVGvertex *allocVerts(int n, int extra);
+    void setViewSize(int width, int height, float devicePixelRatio);
     void clear();
+    // Reserves a draw call which is recorded later, keeping its place in the
+    // frame. Returns its index, or -1 on failure.
+    int deferCall();
+    // The next call*() records the call reserved by deferCall() instead of
+    // adding one.
+    void resumeCall(int call);
+    // Drops the reserved calls from index first on which were never
+    // recorded, and merges the calls which became adjacent.
+    void compactCalls(int first);
+    // Appends the calls recorded in src this frame, with its vertices,
+    // paths, uniforms, instances and indices. Returns 0 on failure.
+    int appendDrawData(const NVGparams *src);
+    // paintInverse and scissorInverse are the inverse transforms nanovg
+    // caches for the paint and scissor, filled in when not yet computed.
+    // When NULL they are computed per call.
     void callFill(NVGpaint *paint,
                   NVGcompositeOperationState compositeOperation,
                   NVGscissor *scissor, float fringe, const float *bounds,
-                  const NVGpath *paths, int npaths);
+                  const NVGpath *paths, int npaths,
+                  struct NVGinverse *paintInverse = nullptr,
+                  struct NVGinverse *scissorInverse = nullptr);
     void callStroke(NVGpaint *paint,
                     NVGcompositeOperationState compositeOperation,
                     NVGscissor *scissor, float fringe, float strokeWidth,
-                    const NVGpath *paths, int npaths);
+                    const NVGpath *paths, int npaths,
+                    struct NVGinverse *paintInverse = nullptr,
+                    struct NVGinverse *scissorInverse = nullptr);
     void callTriangles(NVGpaint *paint,
                        NVGcompositeOperationState compositeOperation,
                        NVGscissor *scissor, const NVGvertex *verts, int nverts,
-                       float fringe);
+                       float fringe, struct NVGinverse *paintInverse = nullptr,
+                       struct NVGinverse *scissorInverse = nullptr);
+    // Returns room for n instances at the end of the frame instance buffer.
+    NVGinstance *reserveInstances(int n);
+    // Records a draw call for n instances written to reserveInstances().
+    void callInstances(NVGpaint *paint,
+                       NVGcompositeOperationState compositeOperation,
+                       NVGscissor *scissor, float fringe, int n,
+                       struct NVGinverse *paintInverse = nullptr,
+                       struct NVGinverse *scissorInverse = nullptr);
 };
 typedef struct NVGparams NVGparams;
 
@@ -881,6 +1192,20 @@ void nvgDelete(NVGcontext *ctx);
 
 NVGparams *nvgParams(NVGcontext *ctx);
 
+// Recorders let several threads record a frame at once. A recorder is a
+// context of its own which shares the fonts and images of ctx, each thread
+// records into its own recorder between nvgBeginFrame() and
+// nvgDrawRecorder(). Text functions serialize on a lock shared with ctx.
+// Images must be created and deleted on ctx, and recorders deleted before
+// ctx. Glyphs which do not fit the font atlas while recording are dropped
+// until ctx has grown the atlas in nvgGetDrawData(), the next frame.
+NVGcontext *nvgCreateRecorder(NVGcontext *ctx);
+
+// Appends the frame recorder has finished to the frame of ctx at this
+// point, so the order of the panels does not depend on the threads.
+// Call it once the recording thread is done with the frame.
+void nvgDrawRecorder(NVGcontext *ctx, NVGcontext *recorder);
+
 // Debug function to dump cached path data.
 void nvgDebugDumpPathCache(NVGcontext *ctx);
 